@@ -0,0 +1,329 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+/*
+ * Hot path microbenchmarks, built against the POSIX port:
+ *
+ *   cc -O2 -DFSM_PORT_POSIX=1 state_machine.c state_machine_executor.c state_machine_graph.c \
+ *      state_machine_mailbox.c state_machine_map.c state_machine_name.c state_machine_pool.c \
+ *      state_machine_port_log.c state_machine_port_posix.c state_machine_slab.c \
+ *      state_machine_timer.c state_machine_trace.c state_machine_transition.c \
+ *      bench/bench_state_machine.c -o bench_state_machine -lpthread
+ *
+ * Usage: bench_state_machine [-n max_states] [-d max_depth] [-t ms_per_benchmark]
+ *
+ * One CSV record per benchmark is written to stdout:
+ *   benchmark,states,depth,iterations,ns_per_op
+ *
+ * "states" is the number of states in the innermost FSM, "depth" the number of nested FSMs
+ * between the polled root and that FSM (depth 1 is a single flat FSM). Polls are issued on the
+ * root, sends and switches target the innermost FSM.
+ */
+
+/*--- Private dependencies -------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../state_machine.h"
+#include "../state_machine_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BENCH_EVENT			 0xBE00
+#define BENCH_MAX_DEPTH		 16
+#define BENCH_SEND_BATCH	 8
+#define BENCH_DEFAULT_TIME	 50
+#define BENCH_MIN_ITERATIONS 16
+
+/*--- Private type definitions ---------------------------------------------------*/
+struct bench_ctx {
+	fsm_t	 chain[BENCH_MAX_DEPTH];  // chain[0] is the root, chain[depth - 1] the leaf
+	state_t	 hosts[BENCH_MAX_DEPTH];
+	uint32_t depth;
+	uint32_t states;
+	char   **names;
+	uint32_t cursor;
+	double	 timer_overhead;
+};
+
+typedef double (*bench_fn_t)(struct bench_ctx *ctx, uint64_t iterations);
+
+/*--- Private variable definitions -----------------------------------------------*/
+static volatile uint32_t handler_calls = 0;
+static uint64_t			 time_budget_ns;
+
+/*--- Private function definitions -----------------------------------------------*/
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void bench_handler(event_t event) {
+	(void)event;
+	handler_calls = handler_calls + 1;
+}
+
+static fsm_t leaf(struct bench_ctx *ctx) {
+	return ctx->chain[ctx->depth - 1];
+}
+
+// Walk through the states with a stride so lookups do not always hit the list head
+static uint32_t next_target(struct bench_ctx *ctx) {
+	ctx->cursor = (ctx->cursor + 7919u) % ctx->states;
+	return ctx->cursor;
+}
+
+static double bench_poll_idle(struct bench_ctx *ctx, uint64_t iterations) {
+	fsm_t	 root = ctx->chain[0];
+	uint64_t t0	  = now_ns();
+	for(uint64_t i = 0; i < iterations; i++) {
+		fsm_poll(root);
+	}
+	return (double)(now_ns() - t0);
+}
+
+static double bench_poll_event(struct bench_ctx *ctx, uint64_t iterations) {
+	fsm_t	 root  = ctx->chain[0];
+	uint64_t total = 0;
+	for(uint64_t i = 0; i < iterations; i++) {
+		fsm_event_send(root, BENCH_EVENT, NULL, 0);
+		uint64_t t0 = now_ns();
+		fsm_poll(root);
+		total += now_ns() - t0;
+	}
+	return (double)total - ctx->timer_overhead * (double)iterations;
+}
+
+static double bench_event_send(struct bench_ctx *ctx, uint64_t iterations) {
+	fsm_t	 fsm   = leaf(ctx);
+	uint64_t total = 0;
+	uint64_t done  = 0;
+	while(done < iterations) {
+		uint64_t batch = iterations - done;
+		if(batch > BENCH_SEND_BATCH) {
+			batch = BENCH_SEND_BATCH;
+		}
+		uint64_t t0 = now_ns();
+		for(uint64_t i = 0; i < batch; i++) {
+			fsm_event_send(fsm, BENCH_EVENT, NULL, 0);
+		}
+		total += now_ns() - t0;
+		fsm_event_clear(fsm);
+		done += batch;
+	}
+	return (double)total - ctx->timer_overhead * (double)(iterations / BENCH_SEND_BATCH + 1);
+}
+
+static double bench_switch(struct bench_ctx *ctx, uint64_t iterations) {
+	fsm_t	 fsm   = leaf(ctx);
+	uint64_t total = 0;
+	for(uint64_t i = 0; i < iterations; i++) {
+		uint32_t id = next_target(ctx);
+		uint64_t t0 = now_ns();
+		fsm_switch(fsm, id);
+		total += now_ns() - t0;
+		fsm_poll(fsm);
+	}
+	return (double)total - ctx->timer_overhead * (double)iterations;
+}
+
+static double bench_switch_by_name(struct bench_ctx *ctx, uint64_t iterations) {
+	fsm_t	 fsm   = leaf(ctx);
+	uint64_t total = 0;
+	for(uint64_t i = 0; i < iterations; i++) {
+		const char *name = ctx->names[next_target(ctx)];
+		uint64_t	t0	 = now_ns();
+		fsm_switch_by_name(fsm, name);
+		total += now_ns() - t0;
+		fsm_poll(fsm);
+	}
+	return (double)total - ctx->timer_overhead * (double)iterations;
+}
+
+static double bench_switch_by_state_handle(struct bench_ctx *ctx, uint64_t iterations) {
+	fsm_t	 fsm   = leaf(ctx);
+	uint64_t total = 0;
+	for(uint64_t i = 0; i < iterations; i++) {
+		state_t	 state = fsm_get_state(fsm, next_target(ctx));
+		uint64_t t0	   = now_ns();
+		fsm_switch_by_state_handle(fsm, state);
+		total += now_ns() - t0;
+		fsm_poll(fsm);
+	}
+	return (double)total - ctx->timer_overhead * (double)iterations;
+}
+
+static double bench_transition(struct bench_ctx *ctx, uint64_t iterations) {
+	fsm_t	 fsm   = leaf(ctx);
+	fsm_t	 root  = ctx->chain[0];
+	uint64_t total = 0;
+	for(uint64_t i = 0; i < iterations; i++) {
+		// Pick the target outside the timed region, then time the switch plus the poll that
+		// runs the exit and enter handlers through the whole hierarchy
+		state_t	 state = fsm_get_state(fsm, next_target(ctx));
+		uint64_t t0	   = now_ns();
+		fsm_switch_by_state_handle(fsm, state);
+		fsm_poll(root);
+		total += now_ns() - t0;
+	}
+	return (double)total - ctx->timer_overhead * (double)iterations;
+}
+
+static void bench_run(struct bench_ctx *ctx, const char *label, bench_fn_t fn) {
+	// Warm up, then grow the iteration count until the time budget is filled
+	uint64_t iterations = BENCH_MIN_ITERATIONS;
+	double	 elapsed	= fn(ctx, iterations);
+	elapsed				= fn(ctx, iterations);
+	while(elapsed < (double)time_budget_ns / 4 && iterations < (1ull << 40)) {
+		iterations *= 4;
+		elapsed = fn(ctx, iterations);
+	}
+	if(elapsed < 0) {
+		elapsed = 0;
+	}
+	printf("%s,%u,%u,%llu,%.2f\n",
+		   label,
+		   ctx->states,
+		   ctx->depth,
+		   (unsigned long long)iterations,
+		   elapsed / (double)iterations);
+	fflush(stdout);
+}
+
+static double timer_overhead_get(void) {
+	const int iterations = 100000;
+	uint64_t  total		 = 0;
+	for(int i = 0; i < iterations; i++) {
+		uint64_t t0 = now_ns();
+		total += now_ns() - t0;
+	}
+	return (double)total / iterations;
+}
+
+static fsm_t leaf_new(struct bench_ctx *ctx, uint32_t states) {
+	fsm_t fsm = fsm_new("bench leaf");
+	fsm_change_default_poll_interval(fsm, FSM_NO_POLL);
+	ctx->names = malloc(sizeof(char *) * states);
+	for(uint32_t i = 0; i < states; i++) {
+		ctx->names[i] = malloc(16);
+		snprintf(ctx->names[i], 16, "S%u", i);
+		if(fsm_state_add(fsm, ctx->names[i], i, bench_handler) != 0) {
+			fprintf(stderr, "Failed to add state %u\n", i);
+			exit(1);
+		}
+	}
+	ctx->states = states;
+	ctx->cursor = 0;
+	return fsm;
+}
+
+static void leaf_del(struct bench_ctx *ctx, fsm_t fsm) {
+	fsm_del(&fsm);
+	for(uint32_t i = 0; i < ctx->states; i++) {
+		free(ctx->names[i]);
+	}
+	free(ctx->names);
+	ctx->names = NULL;
+}
+
+// Wrap the leaf FSM into depth - 1 single-state parents
+static void chain_build(struct bench_ctx *ctx, fsm_t leaf_fsm, uint32_t depth) {
+	ctx->depth				= depth;
+	ctx->chain[depth - 1]	= leaf_fsm;
+	for(int i = (int)depth - 2; i >= 0; i--) {
+		fsm_t fsm = fsm_new("bench parent");
+		fsm_change_default_poll_interval(fsm, FSM_NO_POLL);
+		fsm_state_add(fsm, "host", 0, bench_handler);
+		ctx->hosts[i] = fsm_get_state(fsm, 0);
+		fsm_state_child_fsm_add(ctx->hosts[i], ctx->chain[i + 1]);
+		ctx->chain[i] = fsm;
+	}
+	// Enter the initial state of every level
+	fsm_poll(ctx->chain[0]);
+}
+
+static void chain_destroy(struct bench_ctx *ctx) {
+	for(uint32_t i = 0; i + 1 < ctx->depth; i++) {
+		fsm_state_child_fsm_del(ctx->hosts[i], ctx->chain[i + 1]);
+		fsm_del(&ctx->chain[i]);
+	}
+	ctx->depth = 0;
+}
+
+/*--- Public function definitions ------------------------------------------------*/
+
+int main(int argc, char **argv) {
+	uint32_t max_states = 100000;
+	uint32_t max_depth	= BENCH_MAX_DEPTH;
+	uint32_t budget_ms	= BENCH_DEFAULT_TIME;
+	for(int i = 1; i + 1 < argc; i += 2) {
+		if(strcmp(argv[i], "-n") == 0) {
+			max_states = (uint32_t)strtoul(argv[i + 1], NULL, 0);
+		} else if(strcmp(argv[i], "-d") == 0) {
+			max_depth = (uint32_t)strtoul(argv[i + 1], NULL, 0);
+		} else if(strcmp(argv[i], "-t") == 0) {
+			budget_ms = (uint32_t)strtoul(argv[i + 1], NULL, 0);
+		}
+	}
+	if(max_depth < 1 || max_depth > BENCH_MAX_DEPTH) {
+		max_depth = BENCH_MAX_DEPTH;
+	}
+	time_budget_ns = (uint64_t)budget_ms * 1000000ull;
+	fsm_port_posix_set_print_level(FSM_DBG_LVL_OFF);
+
+	struct bench_ctx ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.timer_overhead = timer_overhead_get();
+
+	static const uint32_t state_counts[] = { 10, 1000, 100000 };
+	printf("benchmark,states,depth,iterations,ns_per_op\n");
+	for(size_t s = 0; s < sizeof(state_counts) / sizeof(state_counts[0]); s++) {
+		if(state_counts[s] > max_states) {
+			break;
+		}
+		fsm_t leaf_fsm = leaf_new(&ctx, state_counts[s]);
+		for(uint32_t depth = 1; depth <= max_depth; depth++) {
+			chain_build(&ctx, leaf_fsm, depth);
+			bench_run(&ctx, "poll_idle", bench_poll_idle);
+			bench_run(&ctx, "poll_event", bench_poll_event);
+			bench_run(&ctx, "event_send", bench_event_send);
+			bench_run(&ctx, "switch", bench_switch);
+			bench_run(&ctx, "switch_by_name", bench_switch_by_name);
+			bench_run(&ctx, "switch_by_state_handle", bench_switch_by_state_handle);
+			bench_run(&ctx, "transition", bench_transition);
+			chain_destroy(&ctx);
+		}
+		leaf_del(&ctx, leaf_fsm);
+	}
+	return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -25,6 +25,14 @@
 /*--- Private dependencies ------------------------------------------------------------*/
 #include "state_machine.h"
 #include "state_machine_port.h"
+#include "state_machine_map.h"
+#include "state_machine_name.h"
+#include "state_machine_mailbox.h"
+#include "state_machine_pool.h"
+#include "state_machine_timer.h"
+#include "state_machine_transition.h"
+#include "state_machine_trace.h"
+#include "state_machine_slab.h"
 #include <stddef.h>
 #include <string.h>
 #include <stdbool.h>
@@ -44,60 +52,452 @@ extern "C" {
 /*--- Public variable definitions -----------------------------------------------------*/
 
 /*--- Private macros ------------------------------------------------------------------*/
-#define DEBUG_SHOW_FSM_STATE_TRANSITION	 1
+#define DEBUG_SHOW_FSM_STATE_TRANSITION	 0  // Prints switches, the trace ring records them anyway
 #define DEBUG_SHOW_FSM_EVENT_PROPAGATION 0
 #define CLEAR_ALL_EVENT_AFTER_EXIT_STATE 0
 #define PASS_EVENT_TO_CHILD_FSM			 1
-#define EVENT_QUEUE_LENGTH				 10
+#define EVENT_HIGH_QUEUE_LENGTH			 4  // Lane lengths are powers of two
+#define EVENT_QUEUE_LENGTH				 16
+#define EVENT_LOW_QUEUE_LENGTH			 8
+#define EVENT_LANE_MAX_SKIPS			 8  // Events a pending lane yields before it is served
+#define EVENT_SEND_TIMEOUT				 200
+#define EVENT_POOL_BLOCK_SIZE			 256  // Largest payload of fsm_event_send_copy()
+#define EVENT_POOL_BLOCKS				 8
+#define SWITCH_QUEUE_LENGTH				 4	// Switch requests queued in run-to-completion mode
+#define SUBSCRIBE_BITSET_TYPES			 256  // Subscribed types below this are kept in a bitset
 #define DEFAULT_POLLING_INTERVAL		 100
+#define SNAPSHOT_SPINS					 64	 // Snapshot retries before a reader sleeps for 1 ms
+
+#define EVENT_QUEUE_CELLS (EVENT_HIGH_QUEUE_LENGTH + EVENT_QUEUE_LENGTH + EVENT_LOW_QUEUE_LENGTH)
+
+#if FSM_USE_STATS
+#define STATS_INC(_counter) __atomic_add_fetch(&(_counter), 1, __ATOMIC_RELAXED)
+#else
+#define STATS_INC(_counter)
+#endif
+
+#if FSM_USE_TRACE
+#define TRACE(_kind, _fsm, _type, _from, _to) \
+	fsm_trace_write(&(_fsm)->trace,           \
+					(_kind),                  \
+					(_fsm)->trace_id,         \
+					(_fsm)->os->uptime_us(),  \
+					(_type),                  \
+					(_from),                  \
+					(_to))
+#else
+#define TRACE(_kind, _fsm, _type, _from, _to)
+#endif
 
 /*--- Private type definitions --------------------------------------------------------*/
+// Wakeup hook and its argument, published together through fsm->wakeup. A published pair never
+// changes, senders count themselves in users while they call it, so that fsm_set_wakeup() only
+// rewrites a pair once every sender has left it.
+struct fsm_hook {
+	fsm_wakeup_t hook;
+	void		*arg;
+	uint32_t	 users;
+};
+
 struct state {
-	uint32_t		magic_number;
-	uint32_t		id;
-	const char	   *name;
-	state_handler_t handler;
-	uint32_t		ts_poll;
-	uint32_t		poll_interval;
-	uint32_t		poll_interval_next;
-	void		   *lock;
-	struct fsm	   *parent_fsm;
-	struct fsm	   *child_fsm;
-	struct state   *next;
+	uint32_t		  magic_number;
+	uint32_t		  id;
+	const char		 *name;	 // Interned, see fsm_name_intern()
+	uint32_t		  name_atom;
+	state_handler_t	  enter;  // Receives FSM_EVT_ENTER, handler unless defined otherwise
+	state_handler_t	  handler;
+	state_handler_t	  exit;	 // Receives FSM_EVT_EXIT, handler unless defined otherwise
+	uint32_t		  ts_poll;
+	uint32_t		  poll_interval;
+	uint32_t		  poll_interval_next;
+	void			 *lock;
+	struct fsm		 *parent_fsm;
+	struct fsm		**child_fsm;  // Child-FSM array, only modified under lock
+	uint32_t		  child_fsm_number;
+	uint32_t		  child_fsm_capacity;
+	uint32_t		  child_fsm_gen;  // Bumped on every change of child_fsm
+	struct state	 *prev;
+	struct state	 *next;
+	struct state	 *name_next;   // Next state with the same name in the parent FSM
+	struct fsm_map	  timers;	   // Event type to fsm_timer, protected by parent_fsm->lock
+	struct fsm_timer *timer_list;  // All timers ever started on this state
+	uint32_t		  ordinal;	   // Position in the state list when transitions were compiled
+	bool			  is_static;   // Defined by a table in fsm_init_static(), never freed
+	bool			  in_slab;	   // A state_static of the state slab, see fsm_slab_reserve()
+#if FSM_USE_STATS
+	struct fsm_state_stats stats;  // Only written by the poller of the parent FSM
+	uint32_t			   ts_enter;
+#endif
 };
 
 struct fsm {
-	uint32_t	magic_number;
-	void	   *lock;
-	const char *name;
-	uint32_t	poll_interval;
-	void	   *event_queue;
-	state_t		parent_state;
-	state_t		state_list;
-	state_t		sta_prev;
-	state_t		sta_curr;
-	state_t		sta_next;
-	struct fsm *next;
+	uint32_t		   magic_number;
+	void			  *lock;
+	const char		  *name;
+	uint32_t		   trace_id;
+	uint32_t		   poll_interval;
+	// One mailbox per FSM_PRIO_* lane, and the number of times a pending lane was passed over
+	struct fsm_mailbox lanes[FSM_PRIO_NUMBER];
+	uint8_t			   lane_skips[FSM_PRIO_NUMBER];
+	// FSM_EVT_POLL is not queued. It is dispatched once the normal lane has been read up to the
+	// position it was due at, which orders it the same as a queued event.
+	bool			   poll_due;
+	uint32_t		   poll_pos;
+	uint32_t		   poll_ts;
+	struct fsm_pool	  *pool;	 // Payload blocks of fsm_event_send_copy(), created on first use
+	void			  *space;	 // Posted after a pop while senders wait for a full lane
+	uint32_t		   space_waiters;
+	uint32_t		   dropped;	 // Events the parent could not forward, the lanes were full
+	state_t			   parent_state;
+	state_t			   state_list;
+	state_t			   state_tail;
+	state_t			   sta_prev;
+	state_t			   sta_curr;
+	state_t			   sta_next;
+
+	// Copy of sta_prev, sta_curr and sta_next for lock-free readers, written under lock. snap_seq
+	// is odd while the copy is being updated, see fsm_snapshot_publish().
+	uint32_t			snap_seq;
+	struct fsm_snapshot snap;
+
+	// Run-to-completion mode, see fsm_set_run_to_completion(). Switch requests that arrive while
+	// sta_next is set wait here, protected by lock.
+	uint32_t		   max_microsteps;
+	state_t			   switch_queue[SWITCH_QUEUE_LENGTH];
+	uint32_t		   switch_head;
+	uint32_t		   switch_count;
+	struct fsm_hook	  *wakeup;	// Called when the FSM needs polling earlier than announced
+	struct fsm_hook	   hooks[2];  // Storage of wakeup, the unpublished one is rewritten
+	struct fsm_wheel  *wheel;  // Allocated when the first timer is started
+
+	// Snapshot of the current state's child-FSM array used by fsm_poll. It is only refreshed
+	// when the state or its child_fsm_gen changes, so steady state polling does not allocate.
+	fsm_t	*child_buf;
+	uint32_t child_buf_number;
+	uint32_t child_buf_capacity;
+	state_t	 child_buf_state;
+	uint32_t child_buf_gen;
+
+	struct fsm_map id_index;	// State ID to state_t, protected by lock
+	struct fsm_map name_index;	// Name atom to first state_t with that name, protected by lock
+
+	struct fsm_trans trans;	 // Transition table, protected by lock
+
+	// Event types this FSM accepts from its parent, all of them while subscriptions is 0. Types
+	// below SUBSCRIBE_BITSET_TYPES are bits of sub_bits, the others keys of sub_types.
+	uint32_t	   subscriptions;
+	uint32_t	   sub_bits[SUBSCRIBE_BITSET_TYPES / 32];
+	struct fsm_map sub_types;  // Protected by lock
+
+#if FSM_USE_STATS
+	struct fsm_stats stats;
+#endif
 
 	os_handle_t os;
+	bool		is_static;	// Placed in caller storage by fsm_init_static()
+	bool		in_slab;	// A fsm_static of the FSM slab, see fsm_slab_reserve()
+	bool		in_block;	// Static layout in a heap block of fsm_new_from_table()
+
+#if FSM_USE_TRACE
+	struct fsm_trace_ring trace;  // Last, it is the largest member and rarely read
+#endif
+};
+
+// Layout of the caller storage of fsm_init_static(): the FSM, then one state_static per state,
+// then the hash tables of id_index and name_index. Slab objects use the same layouts.
+struct fsm_static {
+	struct fsm				fsm;
+	uint64_t				lock[FSM_STATIC_MUTEX_SIZE / sizeof(uint64_t)];
+	struct fsm_mailbox_cell cells[EVENT_QUEUE_CELLS];
+};
+
+struct state_static {
+	struct state state;
+	uint64_t	 lock[FSM_STATIC_MUTEX_SIZE / sizeof(uint64_t)];
 };
 
+_Static_assert((EVENT_QUEUE_LENGTH & (EVENT_QUEUE_LENGTH - 1)) == 0,
+			   "Static FSMs need a power of two EVENT_QUEUE_LENGTH");
+_Static_assert(sizeof(struct fsm_static) <= FSM_STATIC_FSM_SIZE, "FSM_STATIC_FSM_SIZE too small");
+// Each state adds at most four entries to both index tables, see fsm_init_static()
+_Static_assert(sizeof(struct state_static) + 8 * sizeof(struct fsm_map_entry)
+				   <= FSM_STATIC_STATE_SIZE,
+			   "FSM_STATIC_STATE_SIZE too small");
+
 /*--- Private function declarations ---------------------------------------------------*/
 
 /*--- Private variable definitions ----------------------------------------------------*/
 static struct state root_state = { .magic_number	   = STATE_MAGIC_NUMBER,
 								   .id				   = STATE_ID_ROOT,
 								   .name			   = STATE_NAME_ROOT,
+								   .enter			   = NULL,
 								   .handler			   = NULL,
+								   .exit			   = NULL,
 								   .ts_poll			   = 0,
 								   .poll_interval	   = 100,
 								   .poll_interval_next = 100,
 								   .lock			   = NULL,
 								   .parent_fsm		   = NULL,
 								   .child_fsm		   = NULL,
-								   .next			   = NULL };
+								   .child_fsm_number   = 0,
+								   .child_fsm_capacity = 0,
+								   .child_fsm_gen	   = 0,
+								   .prev			   = NULL,
+								   .next			   = NULL,
+								   .name_next		   = NULL,
+								   .timer_list		   = NULL,
+								   .ordinal			   = UINT32_MAX,
+								   .is_static		   = true };
+static uint64_t root_lock[FSM_STATIC_MUTEX_SIZE / sizeof(uint64_t)];
+static struct fsm_slab slabs[FSM_SLAB_NUMBER];
+static const uint32_t  lane_length[FSM_PRIO_NUMBER] = {
+	EVENT_HIGH_QUEUE_LENGTH,
+	EVENT_QUEUE_LENGTH,
+	EVENT_LOW_QUEUE_LENGTH,
+};
 
 /*--- Private function definitions ----------------------------------------------------*/
+// Cancel all timers of a state. Must be called with fsm->lock held.
+static void fsm_state_timers_cancel(fsm_t fsm, state_t state) {
+	if(fsm->wheel == NULL) {
+		return;
+	}
+	for(struct fsm_timer *timer = state->timer_list; timer; timer = timer->owner_next) {
+		fsm_wheel_del(fsm->wheel, timer);
+	}
+}
+
+// Take the published wakeup pair of an FSM, NULL if there is none. A sender that counted itself
+// in after the pair was replaced backs off, fsm_set_wakeup() may be about to rewrite it.
+static struct fsm_hook *fsm_hook_acquire(fsm_t fsm) {
+	for(;;) {
+		struct fsm_hook *hook = __atomic_load_n(&fsm->wakeup, __ATOMIC_ACQUIRE);
+		if(hook == NULL) {
+			return NULL;
+		}
+		__atomic_add_fetch(&hook->users, 1, __ATOMIC_SEQ_CST);
+		if(__atomic_load_n(&fsm->wakeup, __ATOMIC_SEQ_CST) == hook) {
+			return hook;
+		}
+		__atomic_sub_fetch(&hook->users, 1, __ATOMIC_RELEASE);
+	}
+}
+
+// Notify the nearest FSM up the tree that has a wakeup hook. Parent links are read without
+// locking so that this stays usable from fsm_event_try_send.
+static void fsm_wakeup(fsm_t fsm) {
+	while(fsm) {
+		struct fsm_hook *hook = fsm_hook_acquire(fsm);
+		if(hook) {
+			hook->hook(fsm, hook->arg);
+			__atomic_sub_fetch(&hook->users, 1, __ATOMIC_RELEASE);
+			return;
+		}
+		state_t parent = fsm->parent_state;
+		fsm			   = parent ? parent->parent_fsm : NULL;
+	}
+}
+
+// Whether a lane holds an event, the normal lane also holds the due poll event
+static bool fsm_lane_ready(fsm_t fsm, uint32_t lane) {
+	return fsm_mailbox_count(&fsm->lanes[lane]) > 0
+		   || (lane == FSM_PRIO_NORMAL && __atomic_load_n(&fsm->poll_due, __ATOMIC_ACQUIRE));
+}
+
+// Whether any lane holds an event
+static bool fsm_mailbox_pending(fsm_t fsm) {
+	for(uint32_t i = 0; i < FSM_PRIO_NUMBER; i++) {
+		if(fsm_lane_ready(fsm, i)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Milliseconds from now until the FSM or one of its active child FSMs needs polling
+static uint32_t fsm_deadline_ms(fsm_t fsm, uint32_t now) {
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	os_handle_t os	= fsm->os;
+	uint32_t	ret = FSM_NO_DEADLINE;
+	if(fsm_mailbox_pending(fsm)) {
+		return 0;
+	}
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	state_t curr = fsm->sta_curr;
+	if(fsm->sta_next) {
+		ret = 0;
+	} else if(curr->poll_interval != FSM_NO_POLL) {
+		uint32_t elapsed = now - curr->ts_poll;
+		ret				 = elapsed >= curr->poll_interval ? 0 : curr->poll_interval - elapsed;
+	} else if(curr->poll_interval_next != FSM_NO_POLL) {
+		ret = 0;  // The new interval takes effect on the next poll
+	}
+	if(ret != 0 && fsm->wheel) {
+		uint32_t timer = fsm_wheel_next(fsm->wheel, now);
+		ret			   = timer < ret ? timer : ret;
+	}
+	os->mutex_unlock(fsm->lock);
+	if(ret == 0) {
+		return 0;
+	}
+	// Child FSMs of the current state are polled together with their parent
+	os->mutex_lock(curr->lock, BLOCKTIME_MAX);
+	for(uint32_t i = 0; i < curr->child_fsm_number && ret > 0; i++) {
+		uint32_t child = fsm_deadline_ms(curr->child_fsm[i], now);
+		if(child < ret) {
+			ret = child;
+		}
+	}
+	os->mutex_unlock(curr->lock);
+	return ret;
+}
+
+static void *fsm_transition_resolve(void *ctx, uint32_t id, uint32_t *ordinal) {
+	state_t state = fsm_map_get(&((fsm_t)ctx)->id_index, id);
+	if(state) {
+		*ordinal = state->ordinal;
+	}
+	return state;
+}
+
+// Number the states and compile the transition table. Must be called with fsm->lock held.
+static void fsm_transition_compile(fsm_t fsm) {
+	uint32_t ordinal = 0;
+	for(state_t state = fsm->state_list; state; state = state->next) {
+		state->ordinal = ordinal++;
+	}
+	if(fsm_trans_compile(&fsm->trans, ordinal, fsm_transition_resolve, fsm) != 0) {
+		OS_PRINT_ERR(fsm->os, "Failed to compile transitions of fsm %s", fsm->name);
+	}
+}
+
+// Copy sta_prev, sta_curr and sta_next to the snapshot, the FSM lock is held. Writers are
+// serialized by the lock, readers retry while snap_seq is odd or has changed (seqlock).
+static void fsm_snapshot_publish(fsm_t fsm, bool switched) {
+	struct fsm_snapshot *snap = &fsm->snap;
+	state_t				 next = fsm->sta_next;
+	uint32_t			 seq  = fsm->snap_seq;
+	__atomic_store_n(&fsm->snap_seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	if(switched) {
+		__atomic_store_n(&snap->curr.id, fsm->sta_curr->id, __ATOMIC_RELAXED);
+		__atomic_store_n(&snap->curr.name, fsm->sta_curr->name, __ATOMIC_RELAXED);
+		__atomic_store_n(&snap->prev.id, fsm->sta_prev->id, __ATOMIC_RELAXED);
+		__atomic_store_n(&snap->prev.name, fsm->sta_prev->name, __ATOMIC_RELAXED);
+		__atomic_store_n(&snap->switches, snap->switches + 1, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&snap->next.id, next ? next->id : STATE_ID_ROOT, __ATOMIC_RELAXED);
+	__atomic_store_n(&snap->next.name, next ? next->name : NULL, __ATOMIC_RELAXED);
+	__atomic_store_n(&snap->has_next, next != NULL, __ATOMIC_RELAXED);
+	__atomic_store_n(&fsm->snap_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Copy the snapshot without taking a lock. Only spins while the poller is publishing a switch,
+// which takes a few stores.
+static void fsm_snapshot_read(fsm_t fsm, struct fsm_snapshot *dst) {
+	const struct fsm_snapshot *snap = &fsm->snap;
+	for(uint32_t spins = 1;; spins++) {
+		uint32_t seq = __atomic_load_n(&fsm->snap_seq, __ATOMIC_ACQUIRE);
+		if((seq & 1) == 0) {
+			dst->curr.id   = __atomic_load_n(&snap->curr.id, __ATOMIC_RELAXED);
+			dst->curr.name = __atomic_load_n(&snap->curr.name, __ATOMIC_RELAXED);
+			dst->prev.id   = __atomic_load_n(&snap->prev.id, __ATOMIC_RELAXED);
+			dst->prev.name = __atomic_load_n(&snap->prev.name, __ATOMIC_RELAXED);
+			dst->next.id   = __atomic_load_n(&snap->next.id, __ATOMIC_RELAXED);
+			dst->next.name = __atomic_load_n(&snap->next.name, __ATOMIC_RELAXED);
+			dst->has_next  = __atomic_load_n(&snap->has_next, __ATOMIC_RELAXED);
+			dst->switches  = __atomic_load_n(&snap->switches, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if(__atomic_load_n(&fsm->snap_seq, __ATOMIC_RELAXED) == seq) {
+				return;
+			}
+		}
+		// The writer may have been preempted in the middle of an update
+		if(spins % SNAPSHOT_SPINS == 0) {
+			fsm->os->delay_ms(1);
+		}
+	}
+}
+
+// Request a switch, the FSM lock is held. A request arriving while another one is pending is
+// queued in run-to-completion mode and refused otherwise.
+static bool fsm_switch_request(fsm_t fsm, state_t state) {
+	if(fsm->sta_next == NULL) {
+		fsm->sta_next = state;
+		fsm_snapshot_publish(fsm, false);
+		return true;
+	}
+	if(fsm->max_microsteps > 0 && fsm->switch_count < SWITCH_QUEUE_LENGTH) {
+		uint32_t tail			= (fsm->switch_head + fsm->switch_count) % SWITCH_QUEUE_LENGTH;
+		fsm->switch_queue[tail] = state;
+		fsm->switch_count++;
+		return true;
+	}
+	return false;
+}
+
+// Take the oldest queued switch request, the FSM lock is held. Returns NULL if there is none.
+static state_t fsm_switch_dequeue(fsm_t fsm) {
+	if(fsm->switch_count == 0) {
+		return NULL;
+	}
+	state_t state	 = fsm->switch_queue[fsm->switch_head];
+	fsm->switch_head = (fsm->switch_head + 1) % SWITCH_QUEUE_LENGTH;
+	fsm->switch_count--;
+	return state;
+}
+
+// Drop all requested switches to a state that is being removed, the FSM lock is held
+static void fsm_switch_forget(fsm_t fsm, state_t state) {
+	uint32_t kept = 0;
+	for(uint32_t i = 0; i < fsm->switch_count; i++) {
+		state_t queued = fsm->switch_queue[(fsm->switch_head + i) % SWITCH_QUEUE_LENGTH];
+		if(queued != state) {
+			fsm->switch_queue[(fsm->switch_head + kept) % SWITCH_QUEUE_LENGTH] = queued;
+			kept++;
+		}
+	}
+	fsm->switch_count = kept;
+	if(fsm->sta_next == state) {
+		fsm->sta_next = fsm_switch_dequeue(fsm);
+		fsm_snapshot_publish(fsm, false);
+	}
+}
+
+// Fire the first transition of the current state whose guard passes for the event. Returns false
+// if none fires, the event then goes to the state handler.
+static bool fsm_transition_fire(fsm_t fsm, event_t event) {
+	os_handle_t	 os		= fsm->os;
+	fsm_action_t action = NULL;
+	bool		 fired	= false;
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	if(fsm->trans.dirty) {
+		fsm_transition_compile(fsm);
+	}
+	const struct fsm_trans_row *row =
+		fsm_trans_find(&fsm->trans, fsm->sta_curr->ordinal, event->type);
+	while(row && row->def.guard && !row->def.guard(event)) {
+		row = fsm_trans_next(&fsm->trans, row);
+	}
+	if(row) {
+		fired  = true;
+		action = row->def.action;
+		if(row->target && fsm_switch_request(fsm, row->target) == false) {
+			OS_LOG(os,
+				   FSM_DBG_LVL_RAW,
+				   "FSM %s: Transition \"%s\"->\"%s\" is ignored" NL,
+				   fsm->name,
+				   fsm->sta_curr->name,
+				   ((state_t)row->target)->name);
+		}
+	}
+	os->mutex_unlock(fsm->lock);
+	if(action) {
+		action(event);
+	}
+	return fired;
+}
+
 static int fsm_state_register(fsm_t fsm, state_t state) {
 	int ret = 0;
 	ASSERT(fsm);
@@ -113,29 +513,56 @@ static int fsm_state_register(fsm_t fsm, state_t state) {
 	os_handle_t os = fsm->os;
 	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
 	bool is_first_state = fsm->state_list == NULL ? true : false;
-	// Slide to tail of the state list, and check for ID collision
-	state_t *node = &(fsm->state_list);
-	while(*node) {
-		if((*node)->id == state->id) {
-			OS_PRINT_ERR(os, "ID collision");
-			ret = -1;
-			goto ERROR;
+	// Index the state by ID, which also checks for ID collision
+	ret = fsm_map_put(&fsm->id_index, state->id, state);
+	if(ret == -1) {
+		OS_PRINT_ERR(os, "ID collision");
+		goto ERROR;
+	} else if(ret != 0) {
+		OS_PRINT_ERR(os, "Failed to index state #%u", state->id);
+		goto ERROR;
+	}
+	// Index the state by name, states sharing a name are chained in registration order
+	state->name_next = NULL;
+	state_t head	 = fsm_map_get(&fsm->name_index, state->name_atom);
+	if(head) {
+		while(head->name_next) {
+			head = head->name_next;
 		}
-		node = &((*node)->next);
+		head->name_next = state;
+	} else if(fsm_map_put(&fsm->name_index, state->name_atom, state) != 0) {
+		fsm_map_remove(&fsm->id_index, state->id);
+		OS_PRINT_ERR(os, "Failed to index state %s", state->name);
+		ret = -2;
+		goto ERROR;
 	}
 	// Set state parameter
-	state->lock = os->mutex_create();
+	if(state->is_static || state->in_slab) {
+		state->lock = os->mutex_init(((struct state_static *)state)->lock);
+	} else {
+		state->lock = os->mutex_create();
+	}
 	ASSERT(state->lock);
 	os->mutex_lock(state->lock, BLOCKTIME_MAX);
 	state->parent_fsm		  = fsm;
 	state->poll_interval	  = fsm->poll_interval;
 	state->poll_interval_next = fsm->poll_interval;
+	state->prev				  = fsm->state_tail;
 	state->next				  = NULL;
 	os->mutex_unlock(state->lock);
 	// Append to tail of the state list
-	*node = state;
+	if(fsm->state_tail) {
+		fsm->state_tail->next = state;
+	} else {
+		fsm->state_list = state;
+	}
+	fsm->state_tail = state;
 	if(is_first_state) {
 		fsm->sta_next = state;
+		fsm_snapshot_publish(fsm, false);
+	}
+	if(fsm->trans.number) {
+		fsm->trans.dirty = true;  // Ordinals and targets change
 	}
 ERROR:
 	os->mutex_unlock(fsm->lock);
@@ -147,31 +574,61 @@ static int fsm_state_unregister(fsm_t fsm, state_t state) {
 	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
 	ASSERT(fsm->os);
 	ASSERT(fsm->lock);
+	ASSERT(state);
+	ASSERT(state->magic_number == STATE_MAGIC_NUMBER);
 	os_handle_t os = fsm->os;
 	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
-	// Find the state in state list
-	state_t *node = &(fsm->state_list);
-	while(*node) {
-		if(*node == state) {
-			ASSERT(state);
-			ASSERT(state->magic_number == STATE_MAGIC_NUMBER);
-			ASSERT(state->lock);
-			os->mutex_lock(state->lock, BLOCKTIME_MAX);
-			// Reset state parameter
-			state->parent_fsm	  = NULL;
-			void *lock_to_destroy = state->lock;
-			state->lock			  = NULL;
-			// Remove the state from state list
-			*node		= (*node)->next;
-			state->next = NULL;
-			if(fsm->sta_next == state) {
-				fsm->sta_next = NULL;
+	// Only states registered to this FSM are unlinked
+	if(state->parent_fsm == fsm) {
+		ASSERT(state->lock);
+		os->mutex_lock(state->lock, BLOCKTIME_MAX);
+		// Reset state parameter
+		state->parent_fsm	  = NULL;
+		void *lock_to_destroy = state->lock;
+		state->lock			  = NULL;
+		// Remove the state from state list and indexes
+		fsm_state_timers_cancel(fsm, state);
+		fsm_map_remove(&fsm->id_index, state->id);
+		state_t *name_node = NULL;
+		state_t	 head	   = fsm_map_get(&fsm->name_index, state->name_atom);
+		if(head == state) {
+			fsm_map_remove(&fsm->name_index, state->name_atom);
+			if(state->name_next) {
+				fsm_map_put(&fsm->name_index, state->name_atom, state->name_next);
+			}
+		} else if(head) {
+			name_node = &(head->name_next);
+			while(*name_node && *name_node != state) {
+				name_node = &((*name_node)->name_next);
 			}
-			// Release mutex resources
+			if(*name_node) {
+				*name_node = state->name_next;
+			}
+		}
+		state->name_next = NULL;
+		if(state->prev) {
+			state->prev->next = state->next;
+		} else {
+			fsm->state_list = state->next;
+		}
+		if(state->next) {
+			state->next->prev = state->prev;
+		} else {
+			fsm->state_tail = state->prev;
+		}
+		state->prev = NULL;
+		state->next = NULL;
+		fsm_switch_forget(fsm, state);
+		if(fsm->trans.number) {
+			fsm->trans.dirty = true;
+		}
+		// Release mutex resources, destroying a locked mutex is undefined
+		os->mutex_unlock(lock_to_destroy);
+		if(state->is_static || state->in_slab) {
+			os->mutex_deinit(lock_to_destroy);
+		} else {
 			os->mutex_destroy(lock_to_destroy);
-			break;
 		}
-		node = &((*node)->next);
 	}
 	os->mutex_unlock(fsm->lock);
 	return 0;
@@ -183,40 +640,93 @@ static state_t state_new(const char *name, uint32_t id, state_handler_t handler)
 	}
 	state_t		ret = NULL;
 	os_handle_t os	= (os_handle_t)&fsm_port_os_handle;
-	ret				= os->malloc(sizeof(struct state));
-	memset(ret, 0, sizeof(struct state));
-	ASSERT(ret);
+	if(__atomic_load_n(&slabs[FSM_SLAB_STATE].lock, __ATOMIC_ACQUIRE)) {
+		ret = fsm_slab_alloc(&slabs[FSM_SLAB_STATE]);
+	}
+	if(ret) {
+		ret->in_slab = true;
+	} else {
+		ret = os->malloc(sizeof(struct state));
+		ASSERT(ret);
+		memset(ret, 0, sizeof(struct state));
+	}
 	ret->magic_number = STATE_MAGIC_NUMBER;
-	ret->name		  = name;
+	ret->name		  = fsm_name_intern(name, &ret->name_atom);
 	ret->id			  = id;
+	ret->enter		  = handler;
 	ret->handler	  = handler;
+	ret->exit		  = handler;
+	ret->timer_list	  = NULL;
+	fsm_map_init(&ret->timers, os);
+	ASSERT(ret->name);
 	return ret;
 }
 
+// Free what a state allocated at runtime, and the state itself unless it is static. The state
+// must be unregistered.
+static void state_release(state_t state) {
+	os_handle_t os = (os_handle_t)&fsm_port_os_handle;
+	ASSERT(state->parent_fsm == NULL);
+	while(state->timer_list) {
+		struct fsm_timer *timer = state->timer_list;
+		state->timer_list		= timer->owner_next;
+		os->free(timer);
+	}
+	fsm_map_deinit(&state->timers);
+	os->free(state->child_fsm);
+	state->child_fsm		  = NULL;
+	state->child_fsm_number	  = 0;
+	state->child_fsm_capacity = 0;
+	if(state->in_slab) {
+		fsm_slab_free(&slabs[FSM_SLAB_STATE], state);
+	} else if(!state->is_static) {
+		os->free(state);
+	}
+}
+
 static int state_del(state_t *pstate) {
-	int			ret = 0;
-	os_handle_t os	= (os_handle_t)&fsm_port_os_handle;
+	int ret = 0;
 	ASSERT(pstate);
 	state_t state = *pstate;
 	ASSERT(state);
+	if(state->is_static) {
+		return -2;	// Static states live as long as their FSM
+	}
 	if(state->parent_fsm) {
 		ret = fsm_state_unregister(state->parent_fsm, state);
 	}
-	os->free(state);
+	state_release(state);
 	*pstate = NULL;
 	return ret;
 }
 
+// Copy the child-FSM array of a state into the dispatch buffer of its FSM. Must be called with
+// fsm->lock held. Allocates only when the array outgrows every previous snapshot.
+static void fsm_child_buf_refresh(fsm_t fsm, state_t state) {
+	os_handle_t os = fsm->os;
+	os->mutex_lock(state->lock, BLOCKTIME_MAX);
+	if(state->child_fsm_number > fsm->child_buf_capacity) {
+		os->free(fsm->child_buf);
+		fsm->child_buf = os->malloc(sizeof(fsm_t) * state->child_fsm_number);
+		ASSERT(fsm->child_buf);
+		fsm->child_buf_capacity = state->child_fsm_number;
+	}
+	if(state->child_fsm_number) {
+		memcpy(fsm->child_buf, state->child_fsm, sizeof(fsm_t) * state->child_fsm_number);
+	}
+	fsm->child_buf_number = state->child_fsm_number;
+	fsm->child_buf_state  = state;
+	fsm->child_buf_gen	  = state->child_fsm_gen;
+	os->mutex_unlock(state->lock);
+}
+
 /*--- Public function definitions -----------------------------------------------------*/
 state_t fsm_get_state(fsm_t fsm, uint32_t id) {
 	ASSERT(fsm);
 	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
 	os_handle_t os = fsm->os;
 	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
-	state_t node = (fsm->state_list);
-	while(node && (node->id != id)) {
-		node = node->next;
-	}
+	state_t node = fsm_map_get(&fsm->id_index, id);
 	os->mutex_unlock(fsm->lock);
 	return node;
 }
@@ -226,11 +736,12 @@ state_t fsm_get_state_by_name(fsm_t fsm, const char *name) {
 	ASSERT(fsm);
 	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
 	os_handle_t os = fsm->os;
-	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
-	state_t node = (fsm->state_list);
-	while(node && (strcmp(name, node->name) != 0)) {
-		node = node->next;
+	uint32_t	atom;
+	if(fsm_name_lookup(name, &atom) == NULL) {
+		return NULL;  // No state anywhere has this name
 	}
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	state_t node = fsm_map_get(&fsm->name_index, atom);
 	os->mutex_unlock(fsm->lock);
 	return node;
 }
@@ -251,6 +762,9 @@ int fsm_state_del_by_name(fsm_t fsm, const char *name) {
 	if(state == NULL) {
 		return -1;	// No such state
 	}
+	if(state->is_static) {
+		return -2;	// States defined by a static table cannot be deleted
+	}
 	fsm_state_unregister(fsm, state);
 	return state_del(&state);
 }
@@ -260,6 +774,9 @@ int fsm_state_del(fsm_t fsm, uint32_t id) {
 	if(state == NULL) {
 		return -1;	// No such state
 	}
+	if(state->is_static) {
+		return -2;	// States defined by a static table cannot be deleted
+	}
 	fsm_state_unregister(fsm, state);
 	return state_del(&state);
 }
@@ -278,18 +795,25 @@ int fsm_state_child_fsm_add(state_t state, fsm_t fsm) {
 		return -1;
 	}
 	os->mutex_lock(state->lock, BLOCKTIME_MAX);
-	// Slide to tail of the child-FSM list
-	fsm_t *node = &(state->child_fsm);
-	while(*node) {
-		node = &((*node)->next);
+	// Grow the child-FSM array if it is full
+	if(state->child_fsm_number == state->child_fsm_capacity) {
+		uint32_t capacity = state->child_fsm_capacity ? state->child_fsm_capacity * 2 : 4;
+		fsm_t	*array	  = os->malloc(sizeof(fsm_t) * capacity);
+		ASSERT(array);
+		if(state->child_fsm_number) {
+			memcpy(array, state->child_fsm, sizeof(fsm_t) * state->child_fsm_number);
+		}
+		os->free(state->child_fsm);
+		state->child_fsm		  = array;
+		state->child_fsm_capacity = capacity;
 	}
 	// Set FSM parameters
 	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
 	fsm->parent_state = state;
-	fsm->next		  = NULL;
 	os->mutex_unlock(fsm->lock);
-	// Append to tail of the child-FSM list
-	*node = fsm;
+	// Append to tail of the child-FSM array
+	state->child_fsm[state->child_fsm_number++] = fsm;
+	__atomic_add_fetch(&state->child_fsm_gen, 1, __ATOMIC_RELEASE);
 	os->mutex_unlock(state->lock);
 	return 0;
 }
@@ -304,20 +828,21 @@ int fsm_state_child_fsm_del(state_t state, fsm_t fsm) {
 	ASSERT(state->lock);
 	os_handle_t os = fsm->os;
 	os->mutex_lock(state->lock, BLOCKTIME_MAX);
-	// Find the FSM in child-FSM list
-	fsm_t *node = &(state->child_fsm);
-	while(*node) {
-		if(*node == fsm) {
+	// Find the FSM in child-FSM array
+	for(uint32_t i = 0; i < state->child_fsm_number; i++) {
+		if(state->child_fsm[i] == fsm) {
 			// Reset FSM parameters
 			os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
 			fsm->parent_state = NULL;
-			// Remove the FSM from child-FSM list
-			*node	  = (*node)->next;
-			fsm->next = NULL;
 			os->mutex_unlock(fsm->lock);
+			// Remove the FSM from child-FSM array, keeping the polling order
+			state->child_fsm_number--;
+			memmove(&state->child_fsm[i],
+					&state->child_fsm[i + 1],
+					sizeof(fsm_t) * (state->child_fsm_number - i));
+			__atomic_add_fetch(&state->child_fsm_gen, 1, __ATOMIC_RELEASE);
 			break;
 		}
-		node = &((*node)->next);
 	}
 	os->mutex_unlock(state->lock);
 	return 0;
@@ -332,26 +857,25 @@ int fsm_switch(fsm_t fsm, uint32_t id) {
 	os_handle_t os = fsm->os;
 	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
 	// Check if the state is registered to the FSM
-	state_t *node = &(fsm->state_list);
-	while(*node && ((*node)->id != id)) {
-		node = &((*node)->next);
-	}
+	state_t node = fsm_map_get(&fsm->id_index, id);
 	// Set next state to trigger state transition
-	if(*node) {
-		if(fsm->sta_next == NULL) {
-			fsm->sta_next = *node;
-		} else {
-			OS_PRINT(os,
-					 "FSM %s: Request \"%s\"->\"%s\" is ignored" NL,
-					 fsm->name,
-					 fsm->sta_curr->name,
-					 (*node)->name);
+	if(node) {
+		if(fsm_switch_request(fsm, node) == false) {
+			OS_LOG(os,
+				   FSM_DBG_LVL_RAW,
+				   "FSM %s: Request \"%s\"->\"%s\" is ignored" NL,
+				   fsm->name,
+				   fsm->sta_curr->name,
+				   node->name);
 		}
 	} else {
 		OS_PRINT_ERR(os, "No #%d state in \"%s\" fsm:", id, fsm->name);
 		ret = -1;
 	}
 	os->mutex_unlock(fsm->lock);
+	if(ret == 0) {
+		fsm_wakeup(fsm);
+	}
 	return ret;
 }
 
@@ -366,26 +890,23 @@ int fsm_switch_by_state_handle(fsm_t fsm, state_t state) {
 	os_handle_t os = fsm->os;
 	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
 	// Check if the state is registered to the FSM
-	state_t *node = &(fsm->state_list);
-	while(*node && (*node != state)) {
-		node = &((*node)->next);
-	}
-	// Set next state to trigger state transition
-	if(*node) {
-		if(fsm->sta_next == NULL) {
-			fsm->sta_next = *node;
-		} else {
-			OS_PRINT(os,
-					 "FSM %s: Request \"%s\"->\"%s\" is ignored" NL,
-					 fsm->name,
-					 fsm->sta_curr->name,
-					 (*node)->name);
+	if(state->parent_fsm == fsm) {
+		if(fsm_switch_request(fsm, state) == false) {
+			OS_LOG(os,
+				   FSM_DBG_LVL_RAW,
+				   "FSM %s: Request \"%s\"->\"%s\" is ignored" NL,
+				   fsm->name,
+				   fsm->sta_curr->name,
+				   state->name);
 		}
 	} else {
 		OS_PRINT_ERR(os, "No #%d:%s state in \"%s\" fsm:", state->id, state->name, fsm->name);
 		ret = -1;
 	}
 	os->mutex_unlock(fsm->lock);
+	if(ret == 0) {
+		fsm_wakeup(fsm);
+	}
 	return ret;
 }
 
@@ -397,201 +918,652 @@ int fsm_switch_by_name(fsm_t fsm, const char *name) {
 	ASSERT(fsm->lock);
 	ASSERT(name);
 	os_handle_t os = fsm->os;
+	uint32_t	atom;
+	bool		known = fsm_name_lookup(name, &atom) != NULL;
 	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
 	// Check if the state is registered to the FSM
-	state_t *node = &(fsm->state_list);
-	while(*node && (strcmp((*node)->name, name) != 0)) {
-		node = &((*node)->next);
-	}
+	state_t node = known ? fsm_map_get(&fsm->name_index, atom) : NULL;
 	// Set next state to trigger state transition
-	if(*node) {
-		if(fsm->sta_next == NULL) {
-			fsm->sta_next = *node;
-		} else {
-			OS_PRINT(os,
-					 "FSM %s: Request \"%s\"->\"%s\" is ignored" NL,
-					 fsm->name,
-					 fsm->sta_curr->name,
-					 (*node)->name);
+	if(node) {
+		if(fsm_switch_request(fsm, node) == false) {
+			OS_LOG(os,
+				   FSM_DBG_LVL_RAW,
+				   "FSM %s: Request \"%s\"->\"%s\" is ignored" NL,
+				   fsm->name,
+				   fsm->sta_curr->name,
+				   node->name);
 		}
 	} else {
 		OS_PRINT_ERR(os, "No %s state in \"%s\" fsm:", name, fsm->name);
 		ret = -1;
 	}
 	os->mutex_unlock(fsm->lock);
+	if(ret == 0) {
+		fsm_wakeup(fsm);
+	}
 	return ret;
 }
 
-int fsm_poll(fsm_t fsm) {
-	ASSERT(fsm);
-	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
-	ASSERT(fsm->os);
-	ASSERT(fsm->lock);
+// Queue an event in a lane without blocking, keeping count of sent events and of the lane fill
+static bool fsm_lane_push(fsm_t fsm, uint32_t lane, const struct event *event, uint32_t flags) {
+	if(fsm_mailbox_push(&fsm->lanes[lane], event, flags) == false) {
+		return false;
+	}
+#if FSM_USE_STATS
+	STATS_INC(fsm->stats.events_sent);
+	uint32_t count = fsm_mailbox_count(&fsm->lanes[lane]);
+	uint32_t peak  = __atomic_load_n(&fsm->stats.queue_high_water[lane], __ATOMIC_RELAXED);
+	while(count > peak
+		  && !__atomic_compare_exchange_n(&fsm->stats.queue_high_water[lane],
+										  &peak,
+										  count,
+										  true,
+										  __ATOMIC_RELAXED,
+										  __ATOMIC_RELAXED)) {
+	}
+#endif
+	return true;
+}
+
+// Get the semaphore senders wait on while a lane is full, creating it on first use. Returns NULL
+// if out of memory.
+static void *fsm_space_sem(fsm_t fsm) {
 	os_handle_t os = fsm->os;
+	if(__atomic_load_n(&fsm->space, __ATOMIC_ACQUIRE) == NULL) {
+		os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+		if(fsm->space == NULL) {
+			__atomic_store_n(&fsm->space, os->sem_create(), __ATOMIC_RELEASE);
+		}
+		os->mutex_unlock(fsm->lock);
+	}
+	return __atomic_load_n(&fsm->space, __ATOMIC_ACQUIRE);
+}
 
-	uint32_t		ts				 = os->uptime_ms();
-	state_handler_t exit			 = NULL;
-	state_handler_t enter			 = NULL;
-	state_handler_t handler			 = NULL;
-	fsm_t		   *child_fsm_buf	 = NULL;
-	uint32_t		child_fsm_number = 0;
-	struct event	poll_event;
+// Wake a sender waiting for a full lane after an event has been popped
+static void fsm_space_signal(fsm_t fsm) {
+	// Pairs with the increment of space_waiters before the sender retries its push
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&fsm->space_waiters, __ATOMIC_ACQUIRE) != 0) {
+		fsm->os->sem_post(__atomic_load_n(&fsm->space, __ATOMIC_ACQUIRE));
+	}
+}
 
-	// Process state transition
-	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
-	ASSERT(fsm->event_queue);
-	void	*event_queue = fsm->event_queue;
-	state_t *sta_prev	 = &(fsm->sta_prev);
-	state_t *sta_curr	 = &(fsm->sta_curr);
-	state_t *sta_next	 = &(fsm->sta_next);
-	if(*sta_next) {
-		*sta_prev = *sta_curr;
-		*sta_curr = *sta_next;
-		*sta_next = NULL;
-		exit	  = (*sta_prev)->handler;
-		enter	  = (*sta_curr)->handler;
-#if DEBUG_SHOW_FSM_STATE_TRANSITION
-		OS_PRINT(os,
-				 "FSM %s: {%lu,%s}==>{%lu,%s}" NL,
-				 fsm->name,
-				 (*sta_prev)->id,
-				 (*sta_prev)->name,
-				 (*sta_curr)->id,
-				 (*sta_curr)->name);
-#endif
+// Queue an event in a lane, blocking until the consumer pops an event while the lane is full
+static bool fsm_mailbox_send_wait(fsm_t				  fsm,
+								  uint32_t			  lane,
+								  const struct event *event,
+								  uint32_t			  flags,
+								  uint32_t			  timeout_ms) {
+	if(fsm_lane_push(fsm, lane, event, flags)) {
+		return true;
 	}
-	handler = (*sta_curr)->handler;
-	// Count child fsm number
-	fsm_t *node = &((*sta_curr)->child_fsm);
-	while(*node) {
-		child_fsm_number++;
-		node = &((*node)->next);
+	os_handle_t os		 = fsm->os;
+	uint32_t	ts_start = os->uptime_ms();
+	void	   *space	 = timeout_ms ? fsm_space_sem(fsm) : NULL;
+	bool		pushed	 = false;
+	if(space) {
+		__atomic_add_fetch(&fsm->space_waiters, 1, __ATOMIC_SEQ_CST);
 	}
-	// Copy child fsm to buffer
-	if(child_fsm_number) {
-		child_fsm_buf = os->malloc(sizeof(struct fsm) * child_fsm_number);
-		ASSERT(child_fsm_buf);
-		node  = &((*sta_curr)->child_fsm);
-		int i = 0;
-		while(*node) {
-			child_fsm_buf[i++] = *node;
-			node			   = &((*node)->next);
+	for(;;) {
+		if(fsm_lane_push(fsm, lane, event, flags)) {
+			pushed = true;
+			break;
 		}
-	}
-	// Generate polling event
-	if((*sta_curr)->poll_interval != FSM_NO_POLL) {	 // Do not poll if poll_interval == FSM_NO_POLL
-		if(ts - (*sta_curr)->ts_poll >= (*sta_curr)->poll_interval) {
-			(*sta_curr)->ts_poll = ts;
-			poll_event.timestamp = ts;
-			poll_event.type		 = FSM_EVT_POLL;
-			poll_event.data		 = NULL;
-			poll_event.datalen	 = 0;
-			// Send polling event
-			if(os->queue_send(fsm->event_queue, &poll_event, 0) == false) {
-				OS_PRINT_ERR(os, "Failed to send poll event to fsm %s", fsm->name);
-			}
-			// Update polling interval
-			(*sta_curr)->poll_interval = (*sta_curr)->poll_interval_next;
+		uint32_t elapsed = os->uptime_ms() - ts_start;
+		if(elapsed >= timeout_ms) {
+			break;
+		}
+		if(space == NULL) {
+			os->delay_ms(1);  // No semaphore, poll the lane
+		} else if(timeout_ms == BLOCKTIME_MAX) {
+			os->sem_wait(space, BLOCKTIME_MAX);
+		} else {
+			os->sem_wait(space, timeout_ms - elapsed);
 		}
-	} else {
-		(*sta_curr)->poll_interval = (*sta_curr)->poll_interval_next;
 	}
-	os->mutex_unlock(fsm->lock);
-
-	struct event event;
-	// Exit previous state
-	if(exit) {
-		struct state_info info = {
-			// Get target state info, which is current state
-			.id	  = (*sta_curr)->id,
-			.name = (*sta_curr)->name,
-		};
-		event.type		= FSM_EVT_EXIT;
-		event.timestamp = ts;
-		event.data		= &info;
-		event.datalen	= sizeof(struct state_info);
-		exit(&event);  // Exit handler of previous state
+	if(space) {
+		__atomic_sub_fetch(&fsm->space_waiters, 1, __ATOMIC_SEQ_CST);
 	}
-#if CLEAR_ALL_EVENT_AFTER_EXIT_STATE
-	os->queue_clear(event_queue);
-#endif
-	// Enter current state
-	if(enter) {
-		struct state_info info = {
-			// Get previous state info, which is current state
-			.id	  = (*sta_prev)->id,
-			.name = (*sta_prev)->name,
-		};
-		event.type		= FSM_EVT_ENTER;
-		event.timestamp = ts;
-		event.data		= &info;
-		event.datalen	= sizeof(struct state_info);
-		enter(&event);	// Exit handler of current state
-	}
-	// Execute state handler when event occur
-	bool event_occured = false;
-	if(os->queue_receive(event_queue, &event, 0)) {
-		// OS_PRINT(os, R_B "FSM %s, state %s received event %u" R_F ,
-		// 		  fsm->name,
-		// 		  (*sta_curr)->name,
-		// 		  event.type);
-		event_occured = true;
-		if(handler) {
-			handler(&event);
+	if(pushed == false) {
+		if(timeout_ms == 0) {
+			STATS_INC(fsm->stats.events_dropped);
+		} else {
+			STATS_INC(fsm->stats.events_timed_out);
 		}
 	}
-	// Process child-fsm
-	for(int i = 0; i < child_fsm_number; i++) {
-		fsm_t child_fsm = child_fsm_buf[i];
-		ASSERT(child_fsm->magic_number == FSM_MAGIC_NUMBER);
-#if PASS_EVENT_TO_CHILD_FSM
-		ASSERT(child_fsm->event_queue);
-		ASSERT(child_fsm->lock);
-		if(event_occured && event.type != FSM_EVT_POLL) {
-			// Event passing is not needed for poll event because it's sent from inside each FSM
-			os->mutex_lock(child_fsm->lock, BLOCKTIME_MAX);
-#if DEBUG_SHOW_FSM_EVENT_PROPAGATION
-			OS_PRINT(os, "Pass event %lu(0x%X) to %s" NL, event.type, event.type, child_fsm->name);
-#endif
-			if(os->queue_send(child_fsm->event_queue, &event, 200) == false) {
-				OS_PRINT_ERR(os,
-							 "Timeout while passing event %u to child %s",
-							 event.type,
-							 child_fsm->name);
-			}
-			os->mutex_unlock(child_fsm->lock);
+	return pushed;
+}
+
+// Get the payload pool of an FSM, allocating it on first use. Returns NULL if out of memory.
+static struct fsm_pool *fsm_payload_pool(fsm_t fsm) {
+	os_handle_t os = fsm->os;
+	if(__atomic_load_n(&fsm->pool, __ATOMIC_ACQUIRE) == NULL) {
+		os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+		if(fsm->pool == NULL) {
+			struct fsm_pool *pool = fsm_pool_new(EVENT_POOL_BLOCK_SIZE, EVENT_POOL_BLOCKS, os);
+			__atomic_store_n(&fsm->pool, pool, __ATOMIC_RELEASE);
 		}
-#endif
-		fsm_poll(child_fsm);
+		os->mutex_unlock(fsm->lock);
 	}
-	os->free(child_fsm_buf);
+	return __atomic_load_n(&fsm->pool, __ATOMIC_ACQUIRE);
+}
 
+// Queue an event with a copy of its payload, inside the mailbox cell if it fits, in a block of the
+// payload pool otherwise. Returns 0 on success, -1 if the mailbox stayed full, -2 if there is no
+// block for the payload.
+static int fsm_mailbox_send_copy(fsm_t				 fsm,
+								 uint32_t			 lane,
+								 const struct event *event,
+								 uint32_t			 timeout_ms) {
+	if(event->data == NULL || event->datalen == 0) {
+		return fsm_mailbox_send_wait(fsm, lane, event, 0, timeout_ms) ? 0 : -1;
+	}
+	if(event->datalen <= FSM_MAILBOX_INLINE_SIZE) {
+		return fsm_mailbox_send_wait(fsm, lane, event, FSM_MAILBOX_INLINE, timeout_ms) ? 0 : -1;
+	}
+	struct fsm_pool *pool  = fsm_payload_pool(fsm);
+	void			*block = NULL;
+	if(pool && event->datalen <= pool->block_size) {
+		block = fsm_pool_alloc(pool);
+	}
+	if(block == NULL) {
+		return -2;
+	}
+	memcpy(block, event->data, event->datalen);
+	struct event copy = *event;
+	copy.data		  = block;
+	if(fsm_mailbox_send_wait(fsm, lane, &copy, FSM_MAILBOX_POOLED, timeout_ms) == false) {
+		fsm_pool_release(block);
+		return -1;
+	}
 	return 0;
 }
 
-int fsm_init(fsm_t fsm, const char *name) {
+// Take the next event. The highest non-empty lane is served first, except that a lower lane
+// passed over EVENT_LANE_MAX_SKIPS times gets one event through, so that a steady stream of
+// urgent events delays bulk work but never stalls it. Only called by the poller.
+static bool fsm_mailbox_take(fsm_t		   fsm,
+							 struct event *event,
+							 uint32_t	  *flags,
+							 void		  *payload,
+							 uint32_t	  *lane) {
+	uint32_t serve = FSM_PRIO_NUMBER;
+	for(uint32_t i = 0; i < FSM_PRIO_NUMBER; i++) {
+		if(fsm_lane_ready(fsm, i) == false) {
+			fsm->lane_skips[i] = 0;
+			continue;
+		}
+		if(serve == FSM_PRIO_NUMBER) {
+			serve = i;
+		} else if(fsm->lane_skips[i] >= EVENT_LANE_MAX_SKIPS
+				  && fsm->lane_skips[serve] < EVENT_LANE_MAX_SKIPS) {
+			serve = i;
+		}
+	}
+	if(serve == FSM_PRIO_NUMBER) {
+		return false;
+	}
+	if(serve == FSM_PRIO_NORMAL && __atomic_load_n(&fsm->poll_due, __ATOMIC_ACQUIRE)
+	   && (int32_t)(fsm_mailbox_tail(&fsm->lanes[serve]) - fsm->poll_pos) >= 0) {
+		// Everything queued before the poll became due has been taken
+		event->timestamp = fsm->poll_ts;
+		event->type		 = FSM_EVT_POLL;
+		event->data		 = NULL;
+		event->datalen	 = 0;
+		*flags			 = 0;
+		__atomic_store_n(&fsm->poll_due, false, __ATOMIC_RELEASE);
+	} else if(fsm_mailbox_pop(&fsm->lanes[serve], event, flags, payload) == false) {
+		return false;
+	} else {
+		fsm_space_signal(fsm);
+	}
+	for(uint32_t i = 0; i < FSM_PRIO_NUMBER; i++) {
+		if(i == serve) {
+			fsm->lane_skips[i] = 0;
+		} else if(fsm->lane_skips[i] < EVENT_LANE_MAX_SKIPS && fsm_lane_ready(fsm, i)) {
+			fsm->lane_skips[i]++;
+		}
+	}
+	*lane = serve;
+	STATS_INC(fsm->stats.events_received);
+	return true;
+}
+
+// Whether a child FSM subscribed to an event type. Types in the bitset are checked without
+// taking the lock of the child.
+static bool fsm_event_accepted(fsm_t fsm, uint32_t type) {
+	if(__atomic_load_n(&fsm->subscriptions, __ATOMIC_ACQUIRE) == 0) {
+		return true;
+	}
+	if(type < SUBSCRIBE_BITSET_TYPES) {
+		uint32_t bits = __atomic_load_n(&fsm->sub_bits[type / 32], __ATOMIC_RELAXED);
+		return (bits >> (type % 32)) & 1;
+	}
+	os_handle_t os = fsm->os;
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	bool ret = fsm_map_get(&fsm->sub_types, type) != NULL;
+	os->mutex_unlock(fsm->lock);
+	return ret;
+}
+
+// Pass an event to a child FSM in the same lane without blocking. A pooled payload is shared by
+// reference, an inline one is copied into the child's cell and a borrowed one is passed as it is.
+// Returns false and counts the drop if the lane of the child is full.
+static bool fsm_mailbox_forward(fsm_t				child,
+								uint32_t			lane,
+								const struct event *event,
+								uint32_t			flags) {
+	if(flags & FSM_MAILBOX_POOLED) {
+		fsm_pool_retain(event->data);
+	}
+	if(fsm_lane_push(child, lane, event, flags)) {
+		return true;
+	}
+	if(flags & FSM_MAILBOX_POOLED) {
+		fsm_pool_release(event->data);
+	}
+	__atomic_add_fetch(&child->dropped, 1, __ATOMIC_RELAXED);
+	STATS_INC(child->stats.events_dropped);
+	return false;
+}
+
+// Discard all queued events and return their pooled payloads
+static void fsm_mailbox_drain(fsm_t fsm) {
+	struct event event;
+	uint32_t	 flags;
+	__atomic_store_n(&fsm->poll_due, false, __ATOMIC_RELEASE);
+	for(uint32_t i = 0; i < FSM_PRIO_NUMBER; i++) {
+		while(fsm_mailbox_pop(&fsm->lanes[i], &event, &flags, NULL)) {
+			if(flags & FSM_MAILBOX_POOLED) {
+				fsm_pool_release(event.data);
+			}
+		}
+	}
+}
+
+// Remaining part of a microsecond budget that started at ts_start_us
+static uint32_t fsm_budget_left_us(os_handle_t os, uint32_t ts_start_us, uint32_t max_time_us) {
+	if(max_time_us == FSM_POLL_NO_LIMIT) {
+		return FSM_POLL_NO_LIMIT;
+	}
+	uint32_t elapsed = os->uptime_us() - ts_start_us;
+	return elapsed < max_time_us ? max_time_us - elapsed : 0;
+}
+
+// Call the handler of a state, timing it when statistics are enabled
+static void fsm_call_handler(fsm_t fsm, state_t state, state_handler_t handler, event_t event) {
+#if FSM_USE_STATS
+	os_handle_t				os	  = fsm->os;
+	struct fsm_state_stats *stats = &state->stats;
+	uint32_t				start = os->uptime_us();
+	handler(event);
+	uint32_t elapsed = os->uptime_us() - start;
+	STATS_INC(stats->handler_count);
+	__atomic_add_fetch(&stats->handler_total_us, elapsed, __ATOMIC_RELAXED);
+	if(elapsed > __atomic_load_n(&stats->handler_max_us, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&stats->handler_max_us, elapsed, __ATOMIC_RELAXED);
+	}
+#else
+	handler(event);
+#endif
+}
+
+// Carry out a pending switch: exit the current state, then enter the requested one. Returns false
+// if no switch was pending.
+static bool fsm_poll_transition(fsm_t fsm, uint32_t ts) {
+	os_handle_t os = fsm->os;
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	state_t prev = fsm->sta_curr;
+	state_t curr = fsm->sta_next;
+	if(curr == NULL) {
+		os->mutex_unlock(fsm->lock);
+		return false;
+	}
+	fsm->sta_prev		  = prev;
+	fsm->sta_curr		  = curr;
+	fsm->sta_next		  = fsm_switch_dequeue(fsm);
+	fsm_snapshot_publish(fsm, true);
+	state_handler_t exit  = prev->exit;
+	state_handler_t enter = curr->enter;
+#if FSM_USE_STATS
+	// The root state is shared by all FSMs and has no statistics
+	if(prev != &root_state) {
+		uint32_t dwell = ts - prev->ts_enter;
+		__atomic_add_fetch(&prev->stats.dwell_total_ms, dwell, __ATOMIC_RELAXED);
+		if(dwell > prev->stats.dwell_max_ms) {
+			__atomic_store_n(&prev->stats.dwell_max_ms, dwell, __ATOMIC_RELAXED);
+		}
+	}
+	STATS_INC(curr->stats.enter_count);
+	curr->ts_enter = ts;
+#endif
+	TRACE(FSM_TRACE_SWITCH, fsm, FSM_EVT_ENTER, prev->id, curr->id);
+#if DEBUG_SHOW_FSM_STATE_TRANSITION
+	OS_LOG(os,
+		   FSM_DBG_LVL_RAW,
+		   "FSM %s: {%lu,%s}==>{%lu,%s}" NL,
+		   fsm->name,
+		   prev->id,
+		   prev->name,
+		   curr->id,
+		   curr->name);
+#endif
+	os->mutex_unlock(fsm->lock);
+
+	struct event event;
+	// Exit previous state
+	if(exit) {
+		struct state_info info = {
+			// Get target state info, which is current state
+			.id	  = curr->id,
+			.name = curr->name,
+		};
+		event.type		= FSM_EVT_EXIT;
+		event.timestamp = ts;
+		event.data		= &info;
+		event.datalen	= sizeof(struct state_info);
+		exit(&event);  // Exit handler of previous state
+	}
+	// Timers of the previous state end with it, including those started by its exit handler
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	fsm_state_timers_cancel(fsm, prev);
+	os->mutex_unlock(fsm->lock);
+#if CLEAR_ALL_EVENT_AFTER_EXIT_STATE
+	fsm_mailbox_drain(fsm);
+#endif
+	// Enter current state
+	if(enter) {
+		struct state_info info = {
+			// Get previous state info
+			.id	  = prev->id,
+			.name = prev->name,
+		};
+		event.type		= FSM_EVT_ENTER;
+		event.timestamp = ts;
+		event.data		= &info;
+		event.datalen	= sizeof(struct state_info);
+		enter(&event);	// Enter handler of current state
+	}
+	return true;
+}
+
+// Run-to-completion mode: carry out the switches requested while the last event was handled,
+// including chains started by enter handlers, before the poll returns
+static void fsm_poll_microsteps(fsm_t fsm, uint32_t ts) {
+	os_handle_t os	  = fsm->os;
+	uint32_t	bound = __atomic_load_n(&fsm->max_microsteps, __ATOMIC_RELAXED);
+	for(uint32_t step = 0; step < bound; step++) {
+		if(fsm_poll_transition(fsm, ts) == false) {
+			return;
+		}
+	}
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	bool left = fsm->sta_next != NULL;
+	os->mutex_unlock(fsm->lock);
+	if(left) {
+		OS_PRINT_ERR(os,
+					 "FSM %s: More than %u microsteps, continuing on next poll",
+					 fsm->name,
+					 (unsigned)bound);
+	}
+}
+
+// One polling pass: process a pending transition, dispatch at most one event and poll the
+// child FSMs with the full event budget and the remaining time budget. Returns true if an event
+// was dispatched to this FSM.
+static bool fsm_poll_step(fsm_t	   fsm,
+						  uint32_t max_events,
+						  uint32_t ts_start_us,
+						  uint32_t max_time_us,
+						  int	  *processed,
+						  bool	  *pending) {
+	os_handle_t os = fsm->os;
+
+	uint32_t		ts				 = os->uptime_ms();
+	state_handler_t handler			 = NULL;
+	fsm_t		   *child_fsm_buf	 = NULL;
+	uint32_t		child_fsm_number = 0;
+	bool			timers_due		 = false;
+	bool			transitions		 = false;
+
+	// Process state transition
+	fsm_poll_transition(fsm, ts);
+
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	ASSERT(fsm->lanes[FSM_PRIO_NORMAL].cells);
+	state_t curr = fsm->sta_curr;
+	handler		 = curr->handler;
+	// Refresh the child-FSM snapshot only if the current state or its child set changed
+	if(fsm->child_buf_state != curr
+	   || fsm->child_buf_gen != __atomic_load_n(&curr->child_fsm_gen, __ATOMIC_ACQUIRE)) {
+		fsm_child_buf_refresh(fsm, curr);
+	}
+	child_fsm_buf	 = fsm->child_buf;
+	child_fsm_number = fsm->child_buf_number;
+	// Generate polling event
+	if(curr->poll_interval != FSM_NO_POLL) {  // Do not poll if poll_interval == FSM_NO_POLL
+		if(ts - curr->ts_poll >= curr->poll_interval) {
+			curr->ts_poll = ts;
+			// Mark the poll event due behind the events queued so far, a poll that is still
+			// pending absorbs this one
+			if(fsm->poll_due == false) {
+				fsm->poll_pos = fsm_mailbox_head(&fsm->lanes[FSM_PRIO_NORMAL]);
+				fsm->poll_ts  = ts;
+				__atomic_store_n(&fsm->poll_due, true, __ATOMIC_RELEASE);
+			}
+			// Update polling interval
+			curr->poll_interval = curr->poll_interval_next;
+		}
+	} else {
+		curr->poll_interval = curr->poll_interval_next;
+	}
+	timers_due = fsm->wheel && fsm_wheel_next(fsm->wheel, ts) == 0;
+	if(fsm->trans.dirty) {
+		fsm_transition_compile(fsm);
+	}
+	transitions = fsm->trans.cells != NULL;
+	os->mutex_unlock(fsm->lock);
+
+	struct event event;
+	// Dispatch expired timers, one at a time so that handlers may start or stop timers
+	while(timers_due) {
+		os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+		struct fsm_timer *timer	 = fsm_wheel_expire(fsm->wheel, ts);
+		bool			  active = timer && timer->owner == curr;
+		if(timer) {
+			event.type		= timer->type;
+			event.timestamp = ts;
+			event.data		= NULL;
+			event.datalen	= 0;
+		}
+		if(timer && timer->period) {
+			// Re-arm periodic timers, periods missed while not polled are skipped
+			timer->expires += timer->period;
+			if((int32_t)(timer->expires - ts) <= 0) {
+				timer->expires = ts + timer->period;
+			}
+			fsm_wheel_add(fsm->wheel, timer, ts);
+		}
+		os->mutex_unlock(fsm->lock);
+		if(timer == NULL) {
+			break;
+		}
+		if(active && handler) {
+			(*processed)++;
+			TRACE(FSM_TRACE_EVENT, fsm, event.type, curr->id, curr->id);
+			fsm_call_handler(fsm, curr, handler, &event);
+		}
+	}
+	// Execute state handler when event occur. Inline payloads are copied to the stack, so that they
+	// stay valid while the handler runs, pooled payloads are released after propagation.
+	bool	 event_occured = false;
+	uint32_t flags		   = 0;
+	uint32_t lane		   = FSM_PRIO_NORMAL;
+	void	*block		   = NULL;
+	uint64_t payload[FSM_MAILBOX_INLINE_SIZE / sizeof(uint64_t)];
+	if(fsm_mailbox_take(fsm, &event, &flags, payload, &lane)) {
+		block = (flags & FSM_MAILBOX_POOLED) ? event.data : NULL;
+		TRACE(FSM_TRACE_EVENT, fsm, event.type, curr->id, curr->id);
+		event_occured = true;
+		(*processed)++;
+		// Events that fire a transition do not reach the handler
+		bool fired = transitions && fsm_transition_fire(fsm, &event);
+		if(!fired && handler) {
+			fsm_call_handler(fsm, curr, handler, &event);
+		}
+	}
+	// Process child-fsm
+	for(int i = 0; i < child_fsm_number; i++) {
+		fsm_t child_fsm = child_fsm_buf[i];
+		ASSERT(child_fsm->magic_number == FSM_MAGIC_NUMBER);
+#if PASS_EVENT_TO_CHILD_FSM
+		ASSERT(child_fsm->lanes[FSM_PRIO_NORMAL].cells);
+		if(event_occured && event.type != FSM_EVT_POLL
+		   && fsm_event_accepted(child_fsm, event.type)) {
+			// Event passing is not needed for poll event because it's sent from inside each FSM
+#if DEBUG_SHOW_FSM_EVENT_PROPAGATION
+			OS_PRINT(os, "Pass event %lu(0x%X) to %s" NL, event.type, event.type, child_fsm->name);
+#endif
+			if(fsm_mailbox_forward(child_fsm, lane, &event, flags) == false) {
+				OS_PRINT_ERR(os,
+							 "Queue of child %s is full, event %u dropped",
+							 child_fsm->name,
+							 event.type);
+			}
+		}
+#endif
+		bool child_pending = false;
+		*processed += fsm_poll_ex(child_fsm,
+								  max_events,
+								  fsm_budget_left_us(os, ts_start_us, max_time_us),
+								  &child_pending);
+		*pending = *pending || child_pending;
+	}
+	if(block) {
+		fsm_pool_release(block);
+	}
+	if(__atomic_load_n(&fsm->max_microsteps, __ATOMIC_RELAXED) > 0) {
+		fsm_poll_microsteps(fsm, ts);
+	}
+
+	return event_occured;
+}
+
+int fsm_poll_ex(fsm_t fsm, uint32_t max_events, uint32_t max_time_us, bool *pending) {
+	ASSERT(fsm);
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	ASSERT(fsm->os);
+	ASSERT(fsm->lock);
+	ASSERT(max_events > 0);
+	os_handle_t os			= fsm->os;
+	uint32_t	ts_start_us = max_time_us == FSM_POLL_NO_LIMIT ? 0 : os->uptime_us();
+	uint32_t	dispatched	= 0;
+	int			processed	= 0;
+	bool		more		= false;
+
+	// Repeat polling passes until the queue runs dry or the budget is used up. Every pass
+	// processes transitions first, so events after a switch reach the new state.
+	while(fsm_poll_step(fsm, max_events, ts_start_us, max_time_us, &processed, &more)) {
+		dispatched++;
+		if(dispatched >= max_events
+		   || fsm_budget_left_us(os, ts_start_us, max_time_us) == 0) {
+			more = more || fsm_mailbox_pending(fsm);
+			break;
+		}
+	}
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	more = more || (fsm->sta_next != NULL);
+	os->mutex_unlock(fsm->lock);
+	if(pending) {
+		*pending = more;
+	}
+	return processed;
+}
+
+int fsm_poll(fsm_t fsm) {
+	fsm_poll_ex(fsm, 1, FSM_POLL_NO_LIMIT, NULL);
+	return 0;
+}
+
+int fsm_init(fsm_t fsm, const char *name) {
 	ASSERT(fsm);
 	ASSERT(name);
 	fsm->os		   = (os_handle_t)&fsm_port_os_handle;
 	os_handle_t os = fsm->os;
 	// Init root state if not
 	if(root_state.lock == NULL) {
-		root_state.lock = os->mutex_create();
+		fsm_name_init(os);
+		root_state.name = fsm_name_intern_static(STATE_NAME_ROOT, &root_state.name_atom);
+		root_state.lock = os->mutex_init(root_lock);
+	}
+	if(fsm->is_static || fsm->in_slab) {
+		fsm->lock = os->mutex_init(((struct fsm_static *)fsm)->lock);
+	} else {
+		fsm->lock = os->mutex_create();
 	}
-	fsm->lock = os->mutex_create();
 	ASSERT(fsm->lock);
 	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
-	ASSERT(fsm->event_queue == NULL);
-	fsm->event_queue   = os->queue_create(EVENT_QUEUE_LENGTH, sizeof(struct event));
-	fsm->poll_interval = DEFAULT_POLLING_INTERVAL;
-	fsm->magic_number  = FSM_MAGIC_NUMBER;
-	fsm->name		   = name;
-	fsm->parent_state  = NULL;
-	fsm->state_list	   = NULL;
-	fsm->sta_prev	   = &root_state;
-	fsm->sta_curr	   = &root_state;
-	fsm->sta_next	   = NULL;
-	fsm->next		   = NULL;
+	uint32_t cell = 0;
+	for(uint32_t i = 0; i < FSM_PRIO_NUMBER; i++) {
+		ASSERT(fsm->lanes[i].cells == NULL);
+		if(fsm->is_static || fsm->in_slab) {
+			struct fsm_static *storage = (struct fsm_static *)fsm;
+			fsm_mailbox_init_static(&fsm->lanes[i], &storage->cells[cell], lane_length[i]);
+		} else {
+			fsm_mailbox_init(&fsm->lanes[i], lane_length[i], os);
+		}
+		ASSERT(fsm->lanes[i].cells);
+		fsm->lane_skips[i] = 0;
+		cell += lane_length[i];
+	}
+	fsm->poll_due			= false;
+	fsm->poll_pos			= 0;
+	fsm->poll_ts			= 0;
+	fsm->poll_interval		= DEFAULT_POLLING_INTERVAL;
+	fsm->magic_number		= FSM_MAGIC_NUMBER;
+	fsm->name				= name;
+	fsm->trace_id			= fsm_trace_id_new();
+#if FSM_USE_TRACE
+	fsm_trace_ring_init(&fsm->trace);
+#endif
+	fsm->parent_state		= NULL;
+	fsm->state_list			= NULL;
+	fsm->state_tail			= NULL;
+	fsm->sta_prev			= &root_state;
+	fsm->sta_curr			= &root_state;
+	fsm->sta_next			= NULL;
+	fsm->snap_seq			= 0;
+	fsm->snap.curr.id		= root_state.id;
+	fsm->snap.curr.name		= root_state.name;
+	fsm->snap.prev			= fsm->snap.curr;
+	fsm->snap.next.id		= STATE_ID_ROOT;
+	fsm->snap.next.name		= NULL;
+	fsm->snap.has_next		= false;
+	fsm->snap.switches		= 0;
+	fsm->max_microsteps		= 0;
+	fsm->pool				= NULL;
+	fsm->space				= NULL;
+	fsm->space_waiters		= 0;
+	fsm->dropped			= 0;
+	fsm->switch_head		= 0;
+	fsm->switch_count		= 0;
+	fsm->wakeup				= NULL;
+	fsm->wheel				= NULL;
+	fsm->child_buf			= NULL;
+	fsm->child_buf_number	= 0;
+	fsm->child_buf_capacity = 0;
+	fsm->child_buf_state	= NULL;
+	fsm->child_buf_gen		= 0;
+	memset(fsm->hooks, 0, sizeof(fsm->hooks));
+	fsm_map_init(&fsm->id_index, os);
+	fsm_map_init(&fsm->name_index, os);
+	fsm_map_init(&fsm->sub_types, os);
+	fsm->subscriptions = 0;
+	memset(fsm->sub_bits, 0, sizeof(fsm->sub_bits));
+#if FSM_USE_STATS
+	memset(&fsm->stats, 0, sizeof(fsm->stats));
+#endif
+	fsm_trans_init(&fsm->trans, os);
 	os->mutex_unlock(fsm->lock);
 	return 0;
 }
@@ -604,6 +1576,9 @@ int fsm_deinit(fsm_t fsm) {
 	ASSERT(fsm->lock);
 	os_handle_t os = fsm->os;
 
+	// Deferred log messages may refer to the name of this FSM
+	fsm_port_log_sync();
+
 	// Delete this fsm from parent state
 	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
 	state_t parent_state = fsm->parent_state;
@@ -617,7 +1592,7 @@ int fsm_deinit(fsm_t fsm) {
 	while(node) {
 		next = node->next;
 		fsm_state_unregister(fsm, node);
-		os->free(node);
+		state_release(node);
 		node = next;
 	}
 
@@ -627,15 +1602,42 @@ int fsm_deinit(fsm_t fsm) {
 	fsm->name		   = NULL;
 	fsm->os			   = NULL;
 	fsm->state_list	   = NULL;
+	fsm->state_tail	   = NULL;
 	fsm->sta_prev	   = NULL;
 	fsm->sta_curr	   = NULL;
 	fsm->sta_next	   = NULL;
-	os->queue_clear(fsm->event_queue);
-	os->queue_destroy(fsm->event_queue);
-	fsm->event_queue	  = NULL;
+	fsm_mailbox_drain(fsm);
+	for(uint32_t i = 0; i < FSM_PRIO_NUMBER; i++) {
+		fsm_mailbox_deinit(&fsm->lanes[i], os);
+	}
+	if(fsm->pool) {
+		fsm_pool_del(fsm->pool);
+		fsm->pool = NULL;
+	}
+	if(fsm->space) {
+		os->sem_destroy(fsm->space);
+		fsm->space = NULL;
+	}
+	fsm_map_deinit(&fsm->id_index);
+	fsm_map_deinit(&fsm->name_index);
+	fsm_map_deinit(&fsm->sub_types);
+	fsm_trans_deinit(&fsm->trans);
+	os->free(fsm->child_buf);
+	os->free(fsm->wheel);
+	fsm->wakeup				= NULL;
+	fsm->wheel				= NULL;
+	fsm->child_buf			= NULL;
+	fsm->child_buf_number	= 0;
+	fsm->child_buf_capacity = 0;
+	fsm->child_buf_state	= NULL;
 	void *lock_to_destroy = fsm->lock;
 	fsm->lock			  = NULL;
-	os->mutex_destroy(lock_to_destroy);
+	os->mutex_unlock(lock_to_destroy);	// Destroying a locked mutex is undefined
+	if(fsm->is_static || fsm->in_slab) {
+		os->mutex_deinit(lock_to_destroy);
+	} else {
+		os->mutex_destroy(lock_to_destroy);
+	}
 	return 0;
 }
 
@@ -680,7 +1682,7 @@ void fsm_print_info(fsm_t fsm) {
 
 	while(*node) {
 		fsm_t parent = (*node)->parent_fsm;
-		fsm_t child	 = (*node)->child_fsm;
+		fsm_t child	 = (*node)->child_fsm_number ? (*node)->child_fsm[0] : NULL;
 		OS_PRINT(os,
 				 " {%s}->{S%u,%s}->{%s}" NL,
 				 parent ? parent->name : "Detached",
@@ -712,6 +1714,18 @@ void fsm_get_state_list_csv(fsm_t fsm, char *csv_buf) {
 	os->mutex_unlock(fsm->lock);
 }
 
+int fsm_set_run_to_completion(fsm_t fsm, uint32_t max_microsteps) {
+	ASSERT(fsm);
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	ASSERT(fsm->os);
+	ASSERT(fsm->lock);
+	os_handle_t os = fsm->os;
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	__atomic_store_n(&fsm->max_microsteps, max_microsteps, __ATOMIC_RELAXED);
+	os->mutex_unlock(fsm->lock);
+	return 0;
+}
+
 int fsm_change_default_poll_interval(fsm_t fsm, uint32_t interval_ms) {
 	ASSERT(fsm);
 	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
@@ -728,41 +1742,432 @@ int fsm_change_state_poll_interval(state_t state, uint32_t interval_ms) {
 	ASSERT(state);
 	ASSERT(state->magic_number == STATE_MAGIC_NUMBER);
 	state->poll_interval_next = interval_ms;
+	fsm_wakeup(state->parent_fsm);
 	return 0;
 }
 
-int fsm_event_send(fsm_t fsm, uint32_t type, void *data, uint32_t datalen) {
-	int			 ret = 0;
-	struct event event;
+int fsm_timer_start(state_t state, uint32_t type, uint32_t delay_ms, uint32_t period_ms) {
+	int ret = 0;
+	ASSERT(state);
+	ASSERT(state->magic_number == STATE_MAGIC_NUMBER);
+	fsm_t fsm = state->parent_fsm;
+	if(fsm == NULL) {
+		return -1;	// Timers are driven by the FSM the state is registered to
+	}
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	os_handle_t os	= fsm->os;
+	uint32_t	now = os->uptime_ms();
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	if(fsm->wheel == NULL) {
+		fsm->wheel = os->malloc(sizeof(struct fsm_wheel));
+		if(fsm->wheel == NULL) {
+			OS_PRINT_ERR(os, "Failed to allocate timer wheel of fsm %s", fsm->name);
+			ret = -2;
+			goto ERROR;
+		}
+		fsm_wheel_init(fsm->wheel, now);
+	}
+	struct fsm_timer *timer = fsm_map_get(&state->timers, type);
+	if(timer) {
+		fsm_wheel_del(fsm->wheel, timer);  // Re-arm
+	} else {
+		timer = os->malloc(sizeof(struct fsm_timer));
+		if(timer == NULL || fsm_map_put(&state->timers, type, timer) != 0) {
+			OS_PRINT_ERR(os, "Failed to allocate timer %u of state %s", type, state->name);
+			os->free(timer);
+			ret = -2;
+			goto ERROR;
+		}
+		fsm_timer_init(timer);
+		timer->type		  = type;
+		timer->owner	  = state;
+		timer->owner_next = state->timer_list;
+		state->timer_list = timer;
+	}
+	timer->expires = now + delay_ms;
+	timer->period  = period_ms;
+	fsm_wheel_add(fsm->wheel, timer, now);
+ERROR:
+	os->mutex_unlock(fsm->lock);
+	if(ret == 0) {
+		fsm_wakeup(fsm);
+	}
+	return ret;
+}
+
+int fsm_timer_stop(state_t state, uint32_t type) {
+	int ret = -1;
+	ASSERT(state);
+	ASSERT(state->magic_number == STATE_MAGIC_NUMBER);
+	fsm_t fsm = state->parent_fsm;
+	if(fsm == NULL) {
+		return -1;
+	}
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	os_handle_t os = fsm->os;
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	struct fsm_timer *timer = fsm_map_get(&state->timers, type);
+	if(timer && fsm_timer_armed(timer)) {
+		fsm_wheel_del(fsm->wheel, timer);
+		ret = 0;
+	}
+	os->mutex_unlock(fsm->lock);
+	return ret;
+}
+
+uint32_t fsm_next_deadline(fsm_t fsm) {
 	ASSERT(fsm);
 	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
 	ASSERT(fsm->os);
 	ASSERT(fsm->lock);
-	ASSERT(fsm->event_queue);
+	return fsm_deadline_ms(fsm, fsm->os->uptime_ms());
+}
+
+int fsm_set_wakeup(fsm_t fsm, fsm_wakeup_t hook, void *arg) {
+	ASSERT(fsm);
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	ASSERT(fsm->os);
+	ASSERT(fsm->lock);
+	os_handle_t		 os	  = fsm->os;
+	struct fsm_hook *old  = NULL;
+	struct fsm_hook *next = NULL;
+	// Publish the new pair in the slot that is not published. It may still be used by senders of
+	// an earlier change, so wait for them without holding the lock, hooks may take it.
+	for(;;) {
+		os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+		old	 = fsm->wakeup;
+		next = old == &fsm->hooks[0] ? &fsm->hooks[1] : &fsm->hooks[0];
+		if(hook == NULL || __atomic_load_n(&next->users, __ATOMIC_SEQ_CST) == 0) {
+			break;
+		}
+		os->mutex_unlock(fsm->lock);
+		os->delay_ms(1);
+	}
+	if(hook) {
+		next->hook = hook;
+		next->arg  = arg;
+	}
+	__atomic_store_n(&fsm->wakeup, hook ? next : NULL, __ATOMIC_SEQ_CST);
+	os->mutex_unlock(fsm->lock);
+	// Senders still calling the old pair finish before this returns
+	while(old && __atomic_load_n(&old->users, __ATOMIC_SEQ_CST) != 0) {
+		os->delay_ms(1);
+	}
+	return 0;
+}
+
+int fsm_event_try_send(fsm_t fsm, uint32_t type, void *data, uint32_t datalen) {
+	struct event event;
+	ASSERT(fsm);
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	ASSERT(fsm->lanes[FSM_PRIO_NORMAL].cells);
+	event.timestamp = fsm->os->uptime_ms();
+	event.type		= type;
+	event.data		= data;
+	event.datalen	= datalen;
+	if(fsm_lane_push(fsm, FSM_PRIO_NORMAL, &event, 0) == false) {
+		STATS_INC(fsm->stats.events_dropped);
+		return -1;
+	}
+	fsm_wakeup(fsm);
+	return 0;
+}
+
+int fsm_event_send_timeout(fsm_t	fsm,
+						   uint32_t type,
+						   void	   *data,
+						   uint32_t datalen,
+						   uint32_t timeout_ms) {
+	return fsm_event_send_prio(fsm, FSM_PRIO_NORMAL, type, data, datalen, timeout_ms);
+}
+
+int fsm_event_send_prio(fsm_t	 fsm,
+						uint32_t prio,
+						uint32_t type,
+						void	*data,
+						uint32_t datalen,
+						uint32_t timeout_ms) {
+	struct event event;
+	ASSERT(fsm);
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	ASSERT(fsm->os);
+	ASSERT(prio < FSM_PRIO_NUMBER);
+	ASSERT(fsm->lanes[prio].cells);
 	os_handle_t os	= fsm->os;
 	event.timestamp = os->uptime_ms();
 	event.type		= type;
 	event.data		= data;
 	event.datalen	= datalen;
-	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
 #if DEBUG_SHOW_FSM_EVENT_PROPAGATION
 	OS_PRINT(os, "Send event %lu(0x%X) to %s" NL, type, type, fsm->name);
 #endif
-	if(os->queue_send(fsm->event_queue, &event, 200) == false) {
-		OS_PRINT_ERR(os, "Timeout while sending event %lu", type);
+	if(fsm_mailbox_send_wait(fsm, prio, &event, 0, timeout_ms) == false) {
+		return -1;
+	}
+	fsm_wakeup(fsm);
+	return 0;
+}
+
+int fsm_event_send(fsm_t fsm, uint32_t type, void *data, uint32_t datalen) {
+	int ret = fsm_event_send_timeout(fsm, type, data, datalen, EVENT_SEND_TIMEOUT);
+	if(ret != 0) {
+		OS_PRINT_ERR(fsm->os, "Timeout while sending event %u", (unsigned)type);
+	}
+	return ret;
+}
+
+int fsm_event_send_copy(fsm_t fsm, uint32_t type, const void *data, uint32_t datalen) {
+	struct event event;
+	ASSERT(fsm);
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	ASSERT(fsm->os);
+	ASSERT(fsm->lanes[FSM_PRIO_NORMAL].cells);
+	os_handle_t os	= fsm->os;
+	event.timestamp = os->uptime_ms();
+	event.type		= type;
+	event.data		= (void *)data;
+	event.datalen	= datalen;
+	int ret			= fsm_mailbox_send_copy(fsm, FSM_PRIO_NORMAL, &event, EVENT_SEND_TIMEOUT);
+	if(ret == 0) {
+		fsm_wakeup(fsm);
+	} else if(ret == -1) {
+		OS_PRINT_ERR(os, "Timeout while sending event %u", (unsigned)type);
+	} else {
+		OS_PRINT_ERR(
+			os, "No payload block for event %u of %u bytes", (unsigned)type, (unsigned)datalen);
+	}
+	return ret;
+}
+
+int fsm_event_subscribe(fsm_t fsm, uint32_t type) {
+	int ret = 0;
+	ASSERT(fsm);
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	ASSERT(fsm->os);
+	ASSERT(fsm->lock);
+	os_handle_t os = fsm->os;
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	if(type < SUBSCRIBE_BITSET_TYPES) {
+		uint32_t bit = 1u << (type % 32);
+		if((fsm->sub_bits[type / 32] & bit) == 0) {
+			__atomic_fetch_or(&fsm->sub_bits[type / 32], bit, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&fsm->subscriptions, 1, __ATOMIC_RELEASE);
+		}
+	} else if(fsm_map_get(&fsm->sub_types, type) == NULL) {
+		if(fsm_map_put(&fsm->sub_types, type, (void *)fsm) == 0) {
+			__atomic_add_fetch(&fsm->subscriptions, 1, __ATOMIC_RELEASE);
+		} else {
+			OS_PRINT_ERR(os, "Failed to subscribe fsm %s to event %u", fsm->name, (unsigned)type);
+			ret = -1;
+		}
+	}
+	os->mutex_unlock(fsm->lock);
+	return ret;
+}
+
+int fsm_event_unsubscribe(fsm_t fsm, uint32_t type) {
+	int ret = 0;
+	ASSERT(fsm);
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	ASSERT(fsm->os);
+	ASSERT(fsm->lock);
+	os_handle_t os = fsm->os;
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	if(type < SUBSCRIBE_BITSET_TYPES) {
+		uint32_t bit = 1u << (type % 32);
+		if(fsm->sub_bits[type / 32] & bit) {
+			__atomic_fetch_and(&fsm->sub_bits[type / 32], ~bit, __ATOMIC_RELAXED);
+			__atomic_sub_fetch(&fsm->subscriptions, 1, __ATOMIC_RELEASE);
+		} else {
+			ret = -1;
+		}
+	} else if(fsm_map_remove(&fsm->sub_types, type)) {
+		__atomic_sub_fetch(&fsm->subscriptions, 1, __ATOMIC_RELEASE);
+	} else {
 		ret = -1;
 	}
 	os->mutex_unlock(fsm->lock);
 	return ret;
 }
 
+int fsm_get_stats(fsm_t fsm, struct fsm_stats *stats) {
+	ASSERT(fsm);
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	ASSERT(stats);
+#if FSM_USE_STATS
+	stats->events_sent		= __atomic_load_n(&fsm->stats.events_sent, __ATOMIC_RELAXED);
+	stats->events_received	= __atomic_load_n(&fsm->stats.events_received, __ATOMIC_RELAXED);
+	stats->events_dropped	= __atomic_load_n(&fsm->stats.events_dropped, __ATOMIC_RELAXED);
+	stats->events_timed_out = __atomic_load_n(&fsm->stats.events_timed_out, __ATOMIC_RELAXED);
+	for(uint32_t i = 0; i < FSM_PRIO_NUMBER; i++) {
+		stats->queue_high_water[i] =
+			__atomic_load_n(&fsm->stats.queue_high_water[i], __ATOMIC_RELAXED);
+	}
+	return 0;
+#else
+	memset(stats, 0, sizeof(*stats));
+	return -1;
+#endif
+}
+
+int fsm_state_get_stats(state_t state, struct fsm_state_stats *stats) {
+	ASSERT(state);
+	ASSERT(state->magic_number == STATE_MAGIC_NUMBER);
+	ASSERT(stats);
+#if FSM_USE_STATS
+	const struct fsm_state_stats *src = &state->stats;
+	stats->enter_count		= __atomic_load_n(&src->enter_count, __ATOMIC_RELAXED);
+	stats->dwell_total_ms	= __atomic_load_n(&src->dwell_total_ms, __ATOMIC_RELAXED);
+	stats->dwell_max_ms		= __atomic_load_n(&src->dwell_max_ms, __ATOMIC_RELAXED);
+	stats->handler_count	= __atomic_load_n(&src->handler_count, __ATOMIC_RELAXED);
+	stats->handler_total_us = __atomic_load_n(&src->handler_total_us, __ATOMIC_RELAXED);
+	stats->handler_max_us	= __atomic_load_n(&src->handler_max_us, __ATOMIC_RELAXED);
+	return 0;
+#else
+	memset(stats, 0, sizeof(*stats));
+	return -1;
+#endif
+}
+
+int fsm_slab_reserve(uint32_t kind, uint32_t number, uint32_t grow) {
+	ASSERT(kind < FSM_SLAB_NUMBER);
+	os_handle_t		 os	  = (os_handle_t)&fsm_port_os_handle;
+	struct fsm_slab *slab = &slabs[kind];
+	if(slab->lock == NULL) {
+		size_t size = sizeof(struct state_static);
+		if(kind == FSM_SLAB_FSM) {
+			size = sizeof(struct fsm_static);
+		}
+		fsm_slab_init(slab, (uint32_t)size, os);
+	}
+	if(fsm_slab_add(slab, number, grow) != 0) {
+		OS_PRINT_ERR(
+			os, "Failed to reserve %u objects in slab %u", (unsigned)number, (unsigned)kind);
+		return -1;
+	}
+	return 0;
+}
+
+int fsm_slab_get_stats(uint32_t kind, struct fsm_slab_stats *stats) {
+	ASSERT(kind < FSM_SLAB_NUMBER);
+	ASSERT(stats);
+	fsm_slab_read_stats(&slabs[kind], stats);
+	return 0;
+}
+
+uint32_t fsm_get_trace_id(fsm_t fsm) {
+	ASSERT(fsm);
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	return fsm->trace_id;
+}
+
+uint32_t fsm_trace_read(fsm_t					 fsm,
+						uint32_t				*cursor,
+						struct fsm_trace_record	*records,
+						uint32_t				 max) {
+	ASSERT(fsm);
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	ASSERT(cursor);
+#if FSM_USE_TRACE
+	return fsm_trace_ring_read(&fsm->trace, cursor, records, max);
+#else
+	(void)records;
+	(void)max;
+	return 0;
+#endif
+}
+
+uint32_t fsm_trace_merge(fsm_t					 *fsms,
+						 uint32_t				  number,
+						 uint32_t				 *cursors,
+						 struct fsm_trace_record *records,
+						 uint32_t				  max) {
+	ASSERT(fsms);
+	ASSERT(cursors);
+	uint32_t count = 0;
+	while(count < max) {
+		// Peek at the next record of every ring and take the oldest one
+		uint32_t				best	 = number;
+		uint32_t				best_pos = 0;
+		struct fsm_trace_record record;
+		for(uint32_t i = 0; i < number; i++) {
+			uint32_t pos = cursors[i];
+			if(fsm_trace_read(fsms[i], &pos, &record, 1) == 0) {
+				continue;
+			}
+			if(best == number
+			   || (int32_t)(record.timestamp_us - records[count].timestamp_us) < 0) {
+				best		   = i;
+				best_pos	   = pos;
+				records[count] = record;
+			}
+		}
+		if(best == number) {
+			break;
+		}
+		cursors[best] = best_pos;
+		count++;
+	}
+	return count;
+}
+
+uint32_t fsm_event_dropped(fsm_t fsm) {
+	ASSERT(fsm);
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	return __atomic_load_n(&fsm->dropped, __ATOMIC_RELAXED);
+}
+
 int fsm_event_clear(fsm_t fsm) {
+	ASSERT(fsm);
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	ASSERT(fsm->lanes[FSM_PRIO_NORMAL].cells);
+	fsm_mailbox_drain(fsm);
+	return 0;
+}
+
+int fsm_transition_add(fsm_t fsm, const struct fsm_transition *rows, uint32_t number) {
+	ASSERT(fsm);
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	ASSERT(fsm->os);
+	ASSERT(fsm->lock);
+	ASSERT(rows || number == 0);
+	int			ret = 0;
+	os_handle_t os	= fsm->os;
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	for(uint32_t i = 0; i < number; i++) {
+		const struct fsm_transition *row = &rows[i];
+		if(row->type == FSM_EVT_ENTER || row->type == FSM_EVT_EXIT) {
+			OS_PRINT_ERR(os, "Transition on event %u is not allowed", row->type);
+			ret = -1;
+		} else if(fsm_map_get(&fsm->id_index, row->source) == NULL
+				  || (row->target != FSM_TARGET_NONE
+					  && fsm_map_get(&fsm->id_index, row->target) == NULL)) {
+			OS_PRINT_ERR(os,
+						 "No state for transition #%u->#%u in \"%s\" fsm",
+						 row->source,
+						 row->target,
+						 fsm->name);
+			ret = -1;
+		}
+		if(ret != 0) {
+			goto EXIT;
+		}
+	}
+	ret = fsm_trans_append(&fsm->trans, rows, number);
+EXIT:
+	os->mutex_unlock(fsm->lock);
+	return ret;
+}
+
+int fsm_transition_clear(fsm_t fsm) {
 	ASSERT(fsm);
 	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
 	ASSERT(fsm->os);
-	ASSERT(fsm->event_queue);
+	ASSERT(fsm->lock);
 	os_handle_t os = fsm->os;
-	os->queue_clear(fsm->event_queue);
+	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
+	fsm_trans_clear(&fsm->trans);
+	os->mutex_unlock(fsm->lock);
 	return 0;
 }
 
@@ -772,16 +2177,32 @@ void fsm_get_current_state(fsm_t fsm, state_info_t info) {
 	ASSERT(fsm->os);
 	ASSERT(fsm->lock);
 	ASSERT(info);
-	os_handle_t os = fsm->os;
-	os->mutex_lock(fsm->lock, BLOCKTIME_MAX);
-	state_t sta_curr = fsm->sta_curr;
-	ASSERT(sta_curr);
-	ASSERT(sta_curr->magic_number == STATE_MAGIC_NUMBER);
-	os->mutex_lock(sta_curr->lock, BLOCKTIME_MAX);
-	info->id   = sta_curr->id;
-	info->name = sta_curr->name;
-	os->mutex_unlock(sta_curr->lock);
-	os->mutex_unlock(fsm->lock);
+	struct fsm_snapshot snap;
+	fsm_snapshot_read(fsm, &snap);
+	*info = snap.curr;
+}
+
+int fsm_get_snapshot(fsm_t fsm, struct fsm_snapshot *snap) {
+	ASSERT(fsm);
+	ASSERT(fsm->magic_number == FSM_MAGIC_NUMBER);
+	ASSERT(snap);
+	fsm_snapshot_read(fsm, snap);
+	return 0;
+}
+
+uint32_t fsm_get_snapshots(const fsm_t *fsms, struct fsm_snapshot *snaps, uint32_t number) {
+	ASSERT(fsms || number == 0);
+	ASSERT(snaps || number == 0);
+	for(uint32_t i = 0; i < number; i++) {
+#if defined(__GNUC__)
+		if(i + 1 < number) {
+			__builtin_prefetch(&fsms[i + 1]->snap_seq);
+		}
+#endif
+		ASSERT(fsms[i]->magic_number == FSM_MAGIC_NUMBER);
+		fsm_snapshot_read(fsms[i], &snaps[i]);
+	}
+	return number;
 }
 
 fsm_t fsm_new(const char *name) {
@@ -790,7 +2211,15 @@ fsm_t fsm_new(const char *name) {
 	}
 	fsm_t		ret = NULL;
 	os_handle_t os	= (os_handle_t)&fsm_port_os_handle;
-	ret				= os->malloc(sizeof(struct fsm));
+	if(__atomic_load_n(&slabs[FSM_SLAB_FSM].lock, __ATOMIC_ACQUIRE)) {
+		struct fsm_static *storage = fsm_slab_alloc(&slabs[FSM_SLAB_FSM]);
+		ret						   = storage ? &storage->fsm : NULL;
+	}
+	if(ret) {
+		ret->in_slab = true;
+	} else {
+		ret = os->malloc(sizeof(struct fsm));
+	}
 	ASSERT(ret);
 	fsm_init(ret, name);
 	return ret;
@@ -804,13 +2233,137 @@ int fsm_del(fsm_t *fsm) {
 	if(*fsm == NULL) {
 		return -2;
 	}
-	os_handle_t os = (os_handle_t)&fsm_port_os_handle;
-	ret			   = fsm_deinit(*fsm);
-	os->free(*fsm);
+	os_handle_t os		  = (os_handle_t)&fsm_port_os_handle;
+	bool		is_static = (*fsm)->is_static;
+	bool		in_slab	  = (*fsm)->in_slab;
+	bool		in_block  = (*fsm)->in_block;
+	ret					  = fsm_deinit(*fsm);
+	if(in_slab) {
+		fsm_slab_free(&slabs[FSM_SLAB_FSM], *fsm);
+	} else if(!is_static || in_block) {
+		os->free(*fsm);
+	}
 	*fsm = NULL;
 	return ret;
 }
 
+// Build a state machine from a table of STATE() definitions in one block laid out like the
+// caller storage of fsm_init_static(). State names are referenced or, with copy_names, interned
+// as copies, so that the table does not need to outlive the FSM. The indexes start in the block
+// and move to the heap when states added later fill them.
+static fsm_t fsm_build_from_table(const char			 *name,
+								  const struct state_def *states,
+								  uint32_t				  state_number,
+								  void					 *storage,
+								  uint32_t				  index_capacity,
+								  bool					  copy_names) {
+	os_handle_t			  os			= (os_handle_t)&fsm_port_os_handle;
+	struct fsm_static	 *fsm_storage	= storage;
+	struct state_static	 *state_storage = (struct state_static *)(fsm_storage + 1);
+	struct fsm_map_entry *index			= (struct fsm_map_entry *)(state_storage + state_number);
+	fsm_t				  fsm			= &fsm_storage->fsm;
+	fsm->is_static						= true;
+	fsm_init(fsm, name);
+	fsm_map_init_static(&fsm->id_index, index, index_capacity, os);
+	fsm_map_init_static(&fsm->name_index, index + index_capacity, index_capacity, os);
+	for(uint32_t i = 0; i < state_number; i++) {
+		const struct state_def *def		   = &states[i];
+		state_t					state	   = &state_storage[i].state;
+		const char			   *state_name = def->name ? def->name : "No name";
+		state->magic_number				   = STATE_MAGIC_NUMBER;
+		state->id						   = def->id;
+		if(copy_names) {
+			state->name = fsm_name_intern(state_name, &state->name_atom);
+		} else {
+			state->name = fsm_name_intern_static(state_name, &state->name_atom);
+		}
+		state->enter	 = def->enter ? def->enter : def->handler;
+		state->handler	 = def->handler;
+		state->exit		 = def->exit ? def->exit : def->handler;
+		state->is_static = true;
+		fsm_map_init(&state->timers, os);
+		if(state->name == NULL || fsm_state_register(fsm, state) != 0) {
+			OS_PRINT_ERR(os, "Failed to add state #%u to FSM %s", def->id, name);
+			fsm_deinit(fsm);
+			return NULL;
+		}
+	}
+	return fsm;
+}
+
+// Size of the block of fsm_build_from_table() for a table and whether the table is valid
+static size_t fsm_table_size(const char				*name,
+							 const struct state_def *states,
+							 uint32_t				 state_number,
+							 uint32_t				*index_capacity) {
+	os_handle_t os = (os_handle_t)&fsm_port_os_handle;
+	if(states == NULL || state_number == 0) {
+		OS_PRINT_ERR(os, "No states for FSM %s", name);
+		return 0;
+	}
+	for(uint32_t i = 0; i < state_number; i++) {
+		if(states[i].magic_number != STATE_MAGIC_NUMBER) {
+			OS_PRINT_ERR(os, "Invalid state definition #%u of FSM %s", i, name);
+			return 0;
+		}
+	}
+	// Index tables at most half full, so each state accounts for no more than four entries each
+	*index_capacity = 2;
+	while(*index_capacity < state_number * 2) {
+		*index_capacity <<= 1;
+	}
+	return sizeof(struct fsm_static) + sizeof(struct state_static) * state_number
+		   + sizeof(struct fsm_map_entry) * *index_capacity * 2;
+}
+
+fsm_t fsm_init_static(const char			 *name,
+					  const struct state_def *states,
+					  uint32_t				  state_number,
+					  void					 *storage,
+					  size_t				  size) {
+	os_handle_t os = (os_handle_t)&fsm_port_os_handle;
+	if(name == NULL) {
+		name = "No name";
+	}
+	uint32_t index_capacity = 0;
+	size_t	 need			= fsm_table_size(name, states, state_number, &index_capacity);
+	if(need == 0) {
+		return NULL;
+	}
+	if(storage == NULL || size < need || ((uintptr_t)storage % sizeof(uint64_t)) != 0) {
+		OS_PRINT_ERR(os, "Bad storage for static FSM %s, %u bytes needed", name, (unsigned)need);
+		return NULL;
+	}
+	memset(storage, 0, need);
+	return fsm_build_from_table(name, states, state_number, storage, index_capacity, false);
+}
+
+fsm_t fsm_new_from_table(const char			  *name,
+						 const struct state_def *states,
+						 uint32_t				 state_number) {
+	os_handle_t os = (os_handle_t)&fsm_port_os_handle;
+	if(name == NULL) {
+		name = "No name";
+	}
+	uint32_t index_capacity = 0;
+	size_t	 need			= fsm_table_size(name, states, state_number, &index_capacity);
+	if(need == 0) {
+		return NULL;
+	}
+	void *block = os->malloc(need);
+	if(block == NULL) {
+		OS_PRINT_ERR(os, "Failed to allocate FSM %s with %u states", name, (unsigned)state_number);
+		return NULL;
+	}
+	memset(block, 0, need);
+	((struct fsm_static *)block)->fsm.in_block = true;
+	fsm_t fsm = fsm_build_from_table(name, states, state_number, block, index_capacity, true);
+	if(fsm == NULL) {
+		os->free(block);
+	}
+	return fsm;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -40,6 +40,28 @@ extern "C" {
 #define STATE_MAGIC_NUMBER (0x1A1EA1CBu)
 #define FSM_MAGIC_NUMBER   (0xF51EE15Fu)
 
+#ifndef FSM_USE_STATS
+#define FSM_USE_STATS 1	 // Runtime counters of fsm_get_stats() and fsm_state_get_stats()
+#endif
+
+#ifndef FSM_USE_TRACE
+#define FSM_USE_TRACE 1	 // Switches and dispatched events are recorded, see fsm_trace_read()
+#endif
+
+#ifndef FSM_TRACE_LENGTH
+#define FSM_TRACE_LENGTH 32	 // Records kept in the trace ring of each FSM, a power of two
+#endif
+
+// Bytes of the trace ring embedded in every FSM
+#if FSM_USE_TRACE
+#define FSM_TRACE_RING_SIZE (8 + FSM_TRACE_LENGTH * 32)
+#else
+#define FSM_TRACE_RING_SIZE (0)
+#endif
+
+#define FSM_TRACE_SWITCH (0)  // Record of a state switch
+#define FSM_TRACE_EVENT	 (1)  // Record of an event dispatched to a state
+
 #ifdef __cplusplus
 #define STATE(_id, _name, _enter, _handler, _exit) \
 	{ (STATE_MAGIC_NUMBER), (_id), (_name), (_enter), (_handler), (_exit) }
@@ -48,8 +70,44 @@ extern "C" {
 	{ (STATE_MAGIC_NUMBER), (_id), (_name), (_enter), (_handler), (_exit) }
 #endif
 
-#define BLOCKTIME_MAX (UINT_MAX)
-#define FSM_NO_POLL	  (UINT_MAX)
+/**
+ * @brief Storage of a static FSM, see fsm_init_static(). The sizes are upper bounds for 32 and
+ *        64-bit targets and are checked at compile time by the library and by the ports.
+ *
+ */
+#define FSM_STATIC_MUTEX_SIZE (96)
+#define FSM_STATIC_FSM_SIZE \
+	(FSM_STATIC_MUTEX_SIZE + 96 * sizeof(void *) + 1792 + FSM_TRACE_RING_SIZE)
+#define FSM_STATIC_STATE_SIZE (FSM_STATIC_MUTEX_SIZE + 36 * sizeof(void *) + 128)
+#define FSM_STATIC_SIZE(_state_number) \
+	(FSM_STATIC_FSM_SIZE + (size_t)(_state_number)*FSM_STATIC_STATE_SIZE)
+#define FSM_STATIC_STORAGE(_var, _state_number) \
+	uint64_t _var[(FSM_STATIC_SIZE(_state_number) + sizeof(uint64_t) - 1) / sizeof(uint64_t)]
+
+#define BLOCKTIME_MAX	  (UINT_MAX)
+#define FSM_NO_POLL		  (UINT_MAX)
+#define FSM_POLL_NO_LIMIT (UINT_MAX)
+#define FSM_NO_DEADLINE	  (UINT_MAX)
+#define FSM_TARGET_NONE	  (UINT_MAX)  // Transition target that runs the action without a switch
+
+#define FSM_PRIO_HIGH	(0)	 // Served before all other events, e.g. faults and emergency stops
+#define FSM_PRIO_NORMAL (1)	 // Events of fsm_event_send() and polling
+#define FSM_PRIO_LOW	(2)	 // Bulk work, served when the other lanes are empty
+#define FSM_PRIO_NUMBER (3)
+
+#define FSM_SLAB_FSM	(0)	 // Slab of fsm_new(), each object holds an FSM, its lock and its lanes
+#define FSM_SLAB_STATE	(1)	 // Slab of fsm_state_add(), each object holds a state and its lock
+#define FSM_SLAB_NUMBER (2)
+
+#ifndef FSM_INST_TIMERS
+#define FSM_INST_TIMERS 1  // Timers of each instance of a shared graph, at most 8
+#endif
+
+#define GRAPH_STATE(_id, _name, _enter, _handler, _exit, _poll_interval) \
+	{ (STATE_MAGIC_NUMBER), (_id), (_name), (_enter), (_handler), (_exit), (_poll_interval) }
+
+#define TRANSITION(_source, _type, _guard, _action, _target) \
+	{ (_source), (_type), (_guard), (_action), (_target) }
 
 #define STATE_ID_ROOT	(UINT_MAX)
 #define STATE_NAME_ROOT ("ROOT")
@@ -58,6 +116,32 @@ extern "C" {
 #define FSM_EVT_ENTER ((FSM_EVT_POLL)-1)
 #define FSM_EVT_EXIT  ((FSM_EVT_ENTER)-1)
 
+/**
+ * @brief Check if an interned state name equals a string. State names are interned, so the check
+ *        is a pointer comparison. With GCC-compatible compilers the canonical pointer of a string
+ *        literal is looked up once per call site and cached.
+ *
+ */
+#if defined(__GNUC__)
+#define FSM_NAME_IS(_canonical, _name)                                           \
+	__extension__({                                                              \
+		static const char *_fsm_name_cache = NULL;                               \
+		const char		  *_fsm_name	   = NULL;                               \
+		if(__builtin_constant_p(_name)) {                                        \
+			_fsm_name = __atomic_load_n(&_fsm_name_cache, __ATOMIC_RELAXED);     \
+			if(_fsm_name == NULL) {                                              \
+				_fsm_name = fsm_name_find((const char *)(_name));                \
+				__atomic_store_n(&_fsm_name_cache, _fsm_name, __ATOMIC_RELAXED); \
+			}                                                                    \
+		} else {                                                                 \
+			_fsm_name = fsm_name_find((const char *)(_name));                    \
+		}                                                                        \
+		(_fsm_name != NULL) && ((const char *)(_canonical) == _fsm_name);        \
+	})
+#else
+#define FSM_NAME_IS(_canonical, _name) ((_canonical) == fsm_name_find((const char *)(_name)))
+#endif
+
 /**
  * @brief
  *
@@ -65,12 +149,12 @@ extern "C" {
 #define IS_ENTER_FROM(_evt, _id) (((state_info_t)((event_t)_evt->data))->id == ((uint32_t)_id))
 
 #define IS_ENTER_FROM_NAME(_evt, _name) \
-	(strcmp(((state_info_t)((event_t)_evt->data))->name, (char *)(_name)) == 0)
+	FSM_NAME_IS(((state_info_t)((event_t)_evt->data))->name, (_name))
 
 #define IS_EXIT_TO(_evt, _id) (((state_info_t)((event_t)_evt->data))->id == ((uint32_t)_id))
 
 #define IS_EXIT_TO_NAME(_evt, _name) \
-	(strcmp(((state_info_t)((event_t)_evt->data))->name, (char *)(_name)) == 0)
+	FSM_NAME_IS(((state_info_t)((event_t)_evt->data))->name, (_name))
 
 /*--- Public type definitions ---------------------------------------------------------*/
 struct event {
@@ -88,13 +172,143 @@ struct state_info {
 typedef struct state_info *state_info_t;
 
 typedef void (*state_handler_t)(event_t event);
+
+/**
+ * @brief Constant definition of a state, initialized with STATE() so that a whole state machine
+ *        can be declared as a table in read-only memory, see fsm_init_static(). FSM_EVT_ENTER and
+ *        FSM_EVT_EXIT are delivered to enter and exit, or to handler where those are NULL.
+ */
+struct state_def {
+	uint32_t		magic_number;
+	uint32_t		id;
+	const char	   *name;
+	state_handler_t enter;
+	state_handler_t handler;
+	state_handler_t exit;
+};
+
+/**
+ * @brief Guard of a transition. Called with the FSM locked, so it must not call FSM functions.
+ */
+typedef bool (*fsm_guard_t)(event_t event);
+typedef void (*fsm_action_t)(event_t event);
+
+/**
+ * @brief Row of a transition table, initialized with TRANSITION(). When the FSM is in state
+ *        source and an event of the given type arrives, the row fires if guard is NULL or returns
+ *        true: action is called instead of the state handler and the FSM switches to target.
+ *        Rows with the same source and type are tried in the order they were added.
+ */
+struct fsm_transition {
+	uint32_t	 source;
+	uint32_t	 type;
+	fsm_guard_t	 guard;
+	fsm_action_t action;
+	uint32_t	 target;
+};
+
+/**
+ * @brief Runtime counters of a state. Dwell times only cover visits that have ended.
+ */
+struct fsm_state_stats {
+	uint32_t enter_count;
+	uint32_t dwell_total_ms;
+	uint32_t dwell_max_ms;
+	uint32_t handler_count;	  // Calls of the state handler for events and timers
+	uint64_t handler_total_us;
+	uint32_t handler_max_us;
+};
+
+/**
+ * @brief Runtime counters of an FSM. Each high-water mark is the most events seen in a lane.
+ */
+struct fsm_stats {
+	uint32_t events_sent;
+	uint32_t events_received;
+	uint32_t events_dropped;	// Lane full and no time to wait
+	uint32_t events_timed_out;	// Lane still full at the end of the timeout
+	uint32_t queue_high_water[FSM_PRIO_NUMBER];
+};
+
+/**
+ * @brief Binary record of the trace ring. Switch records have the IDs of the states left and
+ *        entered in from and to, event records have the ID of the handling state in both.
+ */
+struct fsm_trace_record {
+	uint32_t seq;  // Position in the trace, consecutive unless records were overwritten
+	uint32_t timestamp_us;
+	uint32_t fsm_id;  // See fsm_get_trace_id()
+	uint32_t kind;	  // FSM_TRACE_SWITCH or FSM_TRACE_EVENT
+	uint32_t type;	  // Event type, FSM_EVT_ENTER for switches
+	uint32_t from;
+	uint32_t to;
+};
+
+/**
+ * @brief States of an FSM as seen by lock-free readers, see fsm_get_snapshot(). next is only
+ *        valid while has_next is set.
+ */
+struct fsm_snapshot {
+	struct state_info curr;
+	struct state_info prev;
+	struct state_info next;	 // Pending switch, carried out by the next poll
+	bool			  has_next;
+	uint32_t		  switches;	 // Switches carried out so far, tells a re-entry from no change
+};
+
+/**
+ * @brief Usage counters of a slab, see fsm_slab_reserve().
+ */
+struct fsm_slab_stats {
+	uint32_t object_size;
+	uint32_t capacity;	// Objects in all chunks
+	uint32_t used;
+	uint32_t used_max;
+	uint32_t chunks;
+	uint32_t exhausted;	 // Allocations the slab could not serve, the heap was used instead
+};
+
 typedef struct state *state_t;
 typedef struct fsm	 *fsm_t;
 
+typedef struct fsm_graph *fsm_graph_t;
+typedef struct fsm_inst	 *fsm_inst_t;
+
+/**
+ * @brief Handler of a state of a shared graph, see fsm_graph_new(). context is the pointer the
+ *        instance was created with.
+ */
+typedef void (*fsm_inst_handler_t)(fsm_inst_t inst, void *context, event_t event);
+
+/**
+ * @brief Constant definition of a state of a shared graph, initialized with GRAPH_STATE(). The
+ *        poll interval is part of the definition, FSM_NO_POLL for none.
+ */
+struct fsm_graph_state_def {
+	uint32_t		   magic_number;
+	uint32_t		   id;
+	const char		  *name;
+	fsm_inst_handler_t enter;
+	fsm_inst_handler_t handler;
+	fsm_inst_handler_t exit;
+	uint32_t		   poll_interval;
+};
+
+typedef void (*fsm_wakeup_t)(fsm_t fsm, void *arg);
+
 /*--- Public variable declarations ----------------------------------------------------*/
 
 /*--- Public function declarations ----------------------------------------------------*/
 
+/**
+ * @brief Get the canonical pointer of an interned name. All state names are interned when the
+ *        state is added, so two names are equal exactly when their canonical pointers are.
+ *
+ * @param name The name to look up
+ * @return const char* The canonical pointer, or NULL if no state was ever given this name
+ */
+extern const char *fsm_name_find(const char *name);
+
 /**
  * @brief Create a new instance of a state machine.
  *
@@ -103,6 +317,55 @@ typedef struct fsm	 *fsm_t;
  */
 extern fsm_t fsm_new(const char *name);
 
+/**
+ * @brief Create a state machine from a table of STATE() definitions without using the heap. The
+ *        FSM, its event queue, its locks and its state indexes are placed in storage, state names
+ *        are referenced instead of copied. The first state of the table is entered first. Delete
+ *        it with fsm_del(), which leaves storage to the caller. States of the table cannot be
+ *        deleted. States added later with fsm_state_add() are allocated as usual, and once they
+ *        fill the state indexes in storage the indexes move to the heap too.
+ *
+ *        static const struct state_def table[] = {
+ *            STATE(1, "Idle", NULL, idle_handler, NULL),
+ *            STATE(2, "Busy", busy_enter, busy_handler, NULL),
+ *        };
+ *        static FSM_STATIC_STORAGE(storage, 2);
+ *        fsm_t fsm = fsm_init_static("Worker", table, 2, storage, sizeof(storage));
+ *
+ * @param name The name of the state machine instance, must outlive it
+ * @param states The state table, must outlive the state machine
+ * @param state_number Number of states in the table, at least 1
+ * @param storage Storage declared with FSM_STATIC_STORAGE(), 8-byte aligned
+ * @param size Size of storage in bytes
+ * @return fsm_t The state machine, or NULL if storage is too small, a definition is not made with
+ * STATE() or two states share an ID
+ */
+extern fsm_t fsm_init_static(const char				*name,
+							 const struct state_def *states,
+							 uint32_t				 state_number,
+							 void					*storage,
+							 size_t					 size);
+
+/**
+ * @brief Create a state machine from a table of STATE() definitions. The FSM, its states, its
+ *        event queue, its locks and its state indexes are laid out in one heap block like with
+ *        fsm_init_static(), the IDs are checked for collisions while the indexes are built. Names
+ *        are copied into the shared name table rather than the block, so the table does not need
+ *        to outlive the FSM. The first state of the table is entered first. States of the table
+ *        cannot be deleted, fsm_del() frees the whole block. States added later with
+ *        fsm_state_add() are allocated as usual, and once they fill the state indexes of the
+ *        block the indexes move to a separate allocation.
+ *
+ * @param name The name of the state machine instance
+ * @param states The state table
+ * @param state_number Number of states in the table, at least 1
+ * @return fsm_t The state machine, or NULL if out of memory, a definition is not made with STATE()
+ * or two states share an ID
+ */
+extern fsm_t fsm_new_from_table(const char			   *name,
+								const struct state_def *states,
+								uint32_t				state_number);
+
 /**
  * @brief Delete an instance of a state machine.
  *
@@ -186,6 +449,51 @@ extern int fsm_state_child_fsm_del(state_t state, fsm_t fsm);
  */
 extern int fsm_poll(fsm_t fsm);
 
+/**
+ * @brief Run the state machine like fsm_poll, but keep dispatching queued events until the queue
+ *        is empty or a budget is used up, so throughput follows the load instead of the polling
+ *        rate. Child FSMs are polled after every event dispatched to their parent, each with the
+ *        full event budget and the remaining time budget. The event budget therefore bounds each
+ *        FSM per poll of its parent rather than the whole call, a child may dispatch up to
+ *        max_events events for every event of its parent. Use max_time_us to bound the call.
+ *
+ * @param fsm The state machine object
+ * @param max_events Maximum number of events to dispatch to fsm, and to each child FSM per poll of
+ * its parent, at least 1. FSM_POLL_NO_LIMIT for no limit
+ * @param max_time_us Time budget in microseconds, FSM_POLL_NO_LIMIT for no limit
+ * @param pending Set to true if events or a transition are still pending in the FSM or its
+ * children when the call returns. May be NULL.
+ * @return int The number of events dispatched in the FSM and its children
+ */
+extern int fsm_poll_ex(fsm_t fsm, uint32_t max_events, uint32_t max_time_us, bool *pending);
+
+/**
+ * @brief Get the time until the state machine needs polling again, so that a runner can sleep
+ *        instead of polling at the smallest interval. Covers the polling interval of the current
+ *        state, pending transitions and queued events, recursively over the active child FSMs.
+ *
+ * @param fsm The state machine object
+ * @return uint32_t Milliseconds until fsm_poll should be called, 0 if it should be called now,
+ * FSM_NO_DEADLINE if only a new event or switch request can make the FSM runnable
+ */
+extern uint32_t fsm_next_deadline(fsm_t fsm);
+
+/**
+ * @brief Install a hook that is called whenever an event is sent to the state machine or to one
+ *        of its descendants, a switch is requested or a polling interval changes, so that a runner
+ *        sleeping on fsm_next_deadline() can wake up early. The hook of the nearest ancestor that
+ *        has one is called, from the context of the sender. It must be async-signal-safe if
+ *        fsm_event_try_send() is used from signal handlers. Hook and argument are replaced
+ *        together, and the call returns once no sender is still calling the old hook, so the old
+ *        argument may be released afterwards. Must not be called from the hook of the same FSM.
+ *
+ * @param fsm The state machine object
+ * @param hook The hook to call, NULL to remove
+ * @param arg Argument passed to the hook
+ * @return int Always 0
+ */
+extern int fsm_set_wakeup(fsm_t fsm, fsm_wakeup_t hook, void *arg);
+
 /**
  * @brief Switch the state machine to a state specified by ID.
  *
@@ -217,13 +525,73 @@ extern int fsm_switch_by_state_handle(fsm_t fsm, state_t state);
 extern int fsm_switch_by_name(fsm_t fsm, const char *name);
 
 /**
- * @brief Get information about the current running state from a state machine.
+ * @brief Add rows to the transition table of a state machine. Events that match a row are
+ *        resolved by a constant-time lookup in a table compiled from the rows, instead of a
+ *        switch in the state handler. Events without a firing row go to the state handler as
+ *        usual. The action runs before the switch, which takes effect like fsm_switch(). The table
+ *        is recompiled on the next poll after rows or states change.
+ *
+ * @param fsm The state machine
+ * @param rows The rows to copy into the table
+ * @param number Number of rows
+ * @return int 0 on success, -1 if a row names a state that is not in the state machine or an
+ * FSM_EVT_ENTER/FSM_EVT_EXIT type, -2 if out of memory
+ */
+extern int fsm_transition_add(fsm_t fsm, const struct fsm_transition *rows, uint32_t number);
+
+/**
+ * @brief Remove all rows from the transition table of a state machine.
+ *
+ * @param fsm The state machine
+ * @return int Always 0
+ */
+extern int fsm_transition_clear(fsm_t fsm);
+
+/**
+ * @brief Switch to run-to-completion mode. A switch requested while an event is handled, also by
+ *        an enter handler of the new state, is carried out before fsm_poll() returns, up to
+ *        max_microsteps chained transitions per event. Switch requests that arrive while another
+ *        one is pending are queued, up to 4, instead of being ignored. Off by default, where a
+ *        switch takes effect on the next poll.
+ *
+ * @param fsm Pointer to the state machine
+ * @param max_microsteps Maximum number of chained transitions per event, 0 turns the mode off
+ * @return int Always 0
+ */
+extern int fsm_set_run_to_completion(fsm_t fsm, uint32_t max_microsteps);
+
+/**
+ * @brief Get information about the current running state from a state machine. Lock-free, see
+ *        fsm_get_snapshot().
  *
  * @param fsm The state machine to retrieve the information from
  * @param info The structure to store the information about the current state
  */
 extern void fsm_get_current_state(fsm_t fsm, state_info_t info);
 
+/**
+ * @brief Read the current, previous and pending state of a state machine without taking a lock.
+ *        The poller publishes every change through a sequence counter, readers copy the states
+ *        and retry if the counter moved meanwhile, so readers never block fsm_poll() and the
+ *        copy is always consistent. Names are interned and stay valid after the read.
+ *
+ * @param fsm The state machine
+ * @param snap Where to store the states
+ * @return int Always 0
+ */
+extern int fsm_get_snapshot(fsm_t fsm, struct fsm_snapshot *snap);
+
+/**
+ * @brief Read the snapshots of many state machines in one call, e.g. for a monitor refreshing
+ *        hundreds of FSMs. Each snapshot is consistent on its own, see fsm_get_snapshot().
+ *
+ * @param fsms The state machines
+ * @param snaps Where to store one snapshot per state machine
+ * @param number Number of state machines
+ * @return uint32_t Number of snapshots stored, always number
+ */
+extern uint32_t fsm_get_snapshots(const fsm_t *fsms, struct fsm_snapshot *snaps, uint32_t number);
+
 /**
  * @brief Change the default polling interval of a state machine, which affects newly added states.
  *
@@ -243,7 +611,31 @@ extern int fsm_change_default_poll_interval(fsm_t fsm, uint32_t interval_ms);
 extern int fsm_change_state_poll_interval(state_t state, uint32_t interval_ms);
 
 /**
- * @brief Send an event to a state machine.
+ * @brief Start a timer on a state. When the timer expires while the state is active, an event of
+ *        the given type is dispatched to the state handler. Each event type names one timer per
+ *        state, starting it again re-arms it. All timers of a state are cancelled when its FSM
+ *        exits the state, so timeouts can be started on entry without cleaning up on exit.
+ *
+ * @param state The state the timer belongs to, must be added to an FSM
+ * @param type The event type delivered on expiry, must not collide with FSM_EVT_*
+ * @param delay_ms Time until the first expiry
+ * @param period_ms Time between further expiries, 0 for a one-shot timer
+ * @return int 0 on success, -1 if the state is not added to an FSM, -2 if out of memory
+ */
+extern int fsm_timer_start(state_t state, uint32_t type, uint32_t delay_ms, uint32_t period_ms);
+
+/**
+ * @brief Stop a timer of a state.
+ *
+ * @param state The state the timer belongs to
+ * @param type The event type the timer was started with
+ * @return int 0 if the timer was stopped, -1 if it was not running
+ */
+extern int fsm_timer_stop(state_t state, uint32_t type);
+
+/**
+ * @brief Send an event to a state machine. Blocks for up to 200ms while the event queue is full.
+ *        The FSM mutex is not taken, so senders never wait for each other or for the poller.
  *
  * @param fsm Pointer to the state machine
  * @param type The event type
@@ -253,6 +645,364 @@ extern int fsm_change_state_poll_interval(state_t state, uint32_t interval_ms);
  */
 extern int fsm_event_send(fsm_t fsm, uint32_t type, void *data, uint32_t datalen);
 
+/**
+ * @brief Send an event to a state machine without blocking. Lock-free and async-signal-safe, so
+ *        it can be called from signal handlers and interrupt-like contexts.
+ *
+ * @param fsm Pointer to the state machine
+ * @param type The event type
+ * @param data Pointer to the event data
+ * @param datalen The length of the event data
+ * @return int 0 if the event was queued, -1 if the event queue is full
+ */
+extern int fsm_event_try_send(fsm_t fsm, uint32_t type, void *data, uint32_t datalen);
+
+/**
+ * @brief Send an event to a state machine, waiting while the event queue is full.
+ *
+ * @param fsm Pointer to the state machine
+ * @param type The event type
+ * @param data Pointer to the event data
+ * @param datalen The length of the event data
+ * @param timeout_ms Maximum time to wait for a free slot, 0 behaves like fsm_event_try_send()
+ * @return int 0 if the event was queued, -1 on timeout
+ */
+extern int fsm_event_send_timeout(fsm_t	   fsm,
+								  uint32_t type,
+								  void	  *data,
+								  uint32_t datalen,
+								  uint32_t timeout_ms);
+
+/**
+ * @brief Send an event to one of the priority lanes of a state machine. Polling always serves the
+ *        highest non-empty lane first, and a lower lane that was passed over for 8 events gets
+ *        one event through, so urgent events wait for at most a few queued events. Events are
+ *        passed to child FSMs in the same lane.
+ *
+ * @param fsm Pointer to the state machine
+ * @param prio FSM_PRIO_HIGH, FSM_PRIO_NORMAL or FSM_PRIO_LOW
+ * @param type The event type
+ * @param data Pointer to the event data
+ * @param datalen The length of the event data
+ * @param timeout_ms Maximum time to wait while the lane is full, 0 does not block
+ * @return int 0 if the event was queued, -1 on timeout
+ */
+extern int fsm_event_send_prio(fsm_t	fsm,
+							   uint32_t prio,
+							   uint32_t type,
+							   void	   *data,
+							   uint32_t datalen,
+							   uint32_t timeout_ms);
+
+/**
+ * @brief Send an event with a copy of its payload, so the caller does not need to keep the data
+ *        alive. Payloads of up to 32 bytes are copied into the event queue, larger ones into a
+ *        block of a small per-FSM payload pool. Handlers see event->data pointing to the copy,
+ *        which is released when the handler returns, so it must not be kept. Child FSMs share
+ *        the copy by reference. Blocks for up to 200ms while the event queue is full.
+ *
+ * @param fsm Pointer to the state machine
+ * @param type The event type
+ * @param data Pointer to the payload
+ * @param datalen The length of the payload, at most 256 bytes
+ * @return int 0 if the event was queued, -1 on timeout, -2 if the payload is too large or all
+ * payload blocks are in use
+ */
+extern int fsm_event_send_copy(fsm_t fsm, uint32_t type, const void *data, uint32_t datalen);
+
+/**
+ * @brief Accept an event type from the parent FSM. The parent only passes events to child FSMs
+ *        that subscribed to their type, or that have no subscriptions at all, which is the
+ *        default. Events sent to the FSM directly are not filtered. Types below 256 are checked
+ *        with a bitset, others with a hash set.
+ *
+ * @param fsm Pointer to the child state machine
+ * @param type The event type
+ * @return int 0 on success, -1 if out of memory
+ */
+extern int fsm_event_subscribe(fsm_t fsm, uint32_t type);
+
+/**
+ * @brief Stop accepting an event type from the parent FSM. Removing the last subscription makes
+ *        the FSM accept all events again.
+ *
+ * @param fsm Pointer to the child state machine
+ * @param type The event type
+ * @return int 0 on success, -1 if the FSM did not subscribe to the type
+ */
+extern int fsm_event_unsubscribe(fsm_t fsm, uint32_t type);
+
+/**
+ * @brief Number of events the parent FSM could not pass to this child FSM. Events are passed on
+ *        without blocking, so they are dropped while the queue of the child is full.
+ *
+ * @param fsm Pointer to the child state machine
+ * @return uint32_t Number of dropped events since the FSM was created
+ */
+extern uint32_t fsm_event_dropped(fsm_t fsm);
+
+/**
+ * @brief Copy the runtime counters of a state machine. The counters are read one by one while
+ *        the FSM keeps running, so they are not a consistent snapshot of a single instant.
+ *
+ * @param fsm Pointer to the state machine
+ * @param stats Where to copy the counters, zeroed if FSM_USE_STATS is 0
+ * @return int 0 on success, -1 if the library was built without FSM_USE_STATS
+ */
+extern int fsm_get_stats(fsm_t fsm, struct fsm_stats *stats);
+
+/**
+ * @brief Copy the runtime counters of a state, with the same caveats as fsm_get_stats().
+ *
+ * @param state Pointer to the state
+ * @param stats Where to copy the counters, zeroed if FSM_USE_STATS is 0
+ * @return int 0 on success, -1 if the library was built without FSM_USE_STATS
+ */
+extern int fsm_state_get_stats(state_t state, struct fsm_state_stats *stats);
+
+/**
+ * @brief Serve fsm_new() or fsm_state_add() from a slab of fixed-size objects instead of the
+ *        heap. An object holds everything that was allocated separately before, e.g. an FSM with
+ *        its lock and its event lanes, so creating and deleting many short-lived FSMs takes O(1)
+ *        and does not fragment the heap. Each call adds one chunk of objects. When the slab
+ *        runs out it grows by further chunks, or the heap is used if it may not grow. Chunks are
+ *        kept for the lifetime of the program. Call it before FSMs are created by several threads.
+ *
+ * @param kind FSM_SLAB_FSM or FSM_SLAB_STATE
+ * @param number Number of objects to add now, 0 to only change grow
+ * @param grow Objects per chunk added when the slab runs out, 0 to never grow
+ * @return int 0 on success, -1 if out of memory
+ */
+extern int fsm_slab_reserve(uint32_t kind, uint32_t number, uint32_t grow);
+
+/**
+ * @brief Copy the usage counters of a slab.
+ *
+ * @param kind FSM_SLAB_FSM or FSM_SLAB_STATE
+ * @param stats Where to copy the counters, zeroed if the slab was never reserved
+ * @return int Always 0
+ */
+extern int fsm_slab_get_stats(uint32_t kind, struct fsm_slab_stats *stats);
+
+/**
+ * @brief Get the ID that identifies a state machine in trace records.
+ *
+ * @param fsm Pointer to the state machine
+ * @return uint32_t The ID, unique for the lifetime of the program
+ */
+extern uint32_t fsm_get_trace_id(fsm_t fsm);
+
+/**
+ * @brief Copy records out of the trace ring of an FSM. Every FSM records its switches and
+ *        dispatched events into its own ring of FSM_TRACE_LENGTH binary records. That costs a
+ *        timestamp and a few stores on memory the polling core already owns, so tracing can stay
+ *        on in production. When the ring wraps the oldest records are overwritten, which shows
+ *        as a gap in seq. Records are formatted by the reader, with fsm_trace_format() or by a
+ *        host tool.
+ *
+ * @param fsm Pointer to the state machine
+ * @param cursor Sequence number of the first record to read, 0 for the oldest one still kept.
+ * Advanced past the records read.
+ * @param records Where to copy the records
+ * @param max Maximum number of records to copy
+ * @return uint32_t Number of records copied, always 0 without FSM_USE_TRACE
+ */
+extern uint32_t fsm_trace_read(fsm_t					fsm,
+							   uint32_t				   *cursor,
+							   struct fsm_trace_record *records,
+							   uint32_t					max);
+
+/**
+ * @brief Read the trace rings of several FSMs as one trace ordered by timestamp_us. Records of
+ *        different FSMs with equal timestamps come in the order of fsms.
+ *
+ * @param fsms The state machines
+ * @param number Number of state machines
+ * @param cursors One cursor per state machine, see fsm_trace_read()
+ * @param records Where to copy the records
+ * @param max Maximum number of records to copy
+ * @return uint32_t Number of records copied
+ */
+extern uint32_t fsm_trace_merge(fsm_t					*fsms,
+								uint32_t				 number,
+								uint32_t				*cursors,
+								struct fsm_trace_record	*records,
+								uint32_t				 max);
+
+/**
+ * @brief Format a trace record as a line of text, without a line break.
+ *
+ * @param record The record
+ * @param buf Where to write the text
+ * @param size Size of buf in bytes
+ * @return int The length of the whole text, like snprintf()
+ */
+extern int fsm_trace_format(const struct fsm_trace_record *record, char *buf, size_t size);
+
+/**
+ * @brief Create an immutable state graph that any number of compact instances share. States,
+ *        names, handlers and poll intervals live once in the graph, while an instance only holds
+ *        its current, previous and next state, its timers, its mailbox and a context pointer that
+ *        is passed to the handlers. The graph and its ID index are one heap block, names are
+ *        copied. The first state of the table is entered first.
+ *
+ *        static const struct fsm_graph_state_def table[] = {
+ *            GRAPH_STATE(1, "Idle", NULL, idle_handler, NULL, FSM_NO_POLL),
+ *            GRAPH_STATE(2, "Busy", busy_enter, busy_handler, NULL, 100),
+ *        };
+ *        fsm_graph_t graph = fsm_graph_new("Device", table, 2, 4);
+ *        fsm_inst_t  inst  = fsm_inst_new(graph, &devices[i]);
+ *
+ * @param name The name of the graph
+ * @param states The state table
+ * @param state_number Number of states in the table, at least 1 and below 65535
+ * @param mailbox_length Events each instance can queue, rounded up to a power of two. With 0 the
+ * instances have no mailbox and only react to switches, timers and polling.
+ * @return fsm_graph_t The graph, or NULL if out of memory, a definition is not made with
+ * GRAPH_STATE() or two states share an ID
+ */
+extern fsm_graph_t fsm_graph_new(const char						  *name,
+								 const struct fsm_graph_state_def *states,
+								 uint32_t						   state_number,
+								 uint32_t						   mailbox_length);
+
+/**
+ * @brief Delete a graph. All of its instances must have been deleted before.
+ *
+ * @param graph Pointer to the graph
+ * @return int 0 on success, -1 or -2 if graph or *graph is NULL, -3 if instances are left
+ */
+extern int fsm_graph_del(fsm_graph_t *graph);
+
+/**
+ * @brief Bytes of storage an instance of a graph needs, see fsm_inst_init().
+ *
+ * @param graph The graph
+ * @return size_t Size of an instance including its mailbox, a multiple of 8
+ */
+extern size_t fsm_graph_inst_size(fsm_graph_t graph);
+
+/**
+ * @brief Create an instance of a graph in caller storage, for example in an array of many
+ *        instances. Nothing is allocated.
+ *
+ * @param graph The graph, must outlive the instance
+ * @param context Passed to the handlers, may be NULL
+ * @param storage Storage of fsm_graph_inst_size() bytes, 8-byte aligned
+ * @param size Size of storage in bytes
+ * @return fsm_inst_t The instance, or NULL if storage is too small
+ */
+extern fsm_inst_t fsm_inst_init(fsm_graph_t graph, void *context, void *storage, size_t size);
+
+/**
+ * @brief Release an instance of fsm_inst_init(), leaving its storage to the caller. Queued
+ *        events are discarded and no exit handler is called.
+ *
+ * @param inst The instance
+ * @return int Always 0
+ */
+extern int fsm_inst_deinit(fsm_inst_t inst);
+
+/**
+ * @brief Create an instance of a graph on the heap.
+ *
+ * @param graph The graph, must outlive the instance
+ * @param context Passed to the handlers, may be NULL
+ * @return fsm_inst_t The instance, or NULL if out of memory
+ */
+extern fsm_inst_t fsm_inst_new(fsm_graph_t graph, void *context);
+
+/**
+ * @brief Delete an instance of fsm_inst_new().
+ *
+ * @param inst Pointer to the instance
+ * @return int 0 on success, -1 or -2 if inst or *inst is NULL
+ */
+extern int fsm_inst_del(fsm_inst_t *inst);
+
+/**
+ * @brief Get the context pointer of an instance.
+ *
+ * @param inst The instance
+ * @return void* The context given to fsm_inst_new() or fsm_inst_init()
+ */
+extern void *fsm_inst_get_context(fsm_inst_t inst);
+
+/**
+ * @brief Request a switch of an instance, carried out by its next poll. Lock-free, so it may be
+ *        called from any thread. A request arriving while another one is pending is ignored.
+ *
+ * @param inst The instance
+ * @param id ID of the target state
+ * @return int 0 on success, -1 if the graph has no state with this ID
+ */
+extern int fsm_inst_switch(fsm_inst_t inst, uint32_t id);
+
+/**
+ * @brief Queue an event for an instance without blocking. Lock-free, so it may be called from any
+ *        thread. The payload is not copied and must stay valid until the handler has run.
+ *
+ * @param inst The instance
+ * @param type Event type
+ * @param data Payload, may be NULL
+ * @param datalen Length of the payload
+ * @return int 0 on success, -1 if the mailbox is full or the graph has no mailbox
+ */
+extern int fsm_inst_event_send(fsm_inst_t inst, uint32_t type, void *data, uint32_t datalen);
+
+/**
+ * @brief Run an instance: carry out a pending switch, then dispatch expired timers, the events
+ *        queued so far and FSM_EVT_POLL when the poll interval of the state has passed. Switches
+ *        requested by handlers are carried out before the next event. Only one thread may poll
+ *        an instance at a time.
+ *
+ * @param inst The instance
+ * @return int Number of events and timers dispatched
+ */
+extern int fsm_inst_poll(fsm_inst_t inst);
+
+/**
+ * @brief Milliseconds until an instance needs polling.
+ *
+ * @param inst The instance
+ * @return uint32_t 0 if it is due now, FSM_NO_DEADLINE if it waits for events only
+ */
+extern uint32_t fsm_inst_next_deadline(fsm_inst_t inst);
+
+/**
+ * @brief Start or re-arm a timer of an instance. The timer delivers an event of the given type to
+ *        the current state and is cancelled when the state is left. Each instance has
+ *        FSM_INST_TIMERS timers. Must be called by the thread polling the instance, usually from
+ *        a handler.
+ *
+ * @param inst The instance
+ * @param type Event type delivered on expiry
+ * @param delay_ms Delay of the first expiry
+ * @param period_ms Period of the following expiries, 0 for a one-shot timer
+ * @return int 0 on success, -2 if all timers of the instance are running
+ */
+extern int fsm_inst_timer_start(fsm_inst_t inst,
+								uint32_t   type,
+								uint32_t   delay_ms,
+								uint32_t   period_ms);
+
+/**
+ * @brief Stop a timer of an instance. Must be called by the thread polling the instance.
+ *
+ * @param inst The instance
+ * @param type Event type of the timer
+ * @return int 0 if the timer was running, -1 otherwise
+ */
+extern int fsm_inst_timer_stop(fsm_inst_t inst, uint32_t type);
+
+/**
+ * @brief Get the current state of an instance. Before the first poll this is the root state.
+ *
+ * @param inst The instance
+ * @param info Where to store ID and interned name of the state
+ */
+extern void fsm_inst_get_current_state(fsm_inst_t inst, state_info_t info);
+
 /**
  * @brief Clear all event queueing in a state machine.
  *
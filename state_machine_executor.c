@@ -0,0 +1,684 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+/*--- Private dependencies ------------------------------------------------------------*/
+#include "state_machine_executor.h"
+#include "state_machine_port.h"
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <assert.h>
+#define USE_ASSERT 1
+#if USE_ASSERT
+#define ASSERT(e) assert(e)
+#else
+#define ASSERT(e)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public variable definitions -----------------------------------------------------*/
+
+/*--- Private macros ------------------------------------------------------------------*/
+#define EXECUTOR_MAGIC_NUMBER 0xE5EC7A5Bu
+#define EXEC_BATCH_EVENTS	  32	  // Events per run before the FSM goes back to the deque
+#define EXEC_BATCH_US		  2000	  // Time per run before the FSM goes back to the deque
+#define EXEC_IDLE_WAIT_MS	  1000	  // Longest sleep of an idle worker without deadlines
+#define EXEC_DEQUE_MIN		  8
+
+/*--- Private type definitions --------------------------------------------------------*/
+
+// Scheduling state of an FSM. Only the worker that moves an entry from QUEUED to RUNNING may
+// run it, which is what keeps an FSM on one worker at a time.
+enum exec_sched {
+	SCHED_IDLE,		// Waiting for a wakeup or its deadline
+	SCHED_QUEUED,	// In exactly one deque
+	SCHED_RUNNING,	// Being polled by a worker
+	SCHED_DIRTY,	// Woken while running, the worker queues it again
+	SCHED_DEAD,		// Removed from the executor
+};
+
+struct exec_entry {
+	fsm_t				 fsm;
+	struct fsm_executor *executor;
+	uint32_t			 sched;		  // enum exec_sched, accessed atomically
+	uint32_t			 removing;	  // Set by fsm_executor_remove, accessed atomically
+	uint32_t			 due;		  // Deadline in the heap, uptime in ms
+	int32_t				 heap_index;  // -1 if not in the heap
+	struct exec_entry	*next;		  // Owned entries or free list
+	struct exec_entry	*inbox_next;  // Next entry in the inbox while queued by a sender
+};
+
+struct exec_deque {
+	void			   *lock;
+	struct exec_entry **ring;
+	uint32_t			capacity;
+	uint32_t			head;
+	uint32_t			count;
+};
+
+struct exec_worker {
+	struct fsm_executor *executor;
+	uint32_t			 index;
+	void				*thread;
+	struct exec_deque	 deque;
+	uint32_t			 runs;
+	uint32_t			 events;
+	uint32_t			 steals;
+	uint32_t			 sleeps;
+};
+
+struct fsm_executor {
+	uint32_t			magic_number;
+	os_handle_t			os;
+	void			   *lock;  // Protects entries, free list and the deadline heap
+	uint32_t			worker_number;
+	struct exec_worker *workers;
+	void			   *doorbell;  // Semaphore waking up sleeping workers
+	struct exec_entry  *inbox;	   // Entries queued by senders, a lock-free stack
+	uint32_t			sleepers;
+	uint32_t			stop;
+	uint32_t			queued;
+	uint32_t			queued_max;
+	struct exec_entry  *entries;
+	struct exec_entry  *free_entries;
+	uint32_t			entry_number;
+	uint32_t			entry_allocated;  // Entries in use or spare, every deque has room for all
+	// Min-heap of entries by due time. heap_due mirrors the top for lock-free checks.
+	struct exec_entry **heap;
+	uint32_t			heap_number;
+	uint32_t			heap_capacity;
+	uint32_t			heap_armed;	 // Mirror of heap_number
+	uint32_t			heap_due;
+};
+
+/*--- Private function declarations ---------------------------------------------------*/
+
+/*--- Private variable definitions ----------------------------------------------------*/
+
+/*--- Private function definitions ----------------------------------------------------*/
+
+static inline bool due_before(uint32_t a, uint32_t b) {
+	return (int32_t)(a - b) < 0;
+}
+
+// Append to the back of a deque. The ring never fills up, see exec_deques_reserve().
+static void deque_push(os_handle_t os, struct exec_deque *dq, struct exec_entry *entry) {
+	os->mutex_lock(dq->lock, BLOCKTIME_MAX);
+	ASSERT(dq->count < dq->capacity);
+	dq->ring[(dq->head + dq->count) % dq->capacity] = entry;
+	__atomic_store_n(&dq->count, dq->count + 1, __ATOMIC_RELAXED);
+	os->mutex_unlock(dq->lock);
+}
+
+// The owner takes the most recently queued FSM, its data is most likely still in cache
+static struct exec_entry *deque_pop_back(os_handle_t os, struct exec_deque *dq) {
+	struct exec_entry *ret = NULL;
+	os->mutex_lock(dq->lock, BLOCKTIME_MAX);
+	if(dq->count) {
+		__atomic_store_n(&dq->count, dq->count - 1, __ATOMIC_RELAXED);
+		ret = dq->ring[(dq->head + dq->count) % dq->capacity];
+	}
+	os->mutex_unlock(dq->lock);
+	return ret;
+}
+
+// Thieves take the oldest FSM
+static struct exec_entry *deque_pop_front(os_handle_t os, struct exec_deque *dq) {
+	struct exec_entry *ret = NULL;
+	if(__atomic_load_n(&dq->count, __ATOMIC_RELAXED) == 0) {
+		return NULL;  // Cheap check before taking the lock of another worker
+	}
+	os->mutex_lock(dq->lock, BLOCKTIME_MAX);
+	if(dq->count) {
+		ret		 = dq->ring[dq->head];
+		dq->head = (dq->head + 1) % dq->capacity;
+		__atomic_store_n(&dq->count, dq->count - 1, __ATOMIC_RELAXED);
+	}
+	os->mutex_unlock(dq->lock);
+	return ret;
+}
+
+// Grow the ring of every deque to hold number entries. An entry sits in at most one deque, so
+// with room for every allocated entry pushing never fails and never allocates. Called with the
+// executor lock held, which serializes the growth, the rings are swapped under the deque locks.
+static int exec_deques_reserve(struct fsm_executor *ex, uint32_t number) {
+	os_handle_t os = ex->os;
+	for(uint32_t i = 0; i < ex->worker_number; i++) {
+		struct exec_deque *dq = &ex->workers[i].deque;
+		if(dq->capacity >= number) {
+			continue;
+		}
+		uint32_t capacity = dq->capacity ? dq->capacity : EXEC_DEQUE_MIN;
+		while(capacity < number) {
+			capacity *= 2;
+		}
+		struct exec_entry **ring = os->malloc(sizeof(struct exec_entry *) * capacity);
+		if(ring == NULL) {
+			return -1;
+		}
+		os->mutex_lock(dq->lock, BLOCKTIME_MAX);
+		struct exec_entry **old = dq->ring;
+		for(uint32_t j = 0; j < dq->count; j++) {
+			ring[j] = dq->ring[(dq->head + j) % dq->capacity];
+		}
+		dq->ring	 = ring;
+		dq->capacity = capacity;
+		dq->head	 = 0;
+		os->mutex_unlock(dq->lock);
+		os->free(old);
+	}
+	return 0;
+}
+
+// Queue an entry that was moved to SCHED_QUEUED. Workers use their own deque, senders (worker < 0)
+// push to the inbox and ring the doorbell, which takes no lock and never allocates, so that
+// waking up an FSM stays lock-free and async-signal-safe.
+static void exec_enqueue(struct fsm_executor *ex, struct exec_entry *entry, int32_t worker) {
+	os_handle_t os = ex->os;
+	if(worker < 0) {
+		struct exec_entry *head = __atomic_load_n(&ex->inbox, __ATOMIC_RELAXED);
+		do {
+			entry->inbox_next = head;
+		} while(!__atomic_compare_exchange_n(
+			&ex->inbox, &head, entry, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	} else {
+		deque_push(os, &ex->workers[worker].deque, entry);
+	}
+	uint32_t queued = __atomic_add_fetch(&ex->queued, 1, __ATOMIC_SEQ_CST);
+	uint32_t max	= __atomic_load_n(&ex->queued_max, __ATOMIC_RELAXED);
+	while(queued > max
+		  && !__atomic_compare_exchange_n(
+			  &ex->queued_max, &max, queued, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+	// Pairs with the announcement in exec_idle, either the sleeper sees the entry or we see it
+	if(__atomic_load_n(&ex->sleepers, __ATOMIC_SEQ_CST) > 0) {
+		os->sem_post(ex->doorbell);
+	}
+}
+
+// Move the entries queued by senders to the deque of a worker, oldest first. The whole inbox is
+// taken with one exchange, so entries are never popped one by one and ABA cannot happen.
+static void exec_take_inbox(struct fsm_executor *ex, struct exec_worker *worker) {
+	if(__atomic_load_n(&ex->inbox, __ATOMIC_RELAXED) == NULL) {
+		return;
+	}
+	struct exec_entry *entry = __atomic_exchange_n(&ex->inbox, NULL, __ATOMIC_ACQUIRE);
+	struct exec_entry *list	 = NULL;
+	while(entry) {
+		struct exec_entry *next = entry->inbox_next;
+		entry->inbox_next		= list;
+		list					= entry;
+		entry					= next;
+	}
+	while(list) {
+		struct exec_entry *next = list->inbox_next;
+		deque_push(ex->os, &worker->deque, list);
+		list = next;
+	}
+}
+
+// Make an entry runnable, or flag it to run again if a worker is running it
+static void exec_schedule(struct fsm_executor *ex, struct exec_entry *entry, int32_t worker) {
+	uint32_t sched = __atomic_load_n(&entry->sched, __ATOMIC_ACQUIRE);
+	for(;;) {
+		if(sched == SCHED_IDLE) {
+			if(__atomic_compare_exchange_n(&entry->sched,
+										   &sched,
+										   SCHED_QUEUED,
+										   false,
+										   __ATOMIC_ACQ_REL,
+										   __ATOMIC_ACQUIRE)) {
+				exec_enqueue(ex, entry, worker);
+				return;
+			}
+		} else if(sched == SCHED_RUNNING) {
+			if(__atomic_compare_exchange_n(&entry->sched,
+										   &sched,
+										   SCHED_DIRTY,
+										   false,
+										   __ATOMIC_ACQ_REL,
+										   __ATOMIC_ACQUIRE)) {
+				return;
+			}
+		} else {
+			return;	 // Already queued, flagged or dead
+		}
+	}
+}
+
+// Called by senders. fsm_set_wakeup() waits for running calls, a call for a removed FSM is ignored.
+static void exec_wakeup(fsm_t fsm, void *arg) {
+	(void)fsm;
+	struct exec_entry *entry = arg;
+	if(entry == NULL || __atomic_load_n(&entry->removing, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	exec_schedule(entry->executor, entry, -1);
+}
+
+static void heap_swap(struct fsm_executor *ex, uint32_t a, uint32_t b) {
+	struct exec_entry *tmp = ex->heap[a];
+	ex->heap[a]			   = ex->heap[b];
+	ex->heap[b]			   = tmp;
+	ex->heap[a]->heap_index = (int32_t)a;
+	ex->heap[b]->heap_index = (int32_t)b;
+}
+
+static void heap_sift(struct fsm_executor *ex, uint32_t idx) {
+	while(idx > 0 && due_before(ex->heap[idx]->due, ex->heap[(idx - 1) / 2]->due)) {
+		heap_swap(ex, idx, (idx - 1) / 2);
+		idx = (idx - 1) / 2;
+	}
+	for(;;) {
+		uint32_t min   = idx;
+		uint32_t left  = idx * 2 + 1;
+		uint32_t right = idx * 2 + 2;
+		if(left < ex->heap_number && due_before(ex->heap[left]->due, ex->heap[min]->due)) {
+			min = left;
+		}
+		if(right < ex->heap_number && due_before(ex->heap[right]->due, ex->heap[min]->due)) {
+			min = right;
+		}
+		if(min == idx) {
+			break;
+		}
+		heap_swap(ex, idx, min);
+		idx = min;
+	}
+}
+
+// Heap helpers below must be called with ex->lock held
+static void heap_publish(struct fsm_executor *ex) {
+	if(ex->heap_number) {
+		__atomic_store_n(&ex->heap_due, ex->heap[0]->due, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&ex->heap_armed, ex->heap_number, __ATOMIC_RELEASE);
+}
+
+static void heap_put(struct fsm_executor *ex, struct exec_entry *entry, uint32_t due) {
+	entry->due = due;
+	if(entry->heap_index < 0) {
+		ASSERT(ex->heap_number < ex->heap_capacity);
+		entry->heap_index			= (int32_t)ex->heap_number;
+		ex->heap[ex->heap_number++] = entry;
+	}
+	heap_sift(ex, (uint32_t)entry->heap_index);
+	heap_publish(ex);
+}
+
+static void heap_remove(struct fsm_executor *ex, struct exec_entry *entry) {
+	if(entry->heap_index < 0) {
+		return;
+	}
+	uint32_t idx = (uint32_t)entry->heap_index;
+	heap_swap(ex, idx, ex->heap_number - 1);
+	ex->heap_number--;
+	entry->heap_index = -1;
+	if(idx < ex->heap_number) {
+		heap_sift(ex, idx);
+	}
+	heap_publish(ex);
+}
+
+static bool heap_pending(struct fsm_executor *ex, uint32_t *due) {
+	if(__atomic_load_n(&ex->heap_armed, __ATOMIC_ACQUIRE) == 0) {
+		return false;
+	}
+	*due = __atomic_load_n(&ex->heap_due, __ATOMIC_RELAXED);
+	return true;
+}
+
+// Queue the FSMs whose deadline has been reached on the calling worker
+static void exec_fire_deadlines(struct fsm_executor *ex, uint32_t worker) {
+	os_handle_t os	= ex->os;
+	uint32_t	due = 0;
+	uint32_t	now = os->uptime_ms();
+	if(!heap_pending(ex, &due) || due_before(now, due)) {
+		return;
+	}
+	os->mutex_lock(ex->lock, BLOCKTIME_MAX);
+	while(ex->heap_number && !due_before(now, ex->heap[0]->due)) {
+		struct exec_entry *entry = ex->heap[0];
+		heap_remove(ex, entry);
+		exec_schedule(ex, entry, (int32_t)worker);
+	}
+	os->mutex_unlock(ex->lock);
+}
+
+static struct exec_entry *exec_steal(struct fsm_executor *ex, struct exec_worker *worker) {
+	for(uint32_t i = 1; i < ex->worker_number; i++) {
+		struct exec_worker *victim = &ex->workers[(worker->index + i) % ex->worker_number];
+		struct exec_entry  *entry  = deque_pop_front(ex->os, &victim->deque);
+		if(entry) {
+			__atomic_add_fetch(&worker->steals, 1, __ATOMIC_RELAXED);
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static void exec_run(struct fsm_executor *ex,
+					 struct exec_worker	 *worker,
+					 struct exec_entry	 *entry) {
+	os_handle_t os = ex->os;
+	if(__atomic_load_n(&entry->removing, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&entry->sched, SCHED_DEAD, __ATOMIC_RELEASE);
+		return;
+	}
+	__atomic_store_n(&entry->sched, SCHED_RUNNING, __ATOMIC_RELEASE);
+	bool pending = false;
+	int	 events	 = fsm_poll_ex(entry->fsm, EXEC_BATCH_EVENTS, EXEC_BATCH_US, &pending);
+	__atomic_add_fetch(&worker->events, (uint32_t)events, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&worker->runs, 1, __ATOMIC_RELAXED);
+	uint32_t wait = pending ? 0 : fsm_next_deadline(entry->fsm);
+	if(__atomic_load_n(&entry->removing, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&entry->sched, SCHED_DEAD, __ATOMIC_RELEASE);
+		return;
+	}
+	if(wait == 0) {
+		// Budget used up or more work arrived, go to the back of our own deque
+		__atomic_store_n(&entry->sched, SCHED_QUEUED, __ATOMIC_RELEASE);
+		exec_enqueue(ex, entry, (int32_t)worker->index);
+		return;
+	}
+	if(wait != FSM_NO_DEADLINE) {
+		os->mutex_lock(ex->lock, BLOCKTIME_MAX);
+		heap_put(ex, entry, os->uptime_ms() + wait);
+		os->mutex_unlock(ex->lock);
+	}
+	uint32_t sched = SCHED_RUNNING;
+	if(!__atomic_compare_exchange_n(
+		   &entry->sched, &sched, SCHED_IDLE, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		// Woken while running
+		__atomic_store_n(&entry->sched, SCHED_QUEUED, __ATOMIC_RELEASE);
+		exec_enqueue(ex, entry, (int32_t)worker->index);
+	}
+}
+
+static void exec_idle(struct fsm_executor *ex, struct exec_worker *worker) {
+	os_handle_t os = ex->os;
+	__atomic_add_fetch(&ex->sleepers, 1, __ATOMIC_SEQ_CST);
+	// Check again after announcing, a producer that missed the announcement queued before it
+	if(__atomic_load_n(&ex->queued, __ATOMIC_SEQ_CST) == 0
+	   && __atomic_load_n(&ex->stop, __ATOMIC_SEQ_CST) == 0) {
+		uint32_t wait = EXEC_IDLE_WAIT_MS;
+		uint32_t due  = 0;
+		if(heap_pending(ex, &due)) {
+			uint32_t now = os->uptime_ms();
+			wait		 = due_before(now, due) ? due - now : 0;
+			wait		 = wait < EXEC_IDLE_WAIT_MS ? wait : EXEC_IDLE_WAIT_MS;
+		}
+		if(wait) {
+			fsm_port_log_flush();  // Format deferred log messages while there is nothing to run
+			__atomic_add_fetch(&worker->sleeps, 1, __ATOMIC_RELAXED);
+			os->sem_wait(ex->doorbell, wait);
+		}
+	}
+	__atomic_sub_fetch(&ex->sleepers, 1, __ATOMIC_SEQ_CST);
+}
+
+static void exec_worker_main(void *arg) {
+	struct exec_worker	*worker = arg;
+	struct fsm_executor *ex		= worker->executor;
+	while(__atomic_load_n(&ex->stop, __ATOMIC_ACQUIRE) == 0) {
+		exec_fire_deadlines(ex, worker->index);
+		exec_take_inbox(ex, worker);
+		struct exec_entry *entry = deque_pop_back(ex->os, &worker->deque);
+		if(entry == NULL) {
+			entry = exec_steal(ex, worker);
+		}
+		if(entry == NULL) {
+			exec_idle(ex, worker);
+			continue;
+		}
+		__atomic_sub_fetch(&ex->queued, 1, __ATOMIC_SEQ_CST);
+		exec_run(ex, worker, entry);
+	}
+}
+
+// Stop and join the workers that were started, then release everything but the entries
+static void exec_destroy(struct fsm_executor *ex) {
+	os_handle_t os = ex->os;
+	__atomic_store_n(&ex->stop, 1, __ATOMIC_SEQ_CST);
+	for(uint32_t i = 0; ex->doorbell && i < ex->worker_number; i++) {
+		os->sem_post(ex->doorbell);
+	}
+	for(uint32_t i = 0; i < ex->worker_number; i++) {
+		if(ex->workers[i].thread) {
+			os->thread_join(ex->workers[i].thread);
+		}
+	}
+	for(uint32_t i = 0; i < ex->worker_number; i++) {
+		os->free(ex->workers[i].deque.ring);
+		if(ex->workers[i].deque.lock) {
+			os->mutex_destroy(ex->workers[i].deque.lock);
+		}
+	}
+	os->free(ex->workers);
+	os->free(ex->heap);
+	if(ex->doorbell) {
+		os->sem_destroy(ex->doorbell);
+	}
+	if(ex->lock) {
+		os->mutex_destroy(ex->lock);
+	}
+	ex->magic_number = 0;
+	os->free(ex);
+}
+
+/*--- Public function definitions -----------------------------------------------------*/
+
+fsm_executor_t fsm_executor_new(uint32_t workers) {
+	ASSERT(workers > 0);
+	os_handle_t			 os = (os_handle_t)&fsm_port_os_handle;
+	struct fsm_executor *ex = os->malloc(sizeof(struct fsm_executor));
+	if(ex == NULL) {
+		return NULL;
+	}
+	memset(ex, 0, sizeof(struct fsm_executor));
+	ex->magic_number  = EXECUTOR_MAGIC_NUMBER;
+	ex->os			  = os;
+	ex->lock		  = os->mutex_create();
+	ex->doorbell	  = os->sem_create();
+	ex->workers		  = os->malloc(sizeof(struct exec_worker) * workers);
+	ex->worker_number = 0;
+	if(ex->lock == NULL || ex->doorbell == NULL || ex->workers == NULL) {
+		OS_PRINT_ERR(os, "Failed to create executor");
+		exec_destroy(ex);
+		return NULL;
+	}
+	memset(ex->workers, 0, sizeof(struct exec_worker) * workers);
+	// Every deque exists before the first worker may try to steal from it
+	for(uint32_t i = 0; i < workers; i++) {
+		ex->workers[i].executor	  = ex;
+		ex->workers[i].index	  = i;
+		ex->workers[i].deque.lock = os->mutex_create();
+		ex->worker_number++;
+		if(ex->workers[i].deque.lock == NULL) {
+			OS_PRINT_ERR(os, "Failed to create executor");
+			exec_destroy(ex);
+			return NULL;
+		}
+	}
+	for(uint32_t i = 0; i < workers; i++) {
+		ex->workers[i].thread = os->thread_create("fsm_exec", exec_worker_main, &ex->workers[i]);
+		if(ex->workers[i].thread == NULL) {
+			OS_PRINT_ERR(os, "Failed to start executor worker %u", i);
+			exec_destroy(ex);
+			return NULL;
+		}
+	}
+	return ex;
+}
+
+int fsm_executor_del(fsm_executor_t *executor) {
+	ASSERT(executor);
+	struct fsm_executor *ex = *executor;
+	ASSERT(ex);
+	ASSERT(ex->magic_number == EXECUTOR_MAGIC_NUMBER);
+	os_handle_t		   os	   = ex->os;
+	struct exec_entry *entries = ex->entries;
+	struct exec_entry *spare   = ex->free_entries;
+	// Detach the FSMs first so that no sender schedules them any more, then join the workers.
+	// fsm_set_wakeup() returns once no sender is inside exec_wakeup for that FSM, entries of
+	// removed FSMs were detached the same way, so neither the executor nor an entry is used by a
+	// sender after this loop.
+	for(struct exec_entry *entry = entries; entry; entry = entry->next) {
+		__atomic_store_n(&entry->removing, 1, __ATOMIC_RELEASE);
+		fsm_set_wakeup(entry->fsm, NULL, NULL);
+	}
+	exec_destroy(ex);
+	while(entries) {
+		struct exec_entry *next = entries->next;
+		os->free(entries);
+		entries = next;
+	}
+	while(spare) {
+		struct exec_entry *next = spare->next;
+		os->free(spare);
+		spare = next;
+	}
+	*executor = NULL;
+	return 0;
+}
+
+int fsm_executor_add(fsm_executor_t ex, fsm_t fsm) {
+	ASSERT(ex);
+	ASSERT(ex->magic_number == EXECUTOR_MAGIC_NUMBER);
+	ASSERT(fsm);
+	os_handle_t os = ex->os;
+	os->mutex_lock(ex->lock, BLOCKTIME_MAX);
+	// Reserve a heap slot per entry, so that arming a deadline never allocates
+	if(ex->heap_capacity <= ex->entry_number) {
+		uint32_t			capacity = ex->heap_capacity ? ex->heap_capacity * 2 : EXEC_DEQUE_MIN;
+		struct exec_entry **heap	 = os->malloc(sizeof(struct exec_entry *) * capacity);
+		if(heap == NULL) {
+			os->mutex_unlock(ex->lock);
+			return -1;
+		}
+		if(ex->heap_number) {
+			memcpy(heap, ex->heap, sizeof(struct exec_entry *) * ex->heap_number);
+		}
+		os->free(ex->heap);
+		ex->heap		  = heap;
+		ex->heap_capacity = capacity;
+	}
+	struct exec_entry *entry = ex->free_entries;
+	if(entry) {
+		ex->free_entries = entry->next;
+	} else {
+		// Entries of removed FSMs may still be queued, so deques are sized by allocated entries
+		if(exec_deques_reserve(ex, ex->entry_allocated + 1) == 0) {
+			entry = os->malloc(sizeof(struct exec_entry));
+		}
+		if(entry == NULL) {
+			os->mutex_unlock(ex->lock);
+			return -1;
+		}
+		ex->entry_allocated++;
+	}
+	entry->fsm		  = fsm;
+	entry->executor	  = ex;
+	entry->sched	  = SCHED_IDLE;
+	entry->removing	  = 0;
+	entry->due		  = 0;
+	entry->heap_index = -1;
+	entry->next		  = ex->entries;
+	ex->entries		  = entry;
+	ex->entry_number++;
+	os->mutex_unlock(ex->lock);
+	fsm_set_wakeup(fsm, exec_wakeup, entry);
+	exec_schedule(ex, entry, -1);
+	return 0;
+}
+
+int fsm_executor_remove(fsm_executor_t ex, fsm_t fsm) {
+	ASSERT(ex);
+	ASSERT(ex->magic_number == EXECUTOR_MAGIC_NUMBER);
+	ASSERT(fsm);
+	os_handle_t os = ex->os;
+	os->mutex_lock(ex->lock, BLOCKTIME_MAX);
+	struct exec_entry **node = &ex->entries;
+	while(*node && (*node)->fsm != fsm) {
+		node = &((*node)->next);
+	}
+	struct exec_entry *entry = *node;
+	if(entry) {
+		*node = entry->next;
+		ex->entry_number--;
+	}
+	os->mutex_unlock(ex->lock);
+	if(entry == NULL) {
+		return -1;
+	}
+	__atomic_store_n(&entry->removing, 1, __ATOMIC_RELEASE);
+	fsm_set_wakeup(fsm, NULL, NULL);
+	// Wait until no worker holds the entry. Queued or running entries are retired by the worker.
+	uint32_t sched = __atomic_load_n(&entry->sched, __ATOMIC_ACQUIRE);
+	while(sched != SCHED_DEAD) {
+		if(sched == SCHED_IDLE
+		   && __atomic_compare_exchange_n(
+			   &entry->sched, &sched, SCHED_DEAD, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+		os->delay_ms(1);
+		sched = __atomic_load_n(&entry->sched, __ATOMIC_ACQUIRE);
+	}
+	// fsm_set_wakeup() has waited for the senders inside exec_wakeup, the entry is kept for reuse
+	os->mutex_lock(ex->lock, BLOCKTIME_MAX);
+	heap_remove(ex, entry);
+	entry->next		 = ex->free_entries;
+	ex->free_entries = entry;
+	os->mutex_unlock(ex->lock);
+	return 0;
+}
+
+void fsm_executor_get_stats(fsm_executor_t ex, struct fsm_executor_stats *stats) {
+	ASSERT(ex);
+	ASSERT(ex->magic_number == EXECUTOR_MAGIC_NUMBER);
+	ASSERT(stats);
+	os_handle_t os = ex->os;
+	memset(stats, 0, sizeof(struct fsm_executor_stats));
+	stats->workers = ex->worker_number;
+	for(uint32_t i = 0; i < ex->worker_number; i++) {
+		stats->runs += __atomic_load_n(&ex->workers[i].runs, __ATOMIC_RELAXED);
+		stats->events += __atomic_load_n(&ex->workers[i].events, __ATOMIC_RELAXED);
+		stats->steals += __atomic_load_n(&ex->workers[i].steals, __ATOMIC_RELAXED);
+		stats->sleeps += __atomic_load_n(&ex->workers[i].sleeps, __ATOMIC_RELAXED);
+	}
+	stats->queue_depth	   = __atomic_load_n(&ex->queued, __ATOMIC_RELAXED);
+	stats->queue_depth_max = __atomic_load_n(&ex->queued_max, __ATOMIC_RELAXED);
+	os->mutex_lock(ex->lock, BLOCKTIME_MAX);
+	stats->fsm_number = ex->entry_number;
+	stats->timed	  = ex->heap_number;
+	os->mutex_unlock(ex->lock);
+}
+
+#ifdef __cplusplus
+}
+#endif
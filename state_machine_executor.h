@@ -0,0 +1,113 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+#ifndef __STATEMACHINE_EXECUTOR_H__
+#define __STATEMACHINE_EXECUTOR_H__
+
+/*--- Public dependencies -------------------------------------------------------------*/
+#include <stdint.h>
+#include "state_machine.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public macros -------------------------------------------------------------------*/
+
+/*--- Public type definitions ---------------------------------------------------------*/
+typedef struct fsm_executor *fsm_executor_t;
+
+struct fsm_executor_stats {
+	uint32_t workers;
+	uint32_t fsm_number;	   // FSMs owned by the executor
+	uint32_t runs;			   // Budgeted polls of a single FSM
+	uint32_t events;		   // Events dispatched by those polls
+	uint32_t steals;		   // Runs taken from the deque of another worker
+	uint32_t sleeps;		   // Times a worker went idle
+	uint32_t queue_depth;	   // FSMs currently waiting in the deques
+	uint32_t queue_depth_max;  // Highest queue_depth seen
+	uint32_t timed;			   // FSMs waiting for their next deadline
+};
+
+/*--- Public variable declarations ----------------------------------------------------*/
+
+/*--- Public function declarations ----------------------------------------------------*/
+
+/**
+ * @brief Create an executor that runs top-level state machines on a pool of worker threads.
+ *        A state machine is scheduled when an event is sent to it or one of its children, when a
+ *        switch is requested or when its next deadline is reached. Runnable FSMs are kept in
+ *        per-worker deques, idle workers steal from the others. An FSM never runs on two workers
+ *        at once.
+ *
+ * @param workers Number of worker threads, at least 1
+ * @return fsm_executor_t The executor, or NULL if it could not be created
+ */
+extern fsm_executor_t fsm_executor_new(uint32_t workers);
+
+/**
+ * @brief Stop the workers and delete an executor. The state machines are detached, not deleted.
+ *        Events may still be sent to them meanwhile, the call waits for senders that are waking
+ *        up the executor.
+ *
+ * @param executor Pointer to the executor, set to NULL
+ * @return int Always 0
+ */
+extern int fsm_executor_del(fsm_executor_t *executor);
+
+/**
+ * @brief Hand a top-level state machine over to the executor. The executor installs its own
+ *        wakeup hook with fsm_set_wakeup(). The hook is lock-free: it marks the FSM queued,
+ *        pushes it to a lock-free inbox and posts a semaphore, so fsm_event_try_send() stays
+ *        usable from signal handlers and interrupts.
+ *
+ * @param executor The executor
+ * @param fsm The state machine, must not be a child FSM or be polled by anyone else
+ * @return int 0 on success, -1 if out of memory
+ */
+extern int fsm_executor_add(fsm_executor_t executor, fsm_t fsm);
+
+/**
+ * @brief Take a state machine back from the executor. Waits until the FSM is not running, so it
+ *        must not be called from the handlers of that FSM.
+ *
+ * @param executor The executor
+ * @param fsm The state machine
+ * @return int 0 on success, -1 if the FSM is not owned by the executor
+ */
+extern int fsm_executor_remove(fsm_executor_t executor, fsm_t fsm);
+
+/**
+ * @brief Get throughput and queue depth counters of an executor. Counters wrap around.
+ *
+ * @param executor The executor
+ * @param stats Destination of the counters
+ */
+extern void fsm_executor_get_stats(fsm_executor_t executor, struct fsm_executor_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// __STATEMACHINE_EXECUTOR_H__
@@ -0,0 +1,525 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+/*--- Private dependencies ------------------------------------------------------------*/
+#include "state_machine.h"
+#include "state_machine_port.h"
+#include "state_machine_map.h"
+#include "state_machine_name.h"
+#include <stddef.h>
+#include <string.h>
+
+#include <assert.h>
+#define USE_ASSERT 1
+#if USE_ASSERT
+#define ASSERT(e) assert(e)
+#else
+#define ASSERT(e)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public variable definitions -----------------------------------------------------*/
+
+/*--- Private macros ------------------------------------------------------------------*/
+#define GRAPH_MAGIC_NUMBER (0x6EA9F1A5u)
+#define GRAPH_NONE		   (UINT16_MAX)	 // State index of no state
+
+/*--- Private type definitions --------------------------------------------------------*/
+struct graph_state {
+	uint32_t		   id;
+	const char		  *name;  // Interned, see fsm_name_intern()
+	fsm_inst_handler_t enter;  // Receives FSM_EVT_ENTER, handler unless defined otherwise
+	fsm_inst_handler_t handler;
+	fsm_inst_handler_t exit;  // Receives FSM_EVT_EXIT, handler unless defined otherwise
+	uint32_t		   poll_interval;
+};
+
+// One heap block: the graph, then its states, then the hash table of id_index
+struct fsm_graph {
+	uint32_t			magic_number;
+	const char		   *name;
+	const char		   *root_name;	// Interned STATE_NAME_ROOT, reported before the first switch
+	struct graph_state *states;
+	uint32_t			state_number;
+	uint32_t			mailbox_length;	 // Power of two, 0 without mailbox
+	uint32_t			instances;		 // Live instances, the graph is deleted after them
+	struct fsm_map		id_index;		 // State ID to graph_state
+	os_handle_t			os;
+};
+
+// Mailbox cell of an instance, a compact version of fsm_mailbox_cell without inline payloads
+struct inst_cell {
+	uint32_t seq;
+	uint32_t type;
+	uint32_t datalen;
+	void	*data;
+};
+
+struct inst_timer {
+	uint32_t type;
+	uint32_t expires;
+	uint32_t period;  // 0 for one-shot timers
+};
+
+// Followed by graph->mailbox_length cells. The mailbox is a bounded MPSC ring like fsm_mailbox,
+// senders claim cells by CAS on head and only the polling thread advances tail.
+struct fsm_inst {
+	const struct fsm_graph *graph;
+	void				   *context;
+	uint16_t				curr;  // State indices, GRAPH_NONE for none
+	uint16_t				prev;
+	uint16_t				next;  // Pending switch, set by CAS from GRAPH_NONE
+	uint8_t					timers_armed;  // Bit i set while timers[i] runs
+	uint32_t				ts_poll;
+	uint32_t				head;
+	uint32_t				tail;
+	struct inst_timer		timers[FSM_INST_TIMERS];
+};
+
+_Static_assert(FSM_INST_TIMERS > 0 && FSM_INST_TIMERS <= 8, "FSM_INST_TIMERS must be 1 to 8");
+
+/*--- Private function declarations ---------------------------------------------------*/
+
+/*--- Private variable definitions ----------------------------------------------------*/
+
+/*--- Private function definitions ----------------------------------------------------*/
+
+static struct inst_cell *inst_cells(fsm_inst_t inst) {
+	return (struct inst_cell *)(inst + 1);
+}
+
+static void inst_info(fsm_inst_t inst, uint16_t index, state_info_t info) {
+	const struct fsm_graph *graph = inst->graph;
+	if(index == GRAPH_NONE) {
+		info->id   = STATE_ID_ROOT;
+		info->name = graph->root_name;
+	} else {
+		info->id   = graph->states[index].id;
+		info->name = graph->states[index].name;
+	}
+}
+
+static void inst_call(fsm_inst_t		 inst,
+					  fsm_inst_handler_t handler,
+					  uint32_t			 type,
+					  uint32_t			 ts,
+					  void				*data,
+					  uint32_t			 datalen) {
+	if(handler == NULL) {
+		return;
+	}
+	struct event event = {
+		.type	   = type,
+		.timestamp = ts,
+		.data	   = data,
+		.datalen   = datalen,
+	};
+	handler(inst, inst->context, &event);
+}
+
+// Carry out a pending switch: exit the current state, then enter the requested one. Returns false
+// if no switch was pending.
+static bool inst_transition(fsm_inst_t inst, uint32_t ts) {
+	uint16_t next = __atomic_load_n(&inst->next, __ATOMIC_ACQUIRE);
+	if(next == GRAPH_NONE) {
+		return false;
+	}
+	const struct fsm_graph *graph = inst->graph;
+	uint16_t				prev  = inst->curr;
+	struct state_info		info;
+	inst->prev = prev;
+	__atomic_store_n(&inst->curr, next, __ATOMIC_RELEASE);
+	// Requests made by the exit and enter handlers become the next switch
+	__atomic_store_n(&inst->next, GRAPH_NONE, __ATOMIC_RELEASE);
+	if(prev != GRAPH_NONE) {
+		inst_info(inst, next, &info);
+		inst_call(inst, graph->states[prev].exit, FSM_EVT_EXIT, ts, &info, sizeof(info));
+	}
+	// Timers of the previous state end with it, including those started by its exit handler
+	inst->timers_armed = 0;
+	inst->ts_poll	   = ts;
+	inst_info(inst, prev, &info);
+	inst_call(inst, graph->states[next].enter, FSM_EVT_ENTER, ts, &info, sizeof(info));
+	return true;
+}
+
+// Take the oldest event of the mailbox, only called by the polling thread
+static bool inst_pop(fsm_inst_t inst, uint32_t *type, void **data, uint32_t *datalen) {
+	uint32_t		  mask = inst->graph->mailbox_length - 1;
+	uint32_t		  pos  = inst->tail;
+	struct inst_cell *cell = &inst_cells(inst)[pos & mask];
+	if(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+		return false;
+	}
+	*type	 = cell->type;
+	*data	 = cell->data;
+	*datalen = cell->datalen;
+	__atomic_store_n(&cell->seq, pos + mask + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&inst->tail, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/*--- Public function definitions -----------------------------------------------------*/
+
+fsm_graph_t fsm_graph_new(const char					   *name,
+						  const struct fsm_graph_state_def *states,
+						  uint32_t							state_number,
+						  uint32_t							mailbox_length) {
+	os_handle_t os = (os_handle_t)&fsm_port_os_handle;
+	if(name == NULL) {
+		name = "No name";
+	}
+	if(states == NULL || state_number == 0 || state_number >= GRAPH_NONE) {
+		OS_PRINT_ERR(os, "Bad number of states for graph %s", name);
+		return NULL;
+	}
+	for(uint32_t i = 0; i < state_number; i++) {
+		if(states[i].magic_number != STATE_MAGIC_NUMBER) {
+			OS_PRINT_ERR(os, "Invalid state definition #%u of graph %s", i, name);
+			return NULL;
+		}
+	}
+	uint32_t mailbox = mailbox_length ? 1 : 0;
+	while(mailbox < mailbox_length) {
+		mailbox <<= 1;
+	}
+	// The index table is at most half full
+	uint32_t index_capacity = 2;
+	while(index_capacity < state_number * 2) {
+		index_capacity <<= 1;
+	}
+	size_t size = sizeof(struct fsm_graph) + sizeof(struct graph_state) * state_number
+				  + sizeof(struct fsm_map_entry) * index_capacity;
+	struct fsm_graph *graph = os->malloc(size);
+	if(graph == NULL) {
+		OS_PRINT_ERR(
+			os, "Failed to allocate graph %s with %u states", name, (unsigned)state_number);
+		return NULL;
+	}
+	memset(graph, 0, size);
+	fsm_name_init(os);
+	graph->os			  = os;
+	graph->states		  = (struct graph_state *)(graph + 1);
+	graph->state_number	  = state_number;
+	graph->mailbox_length = mailbox;
+	graph->name			  = fsm_name_intern(name, NULL);
+	graph->root_name	  = fsm_name_intern_static(STATE_NAME_ROOT, NULL);
+	fsm_map_init_static(&graph->id_index,
+						(struct fsm_map_entry *)(graph->states + state_number),
+						index_capacity,
+						NULL);
+	for(uint32_t i = 0; i < state_number; i++) {
+		const struct fsm_graph_state_def *def	= &states[i];
+		struct graph_state				 *state = &graph->states[i];
+		state->id			 = def->id;
+		state->name			 = fsm_name_intern(def->name ? def->name : "No name", NULL);
+		state->enter		 = def->enter ? def->enter : def->handler;
+		state->handler		 = def->handler;
+		state->exit			 = def->exit ? def->exit : def->handler;
+		state->poll_interval = def->poll_interval;
+		if(state->name == NULL || fsm_map_get(&graph->id_index, def->id)
+		   || fsm_map_put(&graph->id_index, def->id, state) != 0) {
+			OS_PRINT_ERR(os, "Failed to add state #%u to graph %s", def->id, name);
+			os->free(graph);
+			return NULL;
+		}
+	}
+	if(graph->name == NULL || graph->root_name == NULL) {
+		OS_PRINT_ERR(os, "Failed to intern the name of graph %s", name);
+		os->free(graph);
+		return NULL;
+	}
+	graph->magic_number = GRAPH_MAGIC_NUMBER;
+	return graph;
+}
+
+int fsm_graph_del(fsm_graph_t *graph) {
+	if(graph == NULL) {
+		return -1;
+	}
+	if(*graph == NULL) {
+		return -2;
+	}
+	ASSERT((*graph)->magic_number == GRAPH_MAGIC_NUMBER);
+	os_handle_t os = (*graph)->os;
+	if(__atomic_load_n(&(*graph)->instances, __ATOMIC_ACQUIRE) != 0) {
+		OS_PRINT_ERR(
+			os, "Graph %s still has %u instances", (*graph)->name, (unsigned)(*graph)->instances);
+		return -3;
+	}
+	(*graph)->magic_number = 0;
+	os->free(*graph);
+	*graph = NULL;
+	return 0;
+}
+
+size_t fsm_graph_inst_size(fsm_graph_t graph) {
+	ASSERT(graph);
+	ASSERT(graph->magic_number == GRAPH_MAGIC_NUMBER);
+	size_t size = sizeof(struct fsm_inst) + sizeof(struct inst_cell) * graph->mailbox_length;
+	return (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+fsm_inst_t fsm_inst_init(fsm_graph_t graph, void *context, void *storage, size_t size) {
+	ASSERT(graph);
+	ASSERT(graph->magic_number == GRAPH_MAGIC_NUMBER);
+	os_handle_t os	 = graph->os;
+	size_t		need = fsm_graph_inst_size(graph);
+	if(storage == NULL || size < need || ((uintptr_t)storage % sizeof(uint64_t)) != 0) {
+		OS_PRINT_ERR(os,
+					 "Bad storage for instance of graph %s, %u bytes needed",
+					 graph->name,
+					 (unsigned)need);
+		return NULL;
+	}
+	memset(storage, 0, need);
+	fsm_inst_t inst = storage;
+	inst->graph		= graph;
+	inst->context	= context;
+	inst->curr		= GRAPH_NONE;
+	inst->prev		= GRAPH_NONE;
+	inst->next		= 0;  // The first state is entered by the first poll
+	for(uint32_t i = 0; i < graph->mailbox_length; i++) {
+		inst_cells(inst)[i].seq = i;
+	}
+	__atomic_add_fetch(&graph->instances, 1, __ATOMIC_RELEASE);
+	return inst;
+}
+
+int fsm_inst_deinit(fsm_inst_t inst) {
+	ASSERT(inst);
+	ASSERT(inst->graph->magic_number == GRAPH_MAGIC_NUMBER);
+	__atomic_sub_fetch(&((struct fsm_graph *)inst->graph)->instances, 1, __ATOMIC_RELEASE);
+	inst->graph = NULL;
+	return 0;
+}
+
+fsm_inst_t fsm_inst_new(fsm_graph_t graph, void *context) {
+	ASSERT(graph);
+	ASSERT(graph->magic_number == GRAPH_MAGIC_NUMBER);
+	os_handle_t os	  = graph->os;
+	size_t		size  = fsm_graph_inst_size(graph);
+	void	   *block = os->malloc(size);
+	if(block == NULL) {
+		OS_PRINT_ERR(os, "Failed to allocate instance of graph %s", graph->name);
+		return NULL;
+	}
+	return fsm_inst_init(graph, context, block, size);
+}
+
+int fsm_inst_del(fsm_inst_t *inst) {
+	if(inst == NULL) {
+		return -1;
+	}
+	if(*inst == NULL) {
+		return -2;
+	}
+	os_handle_t os = (*inst)->graph->os;
+	fsm_inst_deinit(*inst);
+	os->free(*inst);
+	*inst = NULL;
+	return 0;
+}
+
+void *fsm_inst_get_context(fsm_inst_t inst) {
+	ASSERT(inst);
+	return inst->context;
+}
+
+int fsm_inst_switch(fsm_inst_t inst, uint32_t id) {
+	ASSERT(inst);
+	ASSERT(inst->graph->magic_number == GRAPH_MAGIC_NUMBER);
+	const struct fsm_graph	 *graph = inst->graph;
+	os_handle_t				  os	= graph->os;
+	const struct graph_state *state = fsm_map_get(&graph->id_index, id);
+	if(state == NULL) {
+		OS_PRINT_ERR(os, "No #%d state in \"%s\" graph:", id, graph->name);
+		return -1;
+	}
+	uint16_t index	  = (uint16_t)(state - graph->states);
+	uint16_t expected = GRAPH_NONE;
+	if(!__atomic_compare_exchange_n(
+		   &inst->next, &expected, index, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+		OS_LOG(os,
+			   FSM_DBG_LVL_RAW,
+			   "Graph %s: Request \"%s\" is ignored" NL,
+			   graph->name,
+			   state->name);
+	}
+	return 0;
+}
+
+int fsm_inst_event_send(fsm_inst_t inst, uint32_t type, void *data, uint32_t datalen) {
+	ASSERT(inst);
+	ASSERT(inst->graph->magic_number == GRAPH_MAGIC_NUMBER);
+	if(inst->graph->mailbox_length == 0) {
+		return -1;
+	}
+	uint32_t mask = inst->graph->mailbox_length - 1;
+	uint32_t		  pos = __atomic_load_n(&inst->head, __ATOMIC_RELAXED);
+	struct inst_cell *cell;
+	for(;;) {
+		cell		 = &inst_cells(inst)[pos & mask];
+		int32_t diff = (int32_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+		if(diff == 0) {
+			if(__atomic_compare_exchange_n(
+				   &inst->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if(diff < 0) {
+			return -1;	// Full
+		} else {
+			pos = __atomic_load_n(&inst->head, __ATOMIC_RELAXED);
+		}
+	}
+	cell->type	  = type;
+	cell->data	  = data;
+	cell->datalen = datalen;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int fsm_inst_poll(fsm_inst_t inst) {
+	ASSERT(inst);
+	ASSERT(inst->graph->magic_number == GRAPH_MAGIC_NUMBER);
+	const struct fsm_graph *graph	  = inst->graph;
+	uint32_t				ts		  = graph->os->uptime_ms();
+	int						processed = 0;
+
+	inst_transition(inst, ts);
+	// Expired timers, each of them may switch and so cancel the others
+	for(uint32_t i = 0; i < FSM_INST_TIMERS; i++) {
+		struct inst_timer *timer = &inst->timers[i];
+		if((inst->timers_armed & (1u << i)) == 0 || (int32_t)(timer->expires - ts) > 0) {
+			continue;
+		}
+		if(timer->period) {
+			// Periods missed while not polled are skipped
+			timer->expires += timer->period;
+			if((int32_t)(timer->expires - ts) <= 0) {
+				timer->expires = ts + timer->period;
+			}
+		} else {
+			inst->timers_armed &= (uint8_t)~(1u << i);
+		}
+		inst_call(inst, graph->states[inst->curr].handler, timer->type, ts, NULL, 0);
+		processed++;
+		inst_transition(inst, ts);
+	}
+	// Events queued so far, later ones wait for the next poll
+	uint32_t type;
+	void	*data;
+	uint32_t datalen;
+	for(uint32_t n = 0; n < graph->mailbox_length && inst_pop(inst, &type, &data, &datalen); n++) {
+		inst_call(inst, graph->states[inst->curr].handler, type, ts, data, datalen);
+		processed++;
+		inst_transition(inst, ts);
+	}
+	const struct graph_state *curr = &graph->states[inst->curr];
+	if(curr->poll_interval != FSM_NO_POLL && ts - inst->ts_poll >= curr->poll_interval) {
+		inst->ts_poll = ts;
+		inst_call(inst, curr->handler, FSM_EVT_POLL, ts, NULL, 0);
+		processed++;
+		inst_transition(inst, ts);
+	}
+	return processed;
+}
+
+uint32_t fsm_inst_next_deadline(fsm_inst_t inst) {
+	ASSERT(inst);
+	ASSERT(inst->graph->magic_number == GRAPH_MAGIC_NUMBER);
+	const struct fsm_graph *graph = inst->graph;
+	uint16_t				curr  = __atomic_load_n(&inst->curr, __ATOMIC_ACQUIRE);
+	uint32_t				now	  = graph->os->uptime_ms();
+	uint32_t				ret	  = FSM_NO_DEADLINE;
+	if(__atomic_load_n(&inst->next, __ATOMIC_ACQUIRE) != GRAPH_NONE || curr == GRAPH_NONE
+	   || __atomic_load_n(&inst->head, __ATOMIC_ACQUIRE)
+			  != __atomic_load_n(&inst->tail, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+	uint32_t interval = graph->states[curr].poll_interval;
+	if(interval != FSM_NO_POLL) {
+		uint32_t elapsed = now - inst->ts_poll;
+		ret				 = elapsed >= interval ? 0 : interval - elapsed;
+	}
+	for(uint32_t i = 0; i < FSM_INST_TIMERS; i++) {
+		if(inst->timers_armed & (1u << i)) {
+			int32_t left = (int32_t)(inst->timers[i].expires - now);
+			if(left <= 0) {
+				return 0;
+			}
+			ret = (uint32_t)left < ret ? (uint32_t)left : ret;
+		}
+	}
+	return ret;
+}
+
+int fsm_inst_timer_start(fsm_inst_t inst, uint32_t type, uint32_t delay_ms, uint32_t period_ms) {
+	ASSERT(inst);
+	ASSERT(inst->graph->magic_number == GRAPH_MAGIC_NUMBER);
+	const struct fsm_graph *graph = inst->graph;
+	uint32_t				slot  = FSM_INST_TIMERS;
+	for(uint32_t i = 0; i < FSM_INST_TIMERS; i++) {
+		if((inst->timers_armed & (1u << i)) == 0) {
+			slot = slot < FSM_INST_TIMERS ? slot : i;
+		} else if(inst->timers[i].type == type) {
+			slot = i;  // Re-arm
+			break;
+		}
+	}
+	if(slot == FSM_INST_TIMERS) {
+		OS_PRINT_ERR(graph->os, "No free timer for event %u in graph %s", type, graph->name);
+		return -2;
+	}
+	struct inst_timer *timer = &inst->timers[slot];
+	timer->type				 = type;
+	timer->expires			 = graph->os->uptime_ms() + delay_ms;
+	timer->period			 = period_ms;
+	inst->timers_armed |= (uint8_t)(1u << slot);
+	return 0;
+}
+
+int fsm_inst_timer_stop(fsm_inst_t inst, uint32_t type) {
+	ASSERT(inst);
+	for(uint32_t i = 0; i < FSM_INST_TIMERS; i++) {
+		if((inst->timers_armed & (1u << i)) && inst->timers[i].type == type) {
+			inst->timers_armed &= (uint8_t)~(1u << i);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void fsm_inst_get_current_state(fsm_inst_t inst, state_info_t info) {
+	ASSERT(inst);
+	ASSERT(info);
+	inst_info(inst, __atomic_load_n(&inst->curr, __ATOMIC_ACQUIRE), info);
+}
+
+#ifdef __cplusplus
+}
+#endif
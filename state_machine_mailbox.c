@@ -0,0 +1,190 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+/*--- Private dependencies ------------------------------------------------------------*/
+#include "state_machine_mailbox.h"
+#include <stddef.h>
+#include <string.h>
+
+#include <assert.h>
+#define USE_ASSERT 1
+#if USE_ASSERT
+#define ASSERT(e) assert(e)
+#else
+#define ASSERT(e)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public variable definitions -----------------------------------------------------*/
+
+/*--- Private macros ------------------------------------------------------------------*/
+
+/*--- Private type definitions --------------------------------------------------------*/
+
+/*--- Private function declarations ---------------------------------------------------*/
+
+/*--- Private variable definitions ----------------------------------------------------*/
+
+/*--- Private function definitions ----------------------------------------------------*/
+
+/*--- Public function definitions -----------------------------------------------------*/
+
+int fsm_mailbox_init(struct fsm_mailbox *mb, uint32_t capacity, os_handle_t os) {
+	ASSERT(mb);
+	ASSERT(os);
+	ASSERT(capacity > 0);
+	uint32_t size = 1;
+	while(size < capacity) {
+		size <<= 1;
+	}
+	mb->cells = os->malloc(size * sizeof(struct fsm_mailbox_cell));
+	if(mb->cells == NULL) {
+		return -1;
+	}
+	for(uint32_t i = 0; i < size; i++) {
+		mb->cells[i].seq = i;
+	}
+	mb->mask	  = size - 1;
+	mb->head	  = 0;
+	mb->tail	  = 0;
+	mb->is_static = false;
+	return 0;
+}
+
+int fsm_mailbox_init_static(struct fsm_mailbox		*mb,
+							struct fsm_mailbox_cell *cells,
+							uint32_t				 capacity) {
+	ASSERT(mb);
+	ASSERT(cells);
+	if(capacity == 0 || (capacity & (capacity - 1)) != 0) {
+		return -1;
+	}
+	for(uint32_t i = 0; i < capacity; i++) {
+		cells[i].seq = i;
+	}
+	mb->cells	  = cells;
+	mb->mask	  = capacity - 1;
+	mb->head	  = 0;
+	mb->tail	  = 0;
+	mb->is_static = true;
+	return 0;
+}
+
+void fsm_mailbox_deinit(struct fsm_mailbox *mb, os_handle_t os) {
+	ASSERT(mb);
+	ASSERT(os);
+	if(!mb->is_static) {
+		os->free(mb->cells);
+	}
+	mb->cells = NULL;
+	mb->mask  = 0;
+	mb->head  = 0;
+	mb->tail  = 0;
+}
+
+bool fsm_mailbox_push(struct fsm_mailbox *mb, const struct event *event, uint32_t flags) {
+	struct fsm_mailbox_cell *cell;
+	uint32_t				 pos = __atomic_load_n(&mb->head, __ATOMIC_RELAXED);
+	for(;;) {
+		cell		 = &mb->cells[pos & mb->mask];
+		uint32_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		int32_t	 dif = (int32_t)(seq - pos);
+		if(dif == 0) {
+			// Cell is free for this lap, try to claim it
+			if(__atomic_compare_exchange_n(
+				   &mb->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if(dif < 0) {
+			return false;  // Cell still holds an event from the previous lap, full
+		} else {
+			pos = __atomic_load_n(&mb->head, __ATOMIC_RELAXED);
+		}
+	}
+	cell->event = *event;
+	cell->flags = flags;
+	if(flags & FSM_MAILBOX_INLINE) {
+		ASSERT(event->datalen <= FSM_MAILBOX_INLINE_SIZE);
+		memcpy(cell->payload, event->data, event->datalen);
+		cell->event.data = NULL;
+	}
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+bool fsm_mailbox_pop(struct fsm_mailbox *mb, struct event *event, uint32_t *flags, void *payload) {
+	struct fsm_mailbox_cell *cell;
+	uint32_t				 pos = __atomic_load_n(&mb->tail, __ATOMIC_RELAXED);
+	for(;;) {
+		cell		 = &mb->cells[pos & mb->mask];
+		uint32_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		int32_t	 dif = (int32_t)(seq - (pos + 1));
+		if(dif == 0) {
+			// Cell holds the event of this lap, try to claim it
+			if(__atomic_compare_exchange_n(
+				   &mb->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if(dif < 0) {
+			return false;  // Empty, or the producer of this cell has not finished writing
+		} else {
+			pos = __atomic_load_n(&mb->tail, __ATOMIC_RELAXED);
+		}
+	}
+	*event = cell->event;
+	if(flags) {
+		*flags = cell->flags;
+	}
+	if(cell->flags & FSM_MAILBOX_INLINE) {
+		if(payload) {
+			memcpy(payload, cell->payload, event->datalen);
+		}
+		event->data = payload;
+	}
+	// Hand the cell to the producer of the next lap
+	__atomic_store_n(&cell->seq, pos + mb->mask + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+uint32_t fsm_mailbox_count(const struct fsm_mailbox *mb) {
+	uint32_t tail = __atomic_load_n(&mb->tail, __ATOMIC_ACQUIRE);
+	uint32_t head = __atomic_load_n(&mb->head, __ATOMIC_ACQUIRE);
+	uint32_t ret  = head - tail;
+	return ret > mb->mask + 1 ? 0 : ret;  // Tail passed a stale head
+}
+
+uint32_t fsm_mailbox_head(const struct fsm_mailbox *mb) {
+	return __atomic_load_n(&mb->head, __ATOMIC_ACQUIRE);
+}
+
+uint32_t fsm_mailbox_tail(const struct fsm_mailbox *mb) {
+	return __atomic_load_n(&mb->tail, __ATOMIC_ACQUIRE);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,160 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+#ifndef __STATEMACHINE_MAILBOX_H__
+#define __STATEMACHINE_MAILBOX_H__
+
+/*--- Public dependencies -------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "state_machine.h"
+#include "state_machine_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public macros -------------------------------------------------------------------*/
+#define FSM_MAILBOX_INLINE_SIZE 32	// Largest payload copied into a cell
+
+#define FSM_MAILBOX_INLINE (1u << 0)  // The payload is copied into the cell
+#define FSM_MAILBOX_POOLED (1u << 1)  // data is a payload pool block holding a reference
+
+/*--- Public type definitions ---------------------------------------------------------*/
+
+/**
+ * @brief Bounded lock-free event ring (D. Vyukov's bounded queue). Every cell carries a sequence
+ *        number telling whether it is free for the producer of a given lap or holds an event for
+ *        the consumer of that lap, so producers claim cells with a single CAS on head and never
+ *        take a lock. Designed for many producers and one polling consumer, the consumer side
+ *        also claims cells by CAS so that clearing from another thread stays safe. Small payloads
+ *        can travel inside the cell, so that the sender does not need to keep them alive.
+ */
+struct fsm_mailbox_cell {
+	uint32_t	 seq;
+	uint32_t	 flags;	 // FSM_MAILBOX_* of the event
+	struct event event;
+	uint64_t	 payload[FSM_MAILBOX_INLINE_SIZE / sizeof(uint64_t)];
+};
+
+struct fsm_mailbox {
+	struct fsm_mailbox_cell *cells;
+	uint32_t				 mask;		 // Capacity - 1, capacity is a power of two
+	uint32_t				 head;		 // Next position to write, advanced by producers
+	uint32_t				 tail;		 // Next position to read, advanced by the consumer
+	bool					 is_static;	 // Cells are caller storage and not freed on deinit
+};
+
+/*--- Public variable declarations ----------------------------------------------------*/
+
+/*--- Public function declarations ----------------------------------------------------*/
+
+/**
+ * @brief Initialize a mailbox and allocate its cells.
+ *
+ * @param mb The mailbox to initialize
+ * @param capacity Minimum number of events, rounded up to a power of two
+ * @param os OS handle used for allocation
+ * @return int 0 on success, -1 if the cells could not be allocated
+ */
+extern int fsm_mailbox_init(struct fsm_mailbox *mb, uint32_t capacity, os_handle_t os);
+
+/**
+ * @brief Initialize a mailbox on caller-provided cells. Nothing is allocated.
+ *
+ * @param mb The mailbox to initialize
+ * @param cells Storage for the cells, must outlive the mailbox
+ * @param capacity Number of cells, must be a power of two
+ * @return int 0 on success, -1 if capacity is not a power of two
+ */
+extern int fsm_mailbox_init_static(struct fsm_mailbox	   *mb,
+								   struct fsm_mailbox_cell *cells,
+								   uint32_t					capacity);
+
+/**
+ * @brief Release the cells of a mailbox. Pending events are discarded.
+ *
+ * @param mb The mailbox to deinitialize
+ * @param os OS handle the mailbox was initialized with
+ */
+extern void fsm_mailbox_deinit(struct fsm_mailbox *mb, os_handle_t os);
+
+/**
+ * @brief Append an event without blocking. Lock-free and async-signal-safe.
+ *
+ * @param mb The mailbox to write to
+ * @param event The event to copy into the mailbox
+ * @param flags FSM_MAILBOX_* flags stored with the event. With FSM_MAILBOX_INLINE, datalen bytes
+ * at data are copied into the cell, datalen must not exceed FSM_MAILBOX_INLINE_SIZE.
+ * @return true The event was queued
+ * @return false The mailbox is full
+ */
+extern bool fsm_mailbox_push(struct fsm_mailbox *mb, const struct event *event, uint32_t flags);
+
+/**
+ * @brief Take the oldest event without blocking.
+ *
+ * @param mb The mailbox to read from
+ * @param event Destination of the event
+ * @param flags Set to the flags the event was pushed with, may be NULL
+ * @param payload Buffer of FSM_MAILBOX_INLINE_SIZE bytes receiving an inline payload, event->data
+ * then points to it. May be NULL to discard the payload.
+ * @return true An event was copied to event
+ * @return false The mailbox is empty
+ */
+extern bool fsm_mailbox_pop(struct fsm_mailbox *mb,
+							struct event	   *event,
+							uint32_t		   *flags,
+							void			   *payload);
+
+/**
+ * @brief Number of queued events. Only a snapshot while producers are running.
+ *
+ * @param mb The mailbox to inspect
+ * @return uint32_t Number of queued events
+ */
+extern uint32_t fsm_mailbox_count(const struct fsm_mailbox *mb);
+
+/**
+ * @brief Position of the next event to be pushed. Events are numbered in push order, so an event
+ *        pushed at this position or later is popped after all events that are queued now.
+ *
+ * @param mb The mailbox to inspect
+ * @return uint32_t Push position, wraps around
+ */
+extern uint32_t fsm_mailbox_head(const struct fsm_mailbox *mb);
+
+/**
+ * @brief Position of the next event to be popped. All events before it have been taken.
+ *
+ * @param mb The mailbox to inspect
+ * @return uint32_t Pop position, wraps around
+ */
+extern uint32_t fsm_mailbox_tail(const struct fsm_mailbox *mb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// __STATEMACHINE_MAILBOX_H__
@@ -0,0 +1,358 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+/*--- Private dependencies ------------------------------------------------------------*/
+#include "state_machine_map.h"
+#include <stddef.h>
+#include <string.h>
+
+#include <assert.h>
+#define USE_ASSERT 1
+#if USE_ASSERT
+#define ASSERT(e) assert(e)
+#else
+#define ASSERT(e)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public variable definitions -----------------------------------------------------*/
+
+/*--- Private macros ------------------------------------------------------------------*/
+#define MAP_MIN_CAPACITY	   16
+#define MAP_DENSE_MAX_SPARSITY 2  // Dense layout is kept while span <= 2 * entries
+#define MAP_TOMBSTONE		   ((void *)&map_tombstone)
+
+/*--- Private type definitions --------------------------------------------------------*/
+
+/*--- Private function declarations ---------------------------------------------------*/
+
+/*--- Private variable definitions ----------------------------------------------------*/
+static const char map_tombstone = 0;
+
+/*--- Private function definitions ----------------------------------------------------*/
+
+// Finalizer of MurmurHash3, spreads IDs that differ only in a few bits
+static inline uint32_t map_hash(uint32_t key) {
+	key ^= key >> 16;
+	key *= 0x85EBCA6Bu;
+	key ^= key >> 13;
+	key *= 0xC2B2AE35u;
+	key ^= key >> 16;
+	return key;
+}
+
+static uint32_t map_pow2_ceil(uint32_t v) {
+	uint32_t ret = MAP_MIN_CAPACITY;
+	while(ret < v) {
+		ret <<= 1;
+	}
+	return ret;
+}
+
+// Insert into a hash table known to have room and not to contain the key
+static void map_hash_insert(struct fsm_map_entry *table, uint32_t mask, uint32_t key, void *value) {
+	uint32_t idx = map_hash(key) & mask;
+	while(table[idx].value) {
+		idx = (idx + 1) & mask;
+	}
+	table[idx].key	 = key;
+	table[idx].value = value;
+}
+
+// Move all live entries into a new hash table of the given capacity
+static int map_hash_rebuild(struct fsm_map *map, uint32_t capacity) {
+	struct fsm_map_entry *table = map->os->malloc(sizeof(struct fsm_map_entry) * capacity);
+	if(table == NULL) {
+		return -2;
+	}
+	memset(table, 0, sizeof(struct fsm_map_entry) * capacity);
+	if(map->mode == FSM_MAP_DENSE) {
+		for(uint32_t i = 0; i < map->capacity; i++) {
+			if(map->table.dense[i]) {
+				map_hash_insert(table, capacity - 1, map->base + i, map->table.dense[i]);
+			}
+		}
+	} else if(map->mode == FSM_MAP_HASH) {
+		for(uint32_t i = 0; i < map->capacity; i++) {
+			void *value = map->table.hash[i].value;
+			if(value && value != MAP_TOMBSTONE) {
+				map_hash_insert(table, capacity - 1, map->table.hash[i].key, value);
+			}
+		}
+	}
+	if(!map->is_static) {
+		map->os->free(map->table.hash);
+	}
+	map->table.hash = table;
+	map->capacity	= capacity;
+	map->used		= map->count;
+	map->mode		= FSM_MAP_HASH;
+	map->is_static	= false;  // Caller storage is left behind once outgrown
+	return 0;
+}
+
+// Move all live entries into a new dense table covering at least [lo, hi]. The spare slots are
+// split around the range so that keys growing in either direction rebuild only logarithmically.
+static int map_dense_rebuild(struct fsm_map *map, uint32_t lo, uint32_t hi) {
+	uint32_t capacity = (hi - lo + 1) * 2;
+	if(capacity < MAP_MIN_CAPACITY) {
+		capacity = MAP_MIN_CAPACITY;
+	}
+	uint32_t headroom = (capacity - (hi - lo + 1)) / 2;
+	uint32_t base	  = lo > headroom ? lo - headroom : 0;
+	void **table = map->os->malloc(sizeof(void *) * capacity);
+	if(table == NULL) {
+		return -2;
+	}
+	memset(table, 0, sizeof(void *) * capacity);
+	if(map->mode == FSM_MAP_DENSE) {
+		for(uint32_t i = 0; i < map->capacity; i++) {
+			if(map->table.dense[i]) {
+				table[map->base + i - base] = map->table.dense[i];
+			}
+		}
+	}
+	map->os->free(map->table.dense);
+	map->table.dense = table;
+	map->capacity	 = capacity;
+	map->base		 = base;
+	map->mode		 = FSM_MAP_DENSE;
+	return 0;
+}
+
+// Remove the entry in slot idx of a static table by shifting later entries of its probe run back,
+// so that lookups stay correct without tombstones
+static void map_static_remove(struct fsm_map *map, uint32_t idx) {
+	struct fsm_map_entry *table = map->table.hash;
+	uint32_t			  mask	= map->capacity - 1;
+	uint32_t			  hole	= idx;
+	for(uint32_t next = (hole + 1) & mask; table[next].value; next = (next + 1) & mask) {
+		uint32_t home = map_hash(table[next].key) & mask;
+		// The entry may move into the hole unless its home lies cyclically in (hole, next]
+		if(((next - home) & mask) >= ((next - hole) & mask)) {
+			table[hole] = table[next];
+			hole		= next;
+		}
+	}
+	table[hole].key	  = 0;
+	table[hole].value = NULL;
+}
+
+static void map_reset(struct fsm_map *map) {
+	if(map->is_static) {
+		map->count = 0;
+		map->used  = 0;
+		return;	 // The table is empty already and stays in place
+	}
+	if(map->mode == FSM_MAP_DENSE) {
+		map->os->free(map->table.dense);
+	} else if(map->mode == FSM_MAP_HASH) {
+		map->os->free(map->table.hash);
+	}
+	map->table.hash = NULL;
+	map->mode		= FSM_MAP_EMPTY;
+	map->capacity	= 0;
+	map->count		= 0;
+	map->used		= 0;
+}
+
+/*--- Public function definitions -----------------------------------------------------*/
+
+void fsm_map_init(struct fsm_map *map, os_handle_t os) {
+	ASSERT(map);
+	ASSERT(os);
+	memset(map, 0, sizeof(struct fsm_map));
+	map->mode = FSM_MAP_EMPTY;
+	map->os	  = os;
+}
+
+int fsm_map_init_static(struct fsm_map		 *map,
+						struct fsm_map_entry *table,
+						uint32_t			  capacity,
+						os_handle_t			  os) {
+	ASSERT(map);
+	ASSERT(table);
+	if(capacity == 0 || (capacity & (capacity - 1)) != 0) {
+		return -1;
+	}
+	memset(map, 0, sizeof(struct fsm_map));
+	memset(table, 0, sizeof(struct fsm_map_entry) * capacity);
+	map->mode		= FSM_MAP_HASH;
+	map->capacity	= capacity;
+	map->table.hash = table;
+	map->os			= os;
+	map->is_static	= true;
+	return 0;
+}
+
+void fsm_map_deinit(struct fsm_map *map) {
+	ASSERT(map);
+	map_reset(map);
+	if(map->is_static) {
+		map->table.hash = NULL;
+		map->capacity	= 0;
+		map->mode		= FSM_MAP_EMPTY;
+	}
+}
+
+void *fsm_map_get(const struct fsm_map *map, uint32_t key) {
+	ASSERT(map);
+	if(map->mode == FSM_MAP_DENSE) {
+		uint32_t offset = key - map->base;
+		return offset < map->capacity ? map->table.dense[offset] : NULL;
+	}
+	if(map->mode == FSM_MAP_HASH) {
+		uint32_t mask = map->capacity - 1;
+		uint32_t idx  = map_hash(key) & mask;
+		while(map->table.hash[idx].value) {
+			if(map->table.hash[idx].key == key && map->table.hash[idx].value != MAP_TOMBSTONE) {
+				return map->table.hash[idx].value;
+			}
+			idx = (idx + 1) & mask;
+		}
+	}
+	return NULL;
+}
+
+int fsm_map_put(struct fsm_map *map, uint32_t key, void *value) {
+	ASSERT(map);
+	ASSERT(value);
+	if(map->mode == FSM_MAP_EMPTY) {
+		map->key_min = key;
+		map->key_max = key;
+		if(map_dense_rebuild(map, key, key) != 0) {
+			return -2;
+		}
+	}
+	if(map->mode == FSM_MAP_DENSE) {
+		uint32_t offset = key - map->base;
+		if(offset >= map->capacity) {
+			// Out of the table, rebuild it dense if the span stays compact, otherwise hash
+			uint32_t lo	   = key < map->key_min ? key : map->key_min;
+			uint32_t hi	   = key > map->key_max ? key : map->key_max;
+			uint32_t limit = (map->count + 1) * MAP_DENSE_MAX_SPARSITY;
+			int		 ret;
+			if(limit < MAP_MIN_CAPACITY) {
+				limit = MAP_MIN_CAPACITY;
+			}
+			if(hi - lo < limit) {
+				ret = map_dense_rebuild(map, lo, hi);
+			} else {
+				ret = map_hash_rebuild(map, map_pow2_ceil((map->count + 1) * 4));
+			}
+			if(ret != 0) {
+				return ret;
+			}
+		}
+	}
+	if(map->mode == FSM_MAP_DENSE) {
+		uint32_t offset = key - map->base;
+		if(map->table.dense[offset]) {
+			return -1;
+		}
+		map->table.dense[offset] = value;
+	} else {
+		// Keep the load factor including tombstones at or below one half
+		if(map->is_static) {
+			// Out of caller storage, move to the heap if the map was given an OS handle
+			if((map->count + 1) * 2 > map->capacity
+			   && (map->os == NULL || map_hash_rebuild(map, map->capacity * 2) != 0)) {
+				return -2;
+			}
+		} else if((map->used + 1) * 2 > map->capacity) {
+			uint32_t capacity = map->capacity;
+			if((map->count + 1) * 4 > capacity) {
+				capacity *= 2;
+			}
+			if(map_hash_rebuild(map, capacity) != 0) {
+				return -2;
+			}
+		}
+		uint32_t mask = map->capacity - 1;
+		uint32_t idx  = map_hash(key) & mask;
+		uint32_t slot = UINT32_MAX;
+		while(map->table.hash[idx].value) {
+			if(map->table.hash[idx].value == MAP_TOMBSTONE) {
+				if(slot == UINT32_MAX) {
+					slot = idx;	 // Reuse the first tombstone on the probe path
+				}
+			} else if(map->table.hash[idx].key == key) {
+				return -1;
+			}
+			idx = (idx + 1) & mask;
+		}
+		if(slot == UINT32_MAX) {
+			slot = idx;
+			map->used++;
+		}
+		map->table.hash[slot].key	= key;
+		map->table.hash[slot].value = value;
+	}
+	map->key_min = key < map->key_min ? key : map->key_min;
+	map->key_max = key > map->key_max ? key : map->key_max;
+	map->count++;
+	return 0;
+}
+
+void *fsm_map_remove(struct fsm_map *map, uint32_t key) {
+	ASSERT(map);
+	void *ret = NULL;
+	if(map->mode == FSM_MAP_DENSE) {
+		uint32_t offset = key - map->base;
+		if(offset < map->capacity && map->table.dense[offset]) {
+			ret						 = map->table.dense[offset];
+			map->table.dense[offset] = NULL;
+		}
+	} else if(map->mode == FSM_MAP_HASH) {
+		uint32_t mask = map->capacity - 1;
+		uint32_t idx  = map_hash(key) & mask;
+		while(map->table.hash[idx].value) {
+			if(map->table.hash[idx].key == key && map->table.hash[idx].value != MAP_TOMBSTONE) {
+				ret = map->table.hash[idx].value;
+				if(map->is_static) {
+					map_static_remove(map, idx);
+					map->used--;
+				} else {
+					map->table.hash[idx].value = MAP_TOMBSTONE;
+				}
+				break;
+			}
+			idx = (idx + 1) & mask;
+		}
+	}
+	if(ret) {
+		map->count--;
+		if(map->count == 0) {
+			map_reset(map);
+		}
+	}
+	return ret;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,141 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+#ifndef __STATEMACHINE_MAP_H__
+#define __STATEMACHINE_MAP_H__
+
+/*--- Public dependencies -------------------------------------------------------------*/
+#include <stdint.h>
+#include "state_machine_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public macros -------------------------------------------------------------------*/
+
+/*--- Public type definitions ---------------------------------------------------------*/
+
+/**
+ * @brief Map from uint32_t keys to non-NULL pointers. Compact key sets are stored in a
+ *        direct-mapped table indexed by (key - base), sparse key sets in an open-addressing hash
+ *        table with linear probing. The map switches from dense to hash layout when the key span
+ *        grows too large for the number of entries. Static maps work on a caller-provided hash
+ *        table that never grows, removals shift entries back instead of leaving tombstones.
+ */
+struct fsm_map_entry {
+	uint32_t key;
+	void	*value;
+};
+
+typedef enum fsm_map_mode {
+	FSM_MAP_EMPTY,
+	FSM_MAP_DENSE,
+	FSM_MAP_HASH,
+} fsm_map_mode_t;
+
+struct fsm_map {
+	fsm_map_mode_t mode;
+	uint32_t	   capacity;  // Slots in the table, a power of two in hash mode
+	uint32_t	   count;	  // Live entries
+	uint32_t	   used;	  // Live entries plus tombstones, hash mode only
+	uint32_t	   base;	  // Key of slot 0, dense mode only
+	uint32_t	   key_min;	  // Bounds of the keys ever stored since the last rebuild
+	uint32_t	   key_max;
+	union {
+		void				**dense;
+		struct fsm_map_entry *hash;
+	} table;
+	os_handle_t os;
+	bool		is_static;
+};
+
+/*--- Public variable declarations ----------------------------------------------------*/
+
+/*--- Public function declarations ----------------------------------------------------*/
+
+/**
+ * @brief Initialize an empty map. No memory is allocated until the first insertion.
+ *
+ * @param map The map to initialize
+ * @param os OS handle used for table allocation
+ */
+extern void fsm_map_init(struct fsm_map *map, os_handle_t os);
+
+/**
+ * @brief Initialize an empty map on a caller-provided hash table. Nothing is allocated until the
+ *        table is half full, then the entries move to a heap table if os is given, otherwise
+ *        insertions fail.
+ *
+ * @param map The map to initialize
+ * @param table Storage for the table, must outlive the map
+ * @param capacity Number of entries in table, must be a power of two
+ * @param os OS handle used once the table is outgrown, or NULL to never allocate
+ * @return int 0 on success, -1 if capacity is not a power of two
+ */
+extern int fsm_map_init_static(struct fsm_map		*map,
+							   struct fsm_map_entry	*table,
+							   uint32_t				 capacity,
+							   os_handle_t			 os);
+
+/**
+ * @brief Release the table of a map. The stored pointers are not touched.
+ *
+ * @param map The map to deinitialize
+ */
+extern void fsm_map_deinit(struct fsm_map *map);
+
+/**
+ * @brief Look up a key.
+ *
+ * @param map The map to search
+ * @param key The key to look up
+ * @return void* The value stored for the key, or NULL if the key is not present
+ */
+extern void *fsm_map_get(const struct fsm_map *map, uint32_t key);
+
+/**
+ * @brief Insert a key.
+ *
+ * @param map The map to insert into
+ * @param key The key to insert
+ * @param value The value to store, must not be NULL
+ * @return int 0 on success, -1 if the key is already present, -2 if the table could not grow
+ */
+extern int fsm_map_put(struct fsm_map *map, uint32_t key, void *value);
+
+/**
+ * @brief Remove a key.
+ *
+ * @param map The map to remove from
+ * @param key The key to remove
+ * @return void* The value that was stored for the key, or NULL if the key was not present
+ */
+extern void *fsm_map_remove(struct fsm_map *map, uint32_t key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// __STATEMACHINE_MAP_H__
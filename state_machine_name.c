@@ -0,0 +1,220 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+/*--- Private dependencies ------------------------------------------------------------*/
+#include "state_machine.h"
+#include "state_machine_name.h"
+#include <stddef.h>
+#include <string.h>
+
+#include <assert.h>
+#define USE_ASSERT 1
+#if USE_ASSERT
+#define ASSERT(e) assert(e)
+#else
+#define ASSERT(e)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public variable definitions -----------------------------------------------------*/
+
+/*--- Private macros ------------------------------------------------------------------*/
+// The first names are stored without touching the heap
+#define NAME_STATIC_SLOTS 64  // Must be a power of two
+#define NAME_STATIC_ARENA 1024
+
+/*--- Private type definitions --------------------------------------------------------*/
+struct name_rec {
+	uint32_t	hash;
+	uint32_t	atom;
+	const char *str;
+};
+
+// Open addressing table. Lookups read the published table without the lock, so a table that
+// has been replaced by a bigger one stays allocated and is kept on the retired list.
+struct name_table {
+	struct name_table *retired;
+	uint32_t		   capacity;
+	struct name_rec	 **slots;
+};
+
+/*--- Private function declarations ---------------------------------------------------*/
+
+/*--- Private variable definitions ----------------------------------------------------*/
+static struct name_rec	 *static_slots[NAME_STATIC_SLOTS];
+static struct name_table  static_table = { NULL, NAME_STATIC_SLOTS, static_slots };
+static struct name_table *table		   = &static_table;	 // Published with release semantics
+static uint32_t			  count		   = 0;
+static uint64_t			  arena[NAME_STATIC_ARENA / sizeof(uint64_t)];
+static uint32_t			  arena_used = 0;
+static void				 *lock		 = NULL;
+static os_handle_t		  name_os	 = NULL;
+static uint64_t			  lock_storage[FSM_STATIC_MUTEX_SIZE / sizeof(uint64_t)];
+
+/*--- Private function definitions ----------------------------------------------------*/
+
+// FNV-1a
+static uint32_t name_hash(const char *name, size_t *len) {
+	uint32_t	hash = 2166136261u;
+	const char *c	 = name;
+	while(*c) {
+		hash ^= (uint8_t)*c++;
+		hash *= 16777619u;
+	}
+	*len = (size_t)(c - name);
+	return hash;
+}
+
+// Lock-free, records are filled before they are stored into a slot and never change afterwards
+static struct name_rec *name_find(const struct name_table *tab, const char *name, uint32_t hash) {
+	uint32_t		 mask = tab->capacity - 1;
+	uint32_t		 idx  = hash & mask;
+	struct name_rec *rec;
+	while((rec = __atomic_load_n(&tab->slots[idx], __ATOMIC_ACQUIRE)) != NULL) {
+		if(rec->hash == hash && strcmp(rec->str, name) == 0) {
+			return rec;
+		}
+		idx = (idx + 1) & mask;
+	}
+	return NULL;
+}
+
+// Must be called with lock held
+static void name_insert(struct name_table *tab, struct name_rec *rec) {
+	uint32_t mask = tab->capacity - 1;
+	uint32_t idx  = rec->hash & mask;
+	while(tab->slots[idx]) {
+		idx = (idx + 1) & mask;
+	}
+	__atomic_store_n(&tab->slots[idx], rec, __ATOMIC_RELEASE);
+}
+
+static void *name_alloc(size_t size) {
+	size = (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+	if(arena_used + size <= sizeof(arena)) {
+		void *ret = (uint8_t *)arena + arena_used;
+		arena_used += (uint32_t)size;
+		return ret;
+	}
+	return name_os->malloc(size);
+}
+
+// Publish a table of twice the size once the current one is half full. Must be called with
+// lock held.
+static bool name_grow(void) {
+	struct name_table *old		= table;
+	uint32_t		   capacity = old->capacity * 2;
+	struct name_table *tab =
+		name_os->malloc(sizeof(struct name_table) + sizeof(struct name_rec *) * capacity);
+	if(tab == NULL) {
+		return false;
+	}
+	tab->retired  = old;
+	tab->capacity = capacity;
+	tab->slots	  = (struct name_rec **)(tab + 1);
+	memset(tab->slots, 0, sizeof(struct name_rec *) * capacity);
+	for(uint32_t i = 0; i < old->capacity; i++) {
+		if(old->slots[i]) {
+			name_insert(tab, old->slots[i]);
+		}
+	}
+	__atomic_store_n(&table, tab, __ATOMIC_RELEASE);
+	return true;
+}
+
+// Must be called after fsm_name_init(). Names are referenced instead of copied unless copy is set.
+static const char *name_intern(const char *name, uint32_t *atom, bool copy) {
+	ASSERT(name);
+	ASSERT(lock);
+	size_t			 len;
+	uint32_t		 hash = name_hash(name, &len);
+	struct name_rec *rec  = NULL;
+	name_os->mutex_lock(lock, BLOCKTIME_MAX);
+	rec = name_find(table, name, hash);
+	if(rec == NULL) {
+		if((count + 1) * 2 > table->capacity && !name_grow()) {
+			goto EXIT;
+		}
+		rec = name_alloc(sizeof(struct name_rec) + (copy ? len + 1 : 0));
+		if(rec == NULL) {
+			goto EXIT;
+		}
+		if(copy) {
+			char *str = (char *)(rec + 1);
+			memcpy(str, name, len + 1);
+			name = str;
+		}
+		rec->hash = hash;
+		rec->atom = count++;
+		rec->str  = name;
+		name_insert(table, rec);
+	}
+EXIT:
+	name_os->mutex_unlock(lock);
+	if(rec && atom) {
+		*atom = rec->atom;
+	}
+	return rec ? rec->str : NULL;
+}
+
+/*--- Public function definitions -----------------------------------------------------*/
+
+void fsm_name_init(os_handle_t os) {
+	ASSERT(os);
+	if(lock == NULL) {
+		name_os = os;
+		lock	= os->mutex_init(lock_storage);
+		ASSERT(lock);
+	}
+}
+
+const char *fsm_name_intern(const char *name, uint32_t *atom) {
+	return name_intern(name, atom, true);
+}
+
+const char *fsm_name_intern_static(const char *name, uint32_t *atom) {
+	return name_intern(name, atom, false);
+}
+
+const char *fsm_name_lookup(const char *name, uint32_t *atom) {
+	ASSERT(name);
+	size_t			 len;
+	uint32_t		 hash = name_hash(name, &len);
+	struct name_rec *rec  = name_find(__atomic_load_n(&table, __ATOMIC_ACQUIRE), name, hash);
+	if(rec && atom) {
+		*atom = rec->atom;
+	}
+	return rec ? rec->str : NULL;
+}
+
+const char *fsm_name_find(const char *name) {
+	return fsm_name_lookup(name, NULL);
+}
+
+#ifdef __cplusplus
+}
+#endif
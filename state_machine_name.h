@@ -0,0 +1,87 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+#ifndef __STATEMACHINE_NAME_H__
+#define __STATEMACHINE_NAME_H__
+
+/*--- Public dependencies -------------------------------------------------------------*/
+#include <stdint.h>
+#include "state_machine_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public macros -------------------------------------------------------------------*/
+
+/*--- Public type definitions ---------------------------------------------------------*/
+
+/*--- Public variable declarations ----------------------------------------------------*/
+
+/*--- Public function declarations ----------------------------------------------------*/
+
+/**
+ * @brief Initialize the global name table. Safe to call more than once.
+ *
+ * @param os OS handle used for the table lock and for allocations
+ */
+extern void fsm_name_init(os_handle_t os);
+
+/**
+ * @brief Intern a name. The first call for a string copies it into the name table, every call
+ *        with an equal string returns the same canonical pointer and atom. Interned names live
+ *        until the program ends.
+ *
+ * @param name The name to intern
+ * @param atom Set to the small integer identifying the name, may be NULL
+ * @return const char* The canonical copy of the name, or NULL if it could not be stored
+ */
+extern const char *fsm_name_intern(const char *name, uint32_t *atom);
+
+/**
+ * @brief Intern a name without copying it. Like fsm_name_intern(), but if the name is new the
+ *        table keeps a reference to the caller's string, so it must never change or be freed,
+ *        e.g. a string literal.
+ *
+ * @param name The name to intern
+ * @param atom Set to the small integer identifying the name, may be NULL
+ * @return const char* The canonical pointer of the name, or NULL if it could not be stored
+ */
+extern const char *fsm_name_intern_static(const char *name, uint32_t *atom);
+
+/**
+ * @brief Look up a name without interning it. Lock-free, it does not wait for a concurrent
+ *        fsm_name_intern(). See fsm_name_find() in state_machine.h.
+ *
+ * @param name The name to look up
+ * @param atom Set to the atom of the name if it is found, may be NULL
+ * @return const char* The canonical pointer, or NULL if the name was never interned
+ */
+extern const char *fsm_name_lookup(const char *name, uint32_t *atom);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// __STATEMACHINE_NAME_H__
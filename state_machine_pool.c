@@ -0,0 +1,152 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+/*--- Private dependencies ------------------------------------------------------------*/
+#include "state_machine_pool.h"
+#include <stddef.h>
+#include <string.h>
+
+#include <assert.h>
+#define USE_ASSERT 1
+#if USE_ASSERT
+#define ASSERT(e) assert(e)
+#else
+#define ASSERT(e)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public variable definitions -----------------------------------------------------*/
+
+/*--- Private macros ------------------------------------------------------------------*/
+#define ROUND_UP_8(_n) (((_n) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1))
+
+/*--- Private type definitions --------------------------------------------------------*/
+
+// Placed in front of every block
+struct fsm_pool_block {
+	struct fsm_pool *pool;
+	uint32_t		 refs;
+};
+
+/*--- Private function declarations ---------------------------------------------------*/
+
+/*--- Private variable definitions ----------------------------------------------------*/
+
+/*--- Private function definitions ----------------------------------------------------*/
+
+static inline uint8_t *pool_blocks(struct fsm_pool *pool) {
+	return (uint8_t *)pool + ROUND_UP_8(sizeof(struct fsm_pool));
+}
+
+static inline struct fsm_pool_block *block_header(void *block) {
+	return (struct fsm_pool_block *)((uint8_t *)block - ROUND_UP_8(sizeof(struct fsm_pool_block)));
+}
+
+// Drop a reference to the pool memory, the last one frees it
+static void pool_unref(struct fsm_pool *pool) {
+	if(__atomic_sub_fetch(&pool->users, 1, __ATOMIC_ACQ_REL) == 0) {
+		pool->os->free(pool);
+	}
+}
+
+/*--- Public function definitions -----------------------------------------------------*/
+
+struct fsm_pool *fsm_pool_new(uint32_t block_size, uint32_t number, os_handle_t os) {
+	ASSERT(os);
+	if(block_size == 0 || number == 0 || number > FSM_POOL_MAX_BLOCKS) {
+		return NULL;
+	}
+	block_size				= ROUND_UP_8(block_size);
+	uint32_t		 stride = ROUND_UP_8(sizeof(struct fsm_pool_block)) + block_size;
+	size_t			 size	= ROUND_UP_8(sizeof(struct fsm_pool)) + (size_t)stride * number;
+	struct fsm_pool *pool	= os->malloc(size);
+	if(pool == NULL) {
+		return NULL;
+	}
+	pool->os		 = os;
+	pool->block_size = block_size;
+	pool->stride	 = stride;
+	pool->number	 = number;
+	pool->free_mask	 = number == 32 ? UINT32_MAX : (1u << number) - 1;
+	pool->users		 = 1;
+	for(uint32_t i = 0; i < number; i++) {
+		struct fsm_pool_block *header = (struct fsm_pool_block *)(pool_blocks(pool) + i * stride);
+		header->pool				  = pool;
+		header->refs				  = 0;
+	}
+	return pool;
+}
+
+void fsm_pool_del(struct fsm_pool *pool) {
+	ASSERT(pool);
+	pool_unref(pool);
+}
+
+void *fsm_pool_alloc(struct fsm_pool *pool) {
+	ASSERT(pool);
+	uint32_t mask = __atomic_load_n(&pool->free_mask, __ATOMIC_RELAXED);
+	while(mask) {
+		uint32_t idx = (uint32_t)__builtin_ctz(mask);
+		if(__atomic_compare_exchange_n(&pool->free_mask,
+									   &mask,
+									   mask & ~(1u << idx),
+									   true,
+									   __ATOMIC_ACQUIRE,
+									   __ATOMIC_RELAXED)) {
+			__atomic_add_fetch(&pool->users, 1, __ATOMIC_RELAXED);
+			uint8_t *header = pool_blocks(pool) + (size_t)idx * pool->stride;
+			__atomic_store_n(&((struct fsm_pool_block *)header)->refs, 1, __ATOMIC_RELAXED);
+			return header + ROUND_UP_8(sizeof(struct fsm_pool_block));
+		}
+	}
+	return NULL;
+}
+
+void fsm_pool_retain(void *block) {
+	ASSERT(block);
+	struct fsm_pool_block *header = block_header(block);
+	ASSERT(__atomic_load_n(&header->refs, __ATOMIC_RELAXED) > 0);
+	__atomic_add_fetch(&header->refs, 1, __ATOMIC_RELAXED);
+}
+
+void fsm_pool_release(void *block) {
+	ASSERT(block);
+	struct fsm_pool_block *header = block_header(block);
+	struct fsm_pool		  *pool	  = header->pool;
+	ASSERT(__atomic_load_n(&header->refs, __ATOMIC_RELAXED) > 0);
+	if(__atomic_sub_fetch(&header->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+		return;
+	}
+	uint32_t idx = (uint32_t)(((uint8_t *)header - pool_blocks(pool)) / pool->stride);
+	ASSERT(idx < pool->number);
+	__atomic_fetch_or(&pool->free_mask, 1u << idx, __ATOMIC_RELEASE);
+	pool_unref(pool);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,107 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+#ifndef __STATEMACHINE_POOL_H__
+#define __STATEMACHINE_POOL_H__
+
+/*--- Public dependencies -------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "state_machine_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public macros -------------------------------------------------------------------*/
+#define FSM_POOL_MAX_BLOCKS 32
+
+/*--- Public type definitions ---------------------------------------------------------*/
+
+/**
+ * @brief Pool of up to FSM_POOL_MAX_BLOCKS fixed-size, reference counted blocks. Free blocks are
+ *        tracked in a bitmap that is updated with atomic operations, so blocks can be taken and
+ *        returned from any thread without a lock and without the ABA problem of a free list.
+ *        Every block knows its pool, so a block can be shared by several mailboxes and released
+ *        by whichever holder is last. The pool and its blocks are a single allocation that lives
+ *        until the owner has deleted the pool and the last block has been released.
+ */
+struct fsm_pool {
+	os_handle_t os;
+	uint32_t	block_size;	 // Usable bytes of a block, multiple of 8
+	uint32_t	stride;		 // Distance between blocks, including the block header
+	uint32_t	number;
+	uint32_t	free_mask;	// Bit i is set while block i is free
+	uint32_t	users;		// Blocks in use, plus one until the owner deletes the pool
+};
+
+/*--- Public variable declarations ----------------------------------------------------*/
+
+/*--- Public function declarations ----------------------------------------------------*/
+
+/**
+ * @brief Allocate a pool with all its blocks.
+ *
+ * @param block_size Minimum size of a block, rounded up to a multiple of 8
+ * @param number Number of blocks, 1 to FSM_POOL_MAX_BLOCKS
+ * @param os OS handle used for allocation
+ * @return struct fsm_pool* The pool, NULL on bad parameters or if out of memory
+ */
+extern struct fsm_pool *fsm_pool_new(uint32_t block_size, uint32_t number, os_handle_t os);
+
+/**
+ * @brief Drop the owner's reference to a pool. The memory is released as soon as no block is in
+ *        use, blocks still held by mailboxes stay valid until they are released.
+ *
+ * @param pool The pool to delete
+ */
+extern void fsm_pool_del(struct fsm_pool *pool);
+
+/**
+ * @brief Take a free block with a reference count of one. Lock-free.
+ *
+ * @param pool The pool
+ * @return void* The block, or NULL if all blocks are in use
+ */
+extern void *fsm_pool_alloc(struct fsm_pool *pool);
+
+/**
+ * @brief Add a reference to a block taken with fsm_pool_alloc(). Lock-free.
+ *
+ * @param block The block
+ */
+extern void fsm_pool_retain(void *block);
+
+/**
+ * @brief Drop a reference to a block. The last reference returns the block to its pool. Lock-free.
+ *
+ * @param block The block
+ */
+extern void fsm_pool_release(void *block);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// __STATEMACHINE_POOL_H__
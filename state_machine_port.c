@@ -24,16 +24,22 @@
 
 /*--- Private dependencies ------------------------------------------------------------*/
 #include "state_machine_port.h"
+
+#if !FSM_PORT_POSIX
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 
 #include "systime.h"
+#include "esp_timer.h"
 #include "logger.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "freertos/task.h"
 #include "freertos/semphr.h"
+#include "esp_freertos_hooks.h"
 
 #define DEBUG_PRINT 1
 #include "debug_print.h"
@@ -47,30 +53,59 @@ extern "C" {
 /*--- Public variable definitions -----------------------------------------------------*/
 
 /*--- Private macros ------------------------------------------------------------------*/
+#define THREAD_STACK_SIZE 4096
+#define THREAD_PRIORITY	  (tskIDLE_PRIORITY + 5)
+#define SEM_MAX_COUNT	  (0x7FFF)	// Further posts are dropped, waiters just wake up once more
 
 /*--- Private type definitions --------------------------------------------------------*/
 
+// Static mutexes need configSUPPORT_STATIC_ALLOCATION, which ESP-IDF enables
+_Static_assert(sizeof(StaticSemaphore_t) <= FSM_STATIC_MUTEX_SIZE, "Mutex storage too small");
+
+// FreeRTOS tasks cannot be joined, a binary semaphore is given when the entry returns
+struct freertos_thread {
+	TaskHandle_t	  task;
+	SemaphoreHandle_t done;
+	void (*entry)(void* arg);
+	void* arg;
+};
+
 /*--- Private function declarations ---------------------------------------------------*/
 uint32_t fsm_port_get_systime(void);
+uint32_t fsm_port_get_systime_us(void);
+void	 fsm_port_delay(uint32_t ms);
 void*	 fsm_port_malloc(size_t size);
 void	 fsm_port_free(void* buf);
 void*	 fsm_port_mutex_create(void);
 bool	 fsm_port_mutex_lock(void* mutex, uint32_t blocktime);
 bool	 fsm_port_mutex_unlock(void* mutex);
 bool	 fsm_port_mutex_destroy(void* mutex);
+void*	 fsm_port_mutex_init(void* storage);
+bool	 fsm_port_mutex_deinit(void* mutex);
 void*	 fsm_port_queue_create(uint32_t length, uint32_t item_size);
 bool	 fsm_port_queue_send(void* queue, void* item, uint32_t blocktime);
 bool	 fsm_port_queue_receive(void* queue, void* dst, uint32_t blocktime);
 bool	 fsm_port_queue_clear(void* queue);
+uint32_t fsm_port_queue_count(void* queue);
 bool	 fsm_port_queue_destroy(void* queue);
+void*	 fsm_port_sem_create(void);
+bool	 fsm_port_sem_destroy(void* sem);
+bool	 fsm_port_sem_post(void* sem);
+bool	 fsm_port_sem_wait(void* sem, uint32_t blocktime);
+void*	 fsm_port_thread_create(const char* name, void (*entry)(void* arg), void* arg);
+bool	 fsm_port_thread_join(void* thread);
 void	 fsm_port_print(int level, int line, const char* filename, char* fmt, ...);
 
 /*--- Private variable definitions ----------------------------------------------------*/
 const struct os_handle fsm_port_os_handle = { .uptime_ms	 = fsm_port_get_systime,
+											  .uptime_us	 = fsm_port_get_systime_us,
+											  .delay_ms		 = fsm_port_delay,
 											  .malloc		 = fsm_port_malloc,
 											  .free			 = fsm_port_free,
 											  .mutex_create	 = fsm_port_mutex_create,
 											  .mutex_destroy = fsm_port_mutex_destroy,
+											  .mutex_init	 = fsm_port_mutex_init,
+											  .mutex_deinit	 = fsm_port_mutex_deinit,
 											  .mutex_lock	 = fsm_port_mutex_lock,
 											  .mutex_unlock	 = fsm_port_mutex_unlock,
 											  .queue_create	 = fsm_port_queue_create,
@@ -78,15 +113,52 @@ const struct os_handle fsm_port_os_handle = { .uptime_ms	 = fsm_port_get_systime
 											  .queue_send	 = fsm_port_queue_send,
 											  .queue_receive = fsm_port_queue_receive,
 											  .queue_clear	 = fsm_port_queue_clear,
+											  .queue_count	 = fsm_port_queue_count,
+											  .sem_create	 = fsm_port_sem_create,
+											  .sem_destroy	 = fsm_port_sem_destroy,
+											  .sem_post		 = fsm_port_sem_post,
+											  .sem_wait		 = fsm_port_sem_wait,
+											  .thread_create = fsm_port_thread_create,
+											  .thread_join	 = fsm_port_thread_join,
 											  .print		 = fsm_port_print };
 
+static uint32_t heap_calls		  = 0;
+static bool		log_drain_started = false;	// Whether log_drain_hook is registered
+
 /*--- Private function definitions ----------------------------------------------------*/
 
+static inline void heap_call_count(void) {
+	__atomic_add_fetch(&heap_calls, 1, __ATOMIC_RELAXED);
+}
+
+static void thread_trampoline(void* arg) {
+	struct freertos_thread* t = arg;
+	t->entry(t->arg);
+	xSemaphoreGive(t->done);
+	vTaskDelete(NULL);
+}
+
+// Prints deferred log messages on the idle task, whose stack must fit the logger
+static bool log_drain_hook(void) {
+	fsm_port_log_drain_step();
+	return true;  // Nothing more to do before the next tick
+}
+
 uint32_t fsm_port_get_systime(void) {
 	return uptime_ms_get();
 }
 
+uint32_t fsm_port_get_systime_us(void) {
+	return (uint32_t)esp_timer_get_time();
+}
+
+void fsm_port_delay(uint32_t ms) {
+	TickType_t ticks = pdMS_TO_TICKS(ms);
+	vTaskDelay(ticks ? ticks : 1);
+}
+
 void* fsm_port_malloc(size_t size) {
+	heap_call_count();
 	void* ret = malloc(size);
 	memset(ret, 0, size);
 #if DEBUG_MEMORY
@@ -96,6 +168,10 @@ void* fsm_port_malloc(size_t size) {
 }
 
 void fsm_port_free(void* buf) {
+	if(buf == NULL) {
+		return;	 // Not a heap operation
+	}
+	heap_call_count();
 #if DEBUG_MEMORY
 	fsm_port_print(FSM_DBG_LVL_RAW, "[FSM free] %p" NL, buf);
 #endif
@@ -103,6 +179,7 @@ void fsm_port_free(void* buf) {
 }
 
 void* fsm_port_mutex_create(void) {
+	heap_call_count();
 	void* ret = xSemaphoreCreateMutex();
 #if DEBUG_MEMORY
 	fsm_port_print(FSM_DBG_LVL_RAW, "[FSM mutex create] %p" NL, ret);
@@ -111,6 +188,7 @@ void* fsm_port_mutex_create(void) {
 }
 
 bool fsm_port_mutex_destroy(void* mutex) {
+	heap_call_count();
 #if DEBUG_MEMORY
 	fsm_port_print(FSM_DBG_LVL_RAW, "[FSM mutex destroy] %p" NL, mutex);
 #endif
@@ -118,6 +196,16 @@ bool fsm_port_mutex_destroy(void* mutex) {
 	return true;
 }
 
+// Static mutexes live in caller storage and do not count as heap calls
+void* fsm_port_mutex_init(void* storage) {
+	return xSemaphoreCreateMutexStatic((StaticSemaphore_t*)storage);
+}
+
+bool fsm_port_mutex_deinit(void* mutex) {
+	vSemaphoreDelete(mutex);  // Storage of static semaphores is not freed
+	return true;
+}
+
 bool fsm_port_mutex_lock(void* mutex, uint32_t blocktime) {
 	if(blocktime == BLOCKTIME_MAX) {
 		blocktime = portMAX_DELAY;
@@ -138,6 +226,7 @@ bool fsm_port_mutex_unlock(void* mutex) {
 }
 
 void* fsm_port_queue_create(uint32_t length, uint32_t item_size) {
+	heap_call_count();
 	void* ret = xQueueCreate(length, item_size);
 #if DEBUG_MEMORY
 	fsm_port_print(FSM_DBG_LVL_RAW, "[FSM queue create] %p" NL, ret);
@@ -175,7 +264,12 @@ bool fsm_port_queue_clear(void* queue) {
 	return false;
 }
 
+uint32_t fsm_port_queue_count(void* queue) {
+	return (uint32_t)uxQueueMessagesWaiting((QueueHandle_t)queue);
+}
+
 bool fsm_port_queue_destroy(void* queue) {
+	heap_call_count();
 #if DEBUG_MEMORY
 	fsm_port_print(FSM_DBG_LVL_RAW, "[FSM queue destroy] %p" NL, queue);
 #endif
@@ -183,7 +277,74 @@ bool fsm_port_queue_destroy(void* queue) {
 	return true;
 }
 
+void* fsm_port_sem_create(void) {
+	heap_call_count();
+	return xSemaphoreCreateCounting(SEM_MAX_COUNT, 0);
+}
+
+bool fsm_port_sem_destroy(void* sem) {
+	heap_call_count();
+	vSemaphoreDelete(sem);
+	return true;
+}
+
+bool fsm_port_sem_post(void* sem) {
+	if(xPortInIsrContext()) {
+		BaseType_t woken = pdFALSE;
+		xSemaphoreGiveFromISR((SemaphoreHandle_t)sem, &woken);
+		portYIELD_FROM_ISR(woken);
+		return true;
+	}
+	xSemaphoreGive((SemaphoreHandle_t)sem);
+	return true;
+}
+
+bool fsm_port_sem_wait(void* sem, uint32_t blocktime) {
+	TickType_t ticks = blocktime == BLOCKTIME_MAX ? portMAX_DELAY : pdMS_TO_TICKS(blocktime);
+	if(blocktime != 0 && blocktime != BLOCKTIME_MAX && ticks == 0) {
+		ticks = 1;
+	}
+	return xSemaphoreTake((SemaphoreHandle_t)sem, ticks) == pdTRUE;
+}
+
+void* fsm_port_thread_create(const char* name, void (*entry)(void* arg), void* arg) {
+	heap_call_count();
+	struct freertos_thread* t = malloc(sizeof(struct freertos_thread));
+	if(t == NULL) {
+		return NULL;
+	}
+	t->entry = entry;
+	t->arg	 = arg;
+	t->done	 = xSemaphoreCreateBinary();
+	if(t->done == NULL) {
+		free(t);
+		return NULL;
+	}
+	if(xTaskCreate(thread_trampoline, name, THREAD_STACK_SIZE, t, THREAD_PRIORITY, &t->task)
+	   != pdPASS) {
+		vSemaphoreDelete(t->done);
+		free(t);
+		return NULL;
+	}
+#if DEBUG_MEMORY
+	fsm_port_print(FSM_DBG_LVL_RAW, "[FSM thread create] %s %p" NL, name, t);
+#endif
+	return t;
+}
+
+bool fsm_port_thread_join(void* thread) {
+	heap_call_count();
+	struct freertos_thread* t = thread;
+	xSemaphoreTake(t->done, portMAX_DELAY);
+	vSemaphoreDelete(t->done);
+	free(t);
+	return true;
+}
+
 void fsm_port_print(int level, int line, const char* filename, char* fmt, ...) {
+	if(level > __atomic_load_n(&fsm_port_print_level, __ATOMIC_RELAXED)) {
+		return;	 // Filtered before formatting
+	}
 	char	strbuf[201] = "unparsed";
 	va_list args;
 	va_start(args, fmt);
@@ -211,6 +372,29 @@ void fsm_port_print(int level, int line, const char* filename, char* fmt, ...) {
 
 /*--- Public function definitions -----------------------------------------------------*/
 
+uint32_t fsm_port_heap_calls(void) {
+	return __atomic_load_n(&heap_calls, __ATOMIC_RELAXED);
+}
+
+void fsm_port_log_drain_start(void) {
+	if(log_drain_started == false) {
+		log_drain_started = esp_register_freertos_idle_hook(log_drain_hook) == ESP_OK;
+	}
+}
+
+void fsm_port_log_drain_stop(void) {
+	if(log_drain_started) {
+		esp_deregister_freertos_idle_hook(log_drain_hook);
+		log_drain_started = false;
+	}
+}
+
+void fsm_port_log_drain_wake(void) {
+	// The idle hook runs whenever the CPU has nothing else to do, it needs no wakeup
+}
+
 #ifdef __cplusplus
 }
 #endif
+
+#endif	// !FSM_PORT_POSIX
@@ -35,14 +35,28 @@ extern "C" {
 
 /*--- Public macros -------------------------------------------------------------------*/
 
+/**
+ * @brief Select the OS backend at compile time. Both port sources can be added to the build,
+ *        only the selected one provides fsm_port_os_handle.
+ *        0: FreeRTOS/ESP-IDF (state_machine_port.c)
+ *        1: POSIX threads and CLOCK_MONOTONIC (state_machine_port_posix.c), for Linux hosts
+ */
+#ifndef FSM_PORT_POSIX
+#define FSM_PORT_POSIX 0
+#endif
+
 /*--- Public type definitions ---------------------------------------------------------*/
 
 struct os_handle {
 	uint32_t (*uptime_ms)(void);
+	uint32_t (*uptime_us)(void);
+	void (*delay_ms)(uint32_t ms);
 	void *(*malloc)(size_t size);
 	void (*free)(void *buf);
 	void *(*mutex_create)(void);
 	bool (*mutex_destroy)(void *mutex);
+	void *(*mutex_init)(void *storage);	 // Create in FSM_STATIC_MUTEX_SIZE bytes of storage
+	bool (*mutex_deinit)(void *mutex);
 	bool (*mutex_lock)(void *mutex, uint32_t blocktime);
 	bool (*mutex_unlock)(void *mutex);
 	void *(*queue_create)(uint32_t length, uint32_t item_size);
@@ -50,6 +64,13 @@ struct os_handle {
 	bool (*queue_send)(void *queue, void *item, uint32_t blocktime);
 	bool (*queue_receive)(void *queue, void *dst, uint32_t blocktime);
 	bool (*queue_clear)(void *queue);
+	uint32_t (*queue_count)(void *queue);
+	void *(*sem_create)(void);	// Counting semaphore, starts at 0
+	bool (*sem_destroy)(void *sem);
+	bool (*sem_post)(void *sem);  // Async-signal-safe and usable from interrupts
+	bool (*sem_wait)(void *sem, uint32_t blocktime);
+	void *(*thread_create)(const char *name, void (*entry)(void *arg), void *arg);
+	bool (*thread_join)(void *thread);
 	void (*print)(int level, int line, const char *filename, char *fmt, ...);
 };
 typedef struct os_handle *os_handle_t;
@@ -64,21 +85,189 @@ typedef enum fsm_dbg_lvl {
 
 #define NL "\r\n"
 
-#define OS_PRINT(_os, fmt, ...)                                                             \
-	do {                                                                                    \
-		((os_handle_t)_os)->print(FSM_DBG_LVL_RAW, __LINE__, __FILE__, fmt, ##__VA_ARGS__); \
+/**
+ * @brief Most verbose level compiled in. Messages above it are removed by the compiler, messages
+ *        above the level of fsm_port_set_print_level() are dropped before they are formatted.
+ */
+#ifndef FSM_LOG_LEVEL
+#define FSM_LOG_LEVEL FSM_DBG_LVL_RAW
+#endif
+
+/**
+ * @brief Whether OS_LOG() defers formatting to fsm_port_log_flush(). Otherwise it prints at once
+ *        like OS_PRINT().
+ */
+#ifndef FSM_LOG_DEFERRED
+#define FSM_LOG_DEFERRED 1
+#endif
+
+#define FSM_LOG_MAX_ARGS 6
+
+#define FSM_LOG_ENABLED(_level)     \
+	((_level) <= FSM_LOG_LEVEL \
+	 && (_level) <= __atomic_load_n(&fsm_port_print_level, __ATOMIC_RELAXED))
+
+#define OS_PRINT(_os, fmt, ...)                                                                 \
+	do {                                                                                        \
+		if(FSM_LOG_ENABLED(FSM_DBG_LVL_RAW)) {                                                  \
+			((os_handle_t)_os)->print(FSM_DBG_LVL_RAW, __LINE__, __FILE__, fmt, ##__VA_ARGS__); \
+		}                                                                                       \
+	} while(0)
+
+#define OS_PRINT_ERR(_os, fmt, ...)                                                             \
+	do {                                                                                        \
+		if(FSM_LOG_ENABLED(FSM_DBG_LVL_ERR)) {                                                  \
+			((os_handle_t)_os)->print(FSM_DBG_LVL_ERR, __LINE__, __FILE__, fmt, ##__VA_ARGS__); \
+		}                                                                                       \
 	} while(0)
 
-#define OS_PRINT_ERR(_os, fmt, ...)                                                         \
+// Up to FSM_LOG_MAX_ARGS arguments, each converted to uintptr_t and followed by a comma
+#define FSM_LOG_CAT_(_a, _b) _a##_b
+#define FSM_LOG_CAT(_a, _b)	 FSM_LOG_CAT_(_a, _b)
+#define FSM_LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _n, ...) _n
+#define FSM_LOG_NARGS(...)	   FSM_LOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define FSM_LOG_ARGS_0()
+#define FSM_LOG_ARGS_1(_a)	   (uintptr_t)(_a),
+#define FSM_LOG_ARGS_2(_a, _b) (uintptr_t)(_a), FSM_LOG_ARGS_1(_b)
+#define FSM_LOG_ARGS_3(_a, ...) (uintptr_t)(_a), FSM_LOG_ARGS_2(__VA_ARGS__)
+#define FSM_LOG_ARGS_4(_a, ...) (uintptr_t)(_a), FSM_LOG_ARGS_3(__VA_ARGS__)
+#define FSM_LOG_ARGS_5(_a, ...) (uintptr_t)(_a), FSM_LOG_ARGS_4(__VA_ARGS__)
+#define FSM_LOG_ARGS_6(_a, ...) (uintptr_t)(_a), FSM_LOG_ARGS_5(__VA_ARGS__)
+#define FSM_LOG_ARGS(...)		FSM_LOG_CAT(FSM_LOG_ARGS_, FSM_LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+/**
+ * @brief Log from hot paths and with locks held. Only the format pointer and the raw arguments
+ *        are queued, formatting and printing happen in fsm_port_log_flush(). Formats may only
+ *        use integer and pointer conversions, and strings passed to %s must stay valid until
+ *        the message is flushed, e.g. interned state names.
+ */
+#if FSM_LOG_DEFERRED
+#define OS_LOG(_os, _level, fmt, ...)                                                       \
 	do {                                                                                    \
-		((os_handle_t)_os)->print(FSM_DBG_LVL_ERR, __LINE__, __FILE__, fmt, ##__VA_ARGS__); \
+		if(FSM_LOG_ENABLED(_level)) {                                                       \
+			const uintptr_t _args[FSM_LOG_MAX_ARGS + 1] = { FSM_LOG_ARGS(__VA_ARGS__) 0 };  \
+			fsm_port_log((os_handle_t)(_os), (_level), __LINE__, __FILE__, (fmt), _args);   \
+		}                                                                                   \
 	} while(0)
+#else
+#define OS_LOG(_os, _level, fmt, ...)                                                       \
+	do {                                                                                    \
+		if(FSM_LOG_ENABLED(_level)) {                                                       \
+			((os_handle_t)_os)->print((_level), __LINE__, __FILE__, fmt, ##__VA_ARGS__);    \
+		}                                                                                   \
+	} while(0)
+#endif
+
+#define OS_LOG_ERR(_os, fmt, ...) OS_LOG(_os, FSM_DBG_LVL_ERR, fmt, ##__VA_ARGS__)
 
 /*--- Public variable declarations ----------------------------------------------------*/
 extern const struct os_handle fsm_port_os_handle;
+extern int					  fsm_port_print_level;  // Read by the print macros, see below
 
 /*--- Public function declarations ----------------------------------------------------*/
 
+/**
+ * @brief Get the number of heap operations performed through fsm_port_os_handle so far. Every
+ *        malloc, free of a non-NULL pointer, mutex/queue create and destroy counts as one call.
+ *        Take the difference of two readings to check a code path for heap use.
+ *
+ * @return uint32_t The heap call counter
+ */
+extern uint32_t fsm_port_heap_calls(void);
+
+/**
+ * @brief Drop messages above the given level before they are formatted or queued.
+ *
+ * @param level The most verbose level to print, FSM_DBG_LVL_OFF silences the library
+ */
+extern void fsm_port_set_print_level(fsm_dbg_lvl_t level);
+
+/**
+ * @brief Queue a message of OS_LOG() without formatting it. Lock-free, the message is dropped if
+ *        the log queue is full.
+ *
+ * @param os OS handle whose print function formats the message
+ * @param level FSM_DBG_LVL_* of the message
+ * @param line Source line
+ * @param filename Source file, must be a string literal
+ * @param fmt Format string, must be a string literal
+ * @param args FSM_LOG_MAX_ARGS arguments, unused ones are ignored
+ */
+extern void fsm_port_log(os_handle_t	  os,
+						 int			  level,
+						 int			  line,
+						 const char		 *filename,
+						 const char		 *fmt,
+						 const uintptr_t *args);
+
+/**
+ * @brief Format and print the messages queued by OS_LOG(). Idle executor workers, fsm_deinit()
+ *        and the port drain call it, applications may call it from their own idle hook. Only one
+ *        thread flushes at a time, concurrent calls return at once.
+ *
+ * @return uint32_t Number of messages printed
+ */
+extern uint32_t fsm_port_log_flush(void);
+
+/**
+ * @brief Same as fsm_port_log_flush(), but wait for a flush running in another thread first, so
+ *        that no queued message still refers to memory the caller is about to free.
+ *
+ * @return uint32_t Number of messages printed by this call
+ */
+extern uint32_t fsm_port_log_sync(void);
+
+/**
+ * @brief Start or stop printing OS_LOG() messages in the background, off by default. The POSIX
+ *        port runs a thread that sleeps until a message is queued, ESP-IDF registers a FreeRTOS
+ *        idle hook. Applications that neither run an executor nor flush from their own idle hook
+ *        should start it. Stopping joins the thread or removes the hook and waits for a running
+ *        drain step. Do not call it from several threads at once.
+ *
+ * @param enable True to start the drain, false to stop it
+ */
+extern void fsm_port_log_drain(bool enable);
+
+/**
+ * @brief Port internals: start the drain of the port, it calls fsm_port_log_drain_step() when
+ *        messages may be queued. Does nothing if it is running.
+ */
+extern void fsm_port_log_drain_start(void);
+
+/**
+ * @brief Port internals: stop the drain of the port. Does nothing if it is not running.
+ */
+extern void fsm_port_log_drain_stop(void);
+
+/**
+ * @brief Port internals: called by fsm_port_log() after queuing a message while the drain runs.
+ *        Lock-free, async-signal-safe and usable from interrupts.
+ */
+extern void fsm_port_log_drain_wake(void);
+
+/**
+ * @brief Port internals: flush from the port drain, does nothing while the drain is stopped.
+ *
+ * @return uint32_t Number of messages printed
+ */
+extern uint32_t fsm_port_log_drain_step(void);
+
+/**
+ * @brief Get the number of OS_LOG() messages lost because the log queue was full.
+ *
+ * @return uint32_t The counter, it wraps around
+ */
+extern uint32_t fsm_port_log_dropped(void);
+
+#if FSM_PORT_POSIX
+/**
+ * @brief Same as fsm_port_set_print_level().
+ *
+ * @param level The most verbose level to print, FSM_DBG_LVL_OFF silences the port
+ */
+extern void fsm_port_posix_set_print_level(fsm_dbg_lvl_t level);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
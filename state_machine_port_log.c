@@ -0,0 +1,201 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+/*--- Private dependencies ------------------------------------------------------------*/
+#include "state_machine_port.h"
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public variable definitions -----------------------------------------------------*/
+int fsm_port_print_level = FSM_DBG_LVL_RAW;
+
+/*--- Private macros ------------------------------------------------------------------*/
+#define LOG_QUEUE_LENGTH 64	 // Must be a power of two
+#define LOG_QUEUE_MASK	 (LOG_QUEUE_LENGTH - 1)
+
+/*--- Private type definitions --------------------------------------------------------*/
+
+// Cells of a bounded multi-producer queue, seq tells producers and the flusher whose turn it is.
+// seq is stored minus the cell index, so that the zeroed static storage is an empty queue.
+struct log_cell {
+	uint32_t	seq;
+	int			level;
+	int			line;
+	os_handle_t os;
+	const char *filename;
+	const char *fmt;
+	uintptr_t	args[FSM_LOG_MAX_ARGS];
+};
+
+_Static_assert((LOG_QUEUE_LENGTH & LOG_QUEUE_MASK) == 0, "LOG_QUEUE_LENGTH must be a power of two");
+
+/*--- Private function declarations ---------------------------------------------------*/
+
+/*--- Private variable definitions ----------------------------------------------------*/
+static struct log_cell log_cells[LOG_QUEUE_LENGTH];
+static uint32_t		   log_head		= 0;  // Next position to write, advanced by producers
+static uint32_t		   log_tail		= 0;  // Next position to read, advanced by the flusher
+static uint32_t		   log_dropped	= 0;
+static uint32_t		   log_reported = 0;  // Drops already reported by the flusher
+static bool			   log_flushing = false;
+static bool			   log_drain	= false;  // Whether the port drain may flush
+
+/*--- Private function definitions ----------------------------------------------------*/
+
+/**
+ * @brief Print the queued messages unless another thread is flushing.
+ *
+ * @param drain Called by the port drain, which must not flush while paused
+ * @param number Set to the number of messages printed
+ * @return bool False if another thread is flushing
+ */
+static bool log_flush(bool drain, uint32_t *number) {
+	*number = 0;
+	if(__atomic_exchange_n(&log_flushing, true, __ATOMIC_SEQ_CST)) {
+		return false;
+	}
+	// Pairs with fsm_port_log_drain(false), which clears log_drain before it waits for us
+	if(drain && __atomic_load_n(&log_drain, __ATOMIC_SEQ_CST) == false) {
+		__atomic_store_n(&log_flushing, false, __ATOMIC_RELEASE);
+		return true;
+	}
+	for(;;) {
+		uint32_t		 index = log_tail & LOG_QUEUE_MASK;
+		struct log_cell *cell  = &log_cells[index];
+		if(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) + index != log_tail + 1) {
+			break;	// Empty, or the producer is still writing the cell
+		}
+		struct log_cell msg = *cell;
+		__atomic_store_n(&cell->seq, log_tail + LOG_QUEUE_LENGTH - index, __ATOMIC_RELEASE);
+		log_tail++;
+		msg.os->print(msg.level,
+					  msg.line,
+					  msg.filename,
+					  (char *)msg.fmt,
+					  msg.args[0],
+					  msg.args[1],
+					  msg.args[2],
+					  msg.args[3],
+					  msg.args[4],
+					  msg.args[5]);
+		(*number)++;
+	}
+	uint32_t dropped = __atomic_load_n(&log_dropped, __ATOMIC_RELAXED);
+	if(dropped != log_reported) {
+		os_handle_t os = (os_handle_t)&fsm_port_os_handle;
+		OS_PRINT_ERR(os, "%lu log messages dropped", (unsigned long)(dropped - log_reported));
+		log_reported = dropped;
+	}
+	__atomic_store_n(&log_flushing, false, __ATOMIC_RELEASE);
+	return true;
+}
+
+/*--- Public function definitions -----------------------------------------------------*/
+
+void fsm_port_set_print_level(fsm_dbg_lvl_t level) {
+	__atomic_store_n(&fsm_port_print_level, (int)level, __ATOMIC_RELAXED);
+}
+
+void fsm_port_log(os_handle_t	  os,
+				  int			  level,
+				  int			  line,
+				  const char	 *filename,
+				  const char	 *fmt,
+				  const uintptr_t *args) {
+	struct log_cell *cell;
+	uint32_t		 pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+	for(;;) {
+		cell		 = &log_cells[pos & LOG_QUEUE_MASK];
+		uint32_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) + (pos & LOG_QUEUE_MASK);
+		int32_t	 dif = (int32_t)(seq - pos);
+		if(dif == 0) {
+			if(__atomic_compare_exchange_n(
+				   &log_head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if(dif < 0) {
+			__atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+			return;	 // Full
+		} else {
+			pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+		}
+	}
+	cell->level	   = level;
+	cell->line	   = line;
+	cell->os	   = os;
+	cell->filename = filename;
+	cell->fmt	   = fmt;
+	memcpy(cell->args, args, sizeof(cell->args));
+	__atomic_store_n(&cell->seq, pos + 1 - (pos & LOG_QUEUE_MASK), __ATOMIC_RELEASE);
+	if(__atomic_load_n(&log_drain, __ATOMIC_RELAXED)) {
+		fsm_port_log_drain_wake();
+	}
+}
+
+uint32_t fsm_port_log_flush(void) {
+	uint32_t number;
+	log_flush(false, &number);
+	return number;
+}
+
+uint32_t fsm_port_log_sync(void) {
+	uint32_t	number;
+	os_handle_t os = (os_handle_t)&fsm_port_os_handle;
+	while(log_flush(false, &number) == false) {
+		os->delay_ms(1);
+	}
+	return number;
+}
+
+uint32_t fsm_port_log_drain_step(void) {
+	uint32_t number;
+	log_flush(true, &number);
+	return number;
+}
+
+void fsm_port_log_drain(bool enable) {
+	__atomic_store_n(&log_drain, enable, __ATOMIC_SEQ_CST);
+	if(enable) {
+		fsm_port_log_drain_start();
+		return;
+	}
+	fsm_port_log_drain_stop();
+	// A drain step that saw draining enabled may still be printing
+	os_handle_t os = (os_handle_t)&fsm_port_os_handle;
+	while(__atomic_load_n(&log_flushing, __ATOMIC_SEQ_CST)) {
+		os->delay_ms(1);
+	}
+}
+
+uint32_t fsm_port_log_dropped(void) {
+	return __atomic_load_n(&log_dropped, __ATOMIC_RELAXED);
+}
+
+#ifdef __cplusplus
+}
+#endif
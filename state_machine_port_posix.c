@@ -0,0 +1,552 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+/*--- Private dependencies ------------------------------------------------------------*/
+#include "state_machine_port.h"
+
+#if FSM_PORT_POSIX
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#define DEBUG_MEMORY 0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public variable definitions -----------------------------------------------------*/
+
+/*--- Private macros ------------------------------------------------------------------*/
+
+/*--- Private type definitions --------------------------------------------------------*/
+
+_Static_assert(sizeof(pthread_mutex_t) <= FSM_STATIC_MUTEX_SIZE, "Mutex storage too small");
+
+// Bounded ring queue. Waiter counters let the fast path skip condvar signalling when
+// nobody is blocked on the other side.
+struct posix_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t	not_empty;
+	pthread_cond_t	not_full;
+	uint32_t		length;
+	uint32_t		item_size;
+	uint32_t		head;
+	uint32_t		count;
+	uint32_t		rx_waiting;
+	uint32_t		tx_waiting;
+	uint8_t			buf[];
+};
+
+struct posix_thread {
+	pthread_t id;
+	void (*entry)(void *arg);
+	void *arg;
+};
+
+/*--- Private function declarations ---------------------------------------------------*/
+uint32_t fsm_port_get_systime(void);
+uint32_t fsm_port_get_systime_us(void);
+void	 fsm_port_delay(uint32_t ms);
+void	*fsm_port_malloc(size_t size);
+void	 fsm_port_free(void *buf);
+void	*fsm_port_mutex_create(void);
+bool	 fsm_port_mutex_lock(void *mutex, uint32_t blocktime);
+bool	 fsm_port_mutex_unlock(void *mutex);
+bool	 fsm_port_mutex_destroy(void *mutex);
+void	*fsm_port_mutex_init(void *storage);
+bool	 fsm_port_mutex_deinit(void *mutex);
+void	*fsm_port_queue_create(uint32_t length, uint32_t item_size);
+bool	 fsm_port_queue_send(void *queue, void *item, uint32_t blocktime);
+bool	 fsm_port_queue_receive(void *queue, void *dst, uint32_t blocktime);
+bool	 fsm_port_queue_clear(void *queue);
+uint32_t fsm_port_queue_count(void *queue);
+bool	 fsm_port_queue_destroy(void *queue);
+void	*fsm_port_sem_create(void);
+bool	 fsm_port_sem_destroy(void *sem);
+bool	 fsm_port_sem_post(void *sem);
+bool	 fsm_port_sem_wait(void *sem, uint32_t blocktime);
+void	*fsm_port_thread_create(const char *name, void (*entry)(void *arg), void *arg);
+bool	 fsm_port_thread_join(void *thread);
+void	 fsm_port_print(int level, int line, const char *filename, char *fmt, ...);
+
+/*--- Private variable definitions ----------------------------------------------------*/
+const struct os_handle fsm_port_os_handle = { .uptime_ms	 = fsm_port_get_systime,
+											  .uptime_us	 = fsm_port_get_systime_us,
+											  .delay_ms		 = fsm_port_delay,
+											  .malloc		 = fsm_port_malloc,
+											  .free			 = fsm_port_free,
+											  .mutex_create	 = fsm_port_mutex_create,
+											  .mutex_destroy = fsm_port_mutex_destroy,
+											  .mutex_init	 = fsm_port_mutex_init,
+											  .mutex_deinit	 = fsm_port_mutex_deinit,
+											  .mutex_lock	 = fsm_port_mutex_lock,
+											  .mutex_unlock	 = fsm_port_mutex_unlock,
+											  .queue_create	 = fsm_port_queue_create,
+											  .queue_destroy = fsm_port_queue_destroy,
+											  .queue_send	 = fsm_port_queue_send,
+											  .queue_receive = fsm_port_queue_receive,
+											  .queue_clear	 = fsm_port_queue_clear,
+											  .queue_count	 = fsm_port_queue_count,
+											  .sem_create	 = fsm_port_sem_create,
+											  .sem_destroy	 = fsm_port_sem_destroy,
+											  .sem_post		 = fsm_port_sem_post,
+											  .sem_wait		 = fsm_port_sem_wait,
+											  .thread_create = fsm_port_thread_create,
+											  .thread_join	 = fsm_port_thread_join,
+											  .print		 = fsm_port_print };
+
+static uint32_t heap_calls			= 0;
+static void	   *log_drain_thread	= NULL;
+static void	   *log_drain_sem		= NULL;	 // Kept once created, producers may still post it
+static bool		log_drain_sleeping	= false;
+static bool		log_drain_stopping	= false;
+
+/*--- Private function definitions ----------------------------------------------------*/
+
+static inline void heap_call_count(void) {
+	__atomic_add_fetch(&heap_calls, 1, __ATOMIC_RELAXED);
+}
+
+static void *thread_trampoline(void *arg) {
+	struct posix_thread *t = arg;
+	t->entry(t->arg);
+	return NULL;
+}
+
+// Prints deferred log messages, sleeping on log_drain_sem while the log queue is empty
+static void log_drain_main(void *arg) {
+	(void)arg;
+	while(__atomic_load_n(&log_drain_stopping, __ATOMIC_ACQUIRE) == false) {
+		fsm_port_log_drain_step();
+		__atomic_store_n(&log_drain_sleeping, true, __ATOMIC_SEQ_CST);
+		// Pairs with the fence in fsm_port_log_drain_wake(), a message queued before the flag
+		// was set is seen by the second step
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(fsm_port_log_drain_step() == 0
+		   && __atomic_load_n(&log_drain_stopping, __ATOMIC_ACQUIRE) == false) {
+			fsm_port_sem_wait(log_drain_sem, BLOCKTIME_MAX);
+		}
+		__atomic_store_n(&log_drain_sleeping, false, __ATOMIC_RELAXED);
+	}
+}
+
+// Convert a relative blocktime in milliseconds to an absolute deadline on the given clock
+static void deadline_get(clockid_t clock, uint32_t blocktime, struct timespec *deadline) {
+	clock_gettime(clock, deadline);
+	deadline->tv_sec += blocktime / 1000;
+	deadline->tv_nsec += (long)(blocktime % 1000) * 1000000L;
+	if(deadline->tv_nsec >= 1000000000L) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
+
+// Wait on a queue condition. Called with q->lock held. Returns false on timeout.
+static bool queue_wait(struct posix_queue	 *q,
+					   pthread_cond_t		 *cond,
+					   const struct timespec *deadline) {
+	if(deadline == NULL) {
+		return pthread_cond_wait(cond, &q->lock) == 0;
+	}
+	return pthread_cond_timedwait(cond, &q->lock, deadline) != ETIMEDOUT;
+}
+
+uint32_t fsm_port_get_systime(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+uint32_t fsm_port_get_systime_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u);
+}
+
+void fsm_port_delay(uint32_t ms) {
+	struct timespec ts = { .tv_sec = ms / 1000u, .tv_nsec = (long)(ms % 1000u) * 1000000L };
+	while(nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+	}
+}
+
+void *fsm_port_malloc(size_t size) {
+	heap_call_count();
+	void *ret = calloc(1, size);
+#if DEBUG_MEMORY
+	fsm_port_print(FSM_DBG_LVL_RAW, __LINE__, __FILE__, "[FSM malloc] %p: %lu" NL, ret, size);
+#endif
+	return ret;
+}
+
+void fsm_port_free(void *buf) {
+	if(buf == NULL) {
+		return;	 // Not a heap operation
+	}
+	heap_call_count();
+#if DEBUG_MEMORY
+	fsm_port_print(FSM_DBG_LVL_RAW, __LINE__, __FILE__, "[FSM free] %p" NL, buf);
+#endif
+	free(buf);
+}
+
+void *fsm_port_mutex_create(void) {
+	heap_call_count();
+	pthread_mutex_t *ret = malloc(sizeof(pthread_mutex_t));
+	if(ret == NULL) {
+		return NULL;
+	}
+	if(pthread_mutex_init(ret, NULL) != 0) {
+		free(ret);
+		return NULL;
+	}
+#if DEBUG_MEMORY
+	fsm_port_print(FSM_DBG_LVL_RAW, __LINE__, __FILE__, "[FSM mutex create] %p" NL, ret);
+#endif
+	return ret;
+}
+
+bool fsm_port_mutex_destroy(void *mutex) {
+	heap_call_count();
+#if DEBUG_MEMORY
+	fsm_port_print(FSM_DBG_LVL_RAW, __LINE__, __FILE__, "[FSM mutex destroy] %p" NL, mutex);
+#endif
+	int res = pthread_mutex_destroy((pthread_mutex_t *)mutex);
+	if(res != 0) {
+		// Still locked or waited on, leak it rather than free memory another thread uses
+		fsm_port_print(
+			FSM_DBG_LVL_ERR, __LINE__, __FILE__, "Mutex %p not destroyed: %d", mutex, res);
+		return false;
+	}
+	free(mutex);
+	return true;
+}
+
+// Static mutexes live in caller storage and do not count as heap calls
+void *fsm_port_mutex_init(void *storage) {
+	if(pthread_mutex_init((pthread_mutex_t *)storage, NULL) != 0) {
+		return NULL;
+	}
+	return storage;
+}
+
+bool fsm_port_mutex_deinit(void *mutex) {
+	int res = pthread_mutex_destroy((pthread_mutex_t *)mutex);
+	if(res != 0) {
+		fsm_port_print(
+			FSM_DBG_LVL_ERR, __LINE__, __FILE__, "Mutex %p not destroyed: %d", mutex, res);
+		return false;
+	}
+	return true;
+}
+
+bool fsm_port_mutex_lock(void *mutex, uint32_t blocktime) {
+	if(blocktime == BLOCKTIME_MAX) {
+		return pthread_mutex_lock((pthread_mutex_t *)mutex) == 0;
+	}
+	if(blocktime == 0) {
+		return pthread_mutex_trylock((pthread_mutex_t *)mutex) == 0;
+	}
+	struct timespec deadline;
+	deadline_get(CLOCK_REALTIME, blocktime, &deadline);
+	return pthread_mutex_timedlock((pthread_mutex_t *)mutex, &deadline) == 0;
+}
+
+bool fsm_port_mutex_unlock(void *mutex) {
+	return pthread_mutex_unlock((pthread_mutex_t *)mutex) == 0;
+}
+
+void *fsm_port_queue_create(uint32_t length, uint32_t item_size) {
+	heap_call_count();
+	struct posix_queue *q = calloc(1, sizeof(struct posix_queue) + (size_t)length * item_size);
+	if(q == NULL) {
+		return NULL;
+	}
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_empty, &attr);
+	pthread_cond_init(&q->not_full, &attr);
+	pthread_condattr_destroy(&attr);
+	q->length	 = length;
+	q->item_size = item_size;
+#if DEBUG_MEMORY
+	fsm_port_print(FSM_DBG_LVL_RAW, __LINE__, __FILE__, "[FSM queue create] %p" NL, q);
+#endif
+	return q;
+}
+
+bool fsm_port_queue_send(void *queue, void *item, uint32_t blocktime) {
+	struct posix_queue *q = queue;
+	struct timespec		deadline;
+	bool				ret = true;
+	if(blocktime != BLOCKTIME_MAX && blocktime != 0) {
+		deadline_get(CLOCK_MONOTONIC, blocktime, &deadline);
+	}
+	pthread_mutex_lock(&q->lock);
+	while(q->count == q->length) {
+		if(blocktime == 0) {
+			ret = false;
+			goto EXIT;
+		}
+		q->tx_waiting++;
+		bool ok = queue_wait(q, &q->not_full, blocktime == BLOCKTIME_MAX ? NULL : &deadline);
+		q->tx_waiting--;
+		if(!ok && q->count == q->length) {
+			ret = false;
+			goto EXIT;
+		}
+	}
+	uint32_t tail = q->head + q->count;
+	if(tail >= q->length) {
+		tail -= q->length;
+	}
+	memcpy(&q->buf[(size_t)tail * q->item_size], item, q->item_size);
+	q->count++;
+	if(q->rx_waiting) {
+		pthread_cond_signal(&q->not_empty);
+	}
+EXIT:
+	pthread_mutex_unlock(&q->lock);
+	return ret;
+}
+
+bool fsm_port_queue_receive(void *queue, void *dst, uint32_t blocktime) {
+	struct posix_queue *q = queue;
+	struct timespec		deadline;
+	bool				ret = true;
+	if(blocktime != BLOCKTIME_MAX && blocktime != 0) {
+		deadline_get(CLOCK_MONOTONIC, blocktime, &deadline);
+	}
+	pthread_mutex_lock(&q->lock);
+	while(q->count == 0) {
+		if(blocktime == 0) {
+			ret = false;
+			goto EXIT;
+		}
+		q->rx_waiting++;
+		bool ok = queue_wait(q, &q->not_empty, blocktime == BLOCKTIME_MAX ? NULL : &deadline);
+		q->rx_waiting--;
+		if(!ok && q->count == 0) {
+			ret = false;
+			goto EXIT;
+		}
+	}
+	memcpy(dst, &q->buf[(size_t)q->head * q->item_size], q->item_size);
+	q->head++;
+	if(q->head == q->length) {
+		q->head = 0;
+	}
+	q->count--;
+	if(q->tx_waiting) {
+		pthread_cond_signal(&q->not_full);
+	}
+EXIT:
+	pthread_mutex_unlock(&q->lock);
+	return ret;
+}
+
+bool fsm_port_queue_clear(void *queue) {
+	struct posix_queue *q = queue;
+	pthread_mutex_lock(&q->lock);
+	q->head	 = 0;
+	q->count = 0;
+	if(q->tx_waiting) {
+		pthread_cond_broadcast(&q->not_full);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return true;
+}
+
+uint32_t fsm_port_queue_count(void *queue) {
+	struct posix_queue *q = queue;
+	pthread_mutex_lock(&q->lock);
+	uint32_t ret = q->count;
+	pthread_mutex_unlock(&q->lock);
+	return ret;
+}
+
+bool fsm_port_queue_destroy(void *queue) {
+	heap_call_count();
+	struct posix_queue *q = queue;
+#if DEBUG_MEMORY
+	fsm_port_print(FSM_DBG_LVL_RAW, __LINE__, __FILE__, "[FSM queue destroy] %p" NL, queue);
+#endif
+	pthread_cond_destroy(&q->not_full);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_mutex_destroy(&q->lock);
+	free(q);
+	return true;
+}
+
+void *fsm_port_sem_create(void) {
+	heap_call_count();
+	sem_t *ret = malloc(sizeof(sem_t));
+	if(ret == NULL) {
+		return NULL;
+	}
+	if(sem_init(ret, 0, 0) != 0) {
+		free(ret);
+		return NULL;
+	}
+	return ret;
+}
+
+bool fsm_port_sem_destroy(void *sem) {
+	heap_call_count();
+	sem_destroy((sem_t *)sem);
+	free(sem);
+	return true;
+}
+
+// sem_post() is async-signal-safe, an overflowing count only means spurious wakeups
+bool fsm_port_sem_post(void *sem) {
+	return sem_post((sem_t *)sem) == 0;
+}
+
+bool fsm_port_sem_wait(void *sem, uint32_t blocktime) {
+	int res;
+	if(blocktime == BLOCKTIME_MAX) {
+		while((res = sem_wait((sem_t *)sem)) != 0 && errno == EINTR) {
+		}
+		return res == 0;
+	}
+	if(blocktime == 0) {
+		return sem_trywait((sem_t *)sem) == 0;
+	}
+	struct timespec deadline;
+	deadline_get(CLOCK_REALTIME, blocktime, &deadline);
+	while((res = sem_timedwait((sem_t *)sem, &deadline)) != 0 && errno == EINTR) {
+	}
+	return res == 0;
+}
+
+void *fsm_port_thread_create(const char *name, void (*entry)(void *arg), void *arg) {
+	(void)name;	 // Only printed with DEBUG_MEMORY, pthreads are not named
+	heap_call_count();
+	struct posix_thread *t = malloc(sizeof(struct posix_thread));
+	if(t == NULL) {
+		return NULL;
+	}
+	t->entry = entry;
+	t->arg	 = arg;
+	if(pthread_create(&t->id, NULL, thread_trampoline, t) != 0) {
+		free(t);
+		return NULL;
+	}
+#if DEBUG_MEMORY
+	fsm_port_print(FSM_DBG_LVL_RAW, __LINE__, __FILE__, "[FSM thread create] %s %p" NL, name, t);
+#endif
+	return t;
+}
+
+bool fsm_port_thread_join(void *thread) {
+	heap_call_count();
+	struct posix_thread *t = thread;
+	bool				 ok = pthread_join(t->id, NULL) == 0;
+	free(t);
+	return ok;
+}
+
+void fsm_port_print(int level, int line, const char *filename, char *fmt, ...) {
+	if(level > __atomic_load_n(&fsm_port_print_level, __ATOMIC_RELAXED)) {
+		return;
+	}
+	va_list args;
+	va_start(args, fmt);
+	switch(level) {
+	case FSM_DBG_LVL_ERR:
+		fprintf(stderr, "[E] %s:%d: ", filename, line);
+		vfprintf(stderr, fmt, args);
+		fputs(NL, stderr);
+		break;
+	case FSM_DBG_LVL_WRN:
+		fprintf(stderr, "[W] %s:%d: ", filename, line);
+		vfprintf(stderr, fmt, args);
+		fputs(NL, stderr);
+		break;
+	case FSM_DBG_LVL_INF:
+		fprintf(stdout, "[I] %s:%d: ", filename, line);
+		vfprintf(stdout, fmt, args);
+		fputs(NL, stdout);
+		break;
+	case FSM_DBG_LVL_RAW: vfprintf(stdout, fmt, args); break;
+	}
+	va_end(args);
+}
+
+/*--- Public function definitions -----------------------------------------------------*/
+
+uint32_t fsm_port_heap_calls(void) {
+	return __atomic_load_n(&heap_calls, __ATOMIC_RELAXED);
+}
+
+void fsm_port_log_drain_start(void) {
+	if(log_drain_thread) {
+		return;
+	}
+	if(log_drain_sem == NULL) {
+		__atomic_store_n(&log_drain_sem, fsm_port_sem_create(), __ATOMIC_RELEASE);
+		if(log_drain_sem == NULL) {
+			return;
+		}
+	}
+	__atomic_store_n(&log_drain_stopping, false, __ATOMIC_RELEASE);
+	log_drain_thread = fsm_port_thread_create("fsm_log_drain", log_drain_main, NULL);
+}
+
+void fsm_port_log_drain_stop(void) {
+	if(log_drain_thread == NULL) {
+		return;
+	}
+	__atomic_store_n(&log_drain_stopping, true, __ATOMIC_RELEASE);
+	fsm_port_sem_post(log_drain_sem);
+	fsm_port_thread_join(log_drain_thread);
+	log_drain_thread = NULL;
+}
+
+void fsm_port_log_drain_wake(void) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&log_drain_sleeping, __ATOMIC_RELAXED)
+	   && __atomic_exchange_n(&log_drain_sleeping, false, __ATOMIC_ACQ_REL)) {
+		fsm_port_sem_post(__atomic_load_n(&log_drain_sem, __ATOMIC_ACQUIRE));
+	}
+}
+
+void fsm_port_posix_set_print_level(fsm_dbg_lvl_t level) {
+	fsm_port_set_print_level(level);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// FSM_PORT_POSIX
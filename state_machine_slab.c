@@ -0,0 +1,154 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+/*--- Private dependencies ------------------------------------------------------------*/
+#include "state_machine_slab.h"
+#include <stddef.h>
+#include <string.h>
+
+#include <assert.h>
+#define USE_ASSERT 1
+#if USE_ASSERT
+#define ASSERT(e) assert(e)
+#else
+#define ASSERT(e)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public variable definitions -----------------------------------------------------*/
+
+/*--- Private macros ------------------------------------------------------------------*/
+#define ROUND_UP_8(_n) (((_n) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1))
+
+/*--- Private type definitions --------------------------------------------------------*/
+
+/*--- Private function declarations ---------------------------------------------------*/
+
+/*--- Private variable definitions ----------------------------------------------------*/
+
+/*--- Private function definitions ----------------------------------------------------*/
+
+// Allocate a chunk and put its objects on the free list. Must be called with slab->lock held.
+static int slab_chunk_add(struct fsm_slab *slab, uint32_t number) {
+	os_handle_t os	  = slab->os;
+	uint8_t	   *chunk = os->malloc(sizeof(uint64_t) + (size_t)slab->size * number);
+	if(chunk == NULL) {
+		return -1;
+	}
+	*(void **)chunk = slab->chunks;
+	slab->chunks	= chunk;
+	// Link the objects so that they are handed out in address order
+	uint8_t *object = chunk + sizeof(uint64_t);
+	for(uint32_t i = number; i > 0; i--) {
+		uint8_t *node	= object + (size_t)(i - 1) * slab->size;
+		*(void **)node	= slab->free_list;
+		slab->free_list = node;
+	}
+	slab->stats.capacity += number;
+	slab->stats.chunks++;
+	return 0;
+}
+
+/*--- Public function definitions -----------------------------------------------------*/
+
+void fsm_slab_init(struct fsm_slab *slab, uint32_t size, os_handle_t os) {
+	ASSERT(slab);
+	ASSERT(os);
+	ASSERT(size > 0);
+	memset(slab, 0, sizeof(*slab));
+	slab->os				= os;
+	slab->size				= ROUND_UP_8(size);
+	slab->stats.object_size = slab->size;
+	void *lock				= os->mutex_init(slab->lock_storage);
+	ASSERT(lock);
+	// A set lock marks the slab as usable
+	__atomic_store_n(&slab->lock, lock, __ATOMIC_RELEASE);
+}
+
+int fsm_slab_add(struct fsm_slab *slab, uint32_t number, uint32_t grow) {
+	ASSERT(slab);
+	ASSERT(slab->lock);
+	int			ret = 0;
+	os_handle_t os	= slab->os;
+	os->mutex_lock(slab->lock, BLOCKTIME_MAX);
+	slab->grow = grow;
+	if(number) {
+		ret = slab_chunk_add(slab, number);
+	}
+	os->mutex_unlock(slab->lock);
+	return ret;
+}
+
+void *fsm_slab_alloc(struct fsm_slab *slab) {
+	ASSERT(slab);
+	ASSERT(slab->lock);
+	os_handle_t os = slab->os;
+	os->mutex_lock(slab->lock, BLOCKTIME_MAX);
+	if(slab->free_list == NULL && (slab->grow == 0 || slab_chunk_add(slab, slab->grow) != 0)) {
+		slab->stats.exhausted++;
+		os->mutex_unlock(slab->lock);
+		return NULL;
+	}
+	void *object	= slab->free_list;
+	slab->free_list = *(void **)object;
+	slab->stats.used++;
+	if(slab->stats.used > slab->stats.used_max) {
+		slab->stats.used_max = slab->stats.used;
+	}
+	os->mutex_unlock(slab->lock);
+	memset(object, 0, slab->size);
+	return object;
+}
+
+void fsm_slab_free(struct fsm_slab *slab, void *object) {
+	ASSERT(slab);
+	ASSERT(object);
+	os_handle_t os = slab->os;
+	os->mutex_lock(slab->lock, BLOCKTIME_MAX);
+	ASSERT(slab->stats.used > 0);
+	*(void **)object = slab->free_list;
+	slab->free_list	 = object;
+	slab->stats.used--;
+	os->mutex_unlock(slab->lock);
+}
+
+void fsm_slab_read_stats(struct fsm_slab *slab, struct fsm_slab_stats *stats) {
+	ASSERT(slab);
+	ASSERT(stats);
+	if(slab->lock == NULL) {
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+	os_handle_t os = slab->os;
+	os->mutex_lock(slab->lock, BLOCKTIME_MAX);
+	*stats = slab->stats;
+	os->mutex_unlock(slab->lock);
+}
+
+#ifdef __cplusplus
+}
+#endif
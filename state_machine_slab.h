@@ -0,0 +1,110 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+#ifndef __STATEMACHINE_SLAB_H__
+#define __STATEMACHINE_SLAB_H__
+
+/*--- Public dependencies -------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "state_machine.h"
+#include "state_machine_port.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public macros -------------------------------------------------------------------*/
+
+/*--- Public type definitions ---------------------------------------------------------*/
+
+/**
+ * @brief Allocator of fixed-size objects carved from large chunks. Free objects are kept in a
+ *        list threaded through the objects, so allocation and release are O(1) and never touch
+ *        the heap once the chunks exist. Slabs live for the whole program, chunks are never
+ *        returned to the heap.
+ */
+struct fsm_slab {
+	os_handle_t os;
+	void	   *lock;		 // Created in lock_storage by fsm_slab_init()
+	uint32_t	size;		 // Object size, multiple of 8
+	uint32_t	grow;		 // Objects added per chunk when the slab runs out, 0 for a fixed slab
+	void	   *free_list;	 // Next free object, its first word links to the following one
+	void	   *chunks;		 // Allocated chunks, linked through their first word
+	struct fsm_slab_stats stats;
+	uint64_t	lock_storage[FSM_STATIC_MUTEX_SIZE / sizeof(uint64_t)];
+};
+
+/*--- Public variable declarations ----------------------------------------------------*/
+
+/*--- Public function declarations ----------------------------------------------------*/
+
+/**
+ * @brief Initialize an empty slab. It allocates nothing until objects are added.
+ *
+ * @param slab The slab
+ * @param size Object size, rounded up to a multiple of 8
+ * @param os OS handle used for the lock and the chunks
+ */
+extern void fsm_slab_init(struct fsm_slab *slab, uint32_t size, os_handle_t os);
+
+/**
+ * @brief Add one chunk of objects and set how the slab grows later.
+ *
+ * @param slab The slab
+ * @param number Number of objects in the new chunk, 0 to only change grow
+ * @param grow Objects per chunk added when the slab runs out, 0 to never grow
+ * @return int 0 on success, -1 if out of memory
+ */
+extern int fsm_slab_add(struct fsm_slab *slab, uint32_t number, uint32_t grow);
+
+/**
+ * @brief Take a zeroed object.
+ *
+ * @param slab The slab
+ * @return void* The object, NULL if the slab is empty and cannot grow
+ */
+extern void *fsm_slab_alloc(struct fsm_slab *slab);
+
+/**
+ * @brief Return an object taken with fsm_slab_alloc().
+ *
+ * @param slab The slab the object was taken from
+ * @param object The object
+ */
+extern void fsm_slab_free(struct fsm_slab *slab, void *object);
+
+/**
+ * @brief Copy the usage counters of a slab.
+ *
+ * @param slab The slab
+ * @param stats Where to copy the counters
+ */
+extern void fsm_slab_read_stats(struct fsm_slab *slab, struct fsm_slab_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// __STATEMACHINE_SLAB_H__
@@ -0,0 +1,284 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+/*--- Private dependencies ------------------------------------------------------------*/
+#include "state_machine_timer.h"
+#include <stddef.h>
+
+#include <assert.h>
+#define USE_ASSERT 1
+#if USE_ASSERT
+#define ASSERT(e) assert(e)
+#else
+#define ASSERT(e)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public variable definitions -----------------------------------------------------*/
+
+/*--- Private macros ------------------------------------------------------------------*/
+#define WHEEL_MASK		  (FSM_WHEEL_SLOTS - 1)
+#define WHEEL_MAX_DELTA	  ((1u << (FSM_WHEEL_BITS * FSM_WHEEL_LEVELS)) - 1)
+#define WHEEL_LEVEL_IDLE  0xFF
+#define WHEEL_LEVEL_DUE	  0xFE
+#define WHEEL_SHIFT(_lvl) ((_lvl) * FSM_WHEEL_BITS)
+
+/*--- Private type definitions --------------------------------------------------------*/
+
+/*--- Private function declarations ---------------------------------------------------*/
+
+/*--- Private variable definitions ----------------------------------------------------*/
+
+/*--- Private function definitions ----------------------------------------------------*/
+
+static inline void link_init(struct fsm_timer_link *head) {
+	head->next = head;
+	head->prev = head;
+}
+
+static inline bool link_empty(const struct fsm_timer_link *head) {
+	return head->next == head;
+}
+
+static inline void link_append(struct fsm_timer_link *head, struct fsm_timer_link *node) {
+	node->prev		 = head->prev;
+	node->next		 = head;
+	head->prev->next = node;
+	head->prev		 = node;
+}
+
+static inline void link_remove(struct fsm_timer_link *node) {
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	node->next		 = NULL;
+	node->prev		 = NULL;
+}
+
+// Rotate an occupancy bitmap right so that bit 0 corresponds to slot first
+static inline uint64_t occupied_from(uint64_t occupied, uint32_t first) {
+	first &= WHEEL_MASK;
+	return first ? (occupied >> first) | (occupied << (FSM_WHEEL_SLOTS - first)) : occupied;
+}
+
+static void wheel_place(struct fsm_wheel *wheel, struct fsm_timer *timer) {
+	uint32_t delta = timer->expires - wheel->now;
+	if((int32_t)delta < 0) {
+		timer->level = WHEEL_LEVEL_DUE;
+		link_append(&wheel->expired, &timer->link);
+		return;
+	}
+	uint32_t target = timer->expires;
+	if(delta > WHEEL_MAX_DELTA) {
+		target = wheel->now + WHEEL_MAX_DELTA;	// Parked, placed again when cascaded
+		delta  = WHEEL_MAX_DELTA;
+	}
+	uint8_t level = 0;
+	while(level < FSM_WHEEL_LEVELS - 1 && delta >= (1u << WHEEL_SHIFT(level + 1))) {
+		level++;
+	}
+	uint8_t slot = (target >> WHEEL_SHIFT(level)) & WHEEL_MASK;
+	timer->level = level;
+	timer->slot	 = slot;
+	link_append(&wheel->slots[level][slot], &timer->link);
+	wheel->occupied[level] |= (uint64_t)1 << slot;
+	wheel->armed++;
+}
+
+// Move all timers of a slot to lower levels
+static void wheel_cascade(struct fsm_wheel *wheel, uint32_t level, uint32_t slot) {
+	struct fsm_timer_link list;
+	struct fsm_timer_link *head = &wheel->slots[level][slot];
+	if(link_empty(head)) {
+		return;
+	}
+	// Detach the slot first, timers may be placed into the same slot again when parked
+	list.next		= head->next;
+	list.prev		= head->prev;
+	list.next->prev = &list;
+	list.prev->next = &list;
+	link_init(head);
+	wheel->occupied[level] &= ~((uint64_t)1 << slot);
+	while(!link_empty(&list)) {
+		struct fsm_timer *timer = (struct fsm_timer *)list.next;
+		link_remove(&timer->link);
+		wheel->armed--;
+		wheel_place(wheel, timer);
+	}
+}
+
+static void wheel_expire_slot(struct fsm_wheel *wheel, uint32_t slot) {
+	struct fsm_timer_link *head = &wheel->slots[0][slot];
+	while(!link_empty(head)) {
+		struct fsm_timer *timer = (struct fsm_timer *)head->next;
+		link_remove(&timer->link);
+		wheel->armed--;
+		timer->level = WHEEL_LEVEL_DUE;
+		link_append(&wheel->expired, &timer->link);
+	}
+	wheel->occupied[0] &= ~((uint64_t)1 << slot);
+}
+
+// Process all ticks up to and including now
+static void wheel_advance(struct fsm_wheel *wheel, uint32_t now) {
+	while((int32_t)(now - wheel->now) >= 0) {
+		uint32_t idx = wheel->now & WHEEL_MASK;
+		// Cascade upper levels when the lower one wraps
+		for(uint32_t level = 1; idx == 0 && level < FSM_WHEEL_LEVELS; level++) {
+			uint32_t slot = (wheel->now >> WHEEL_SHIFT(level)) & WHEEL_MASK;
+			wheel_cascade(wheel, level, slot);
+			if(slot != 0) {
+				break;
+			}
+		}
+		if(wheel->armed == 0) {
+			wheel->now = now + 1;
+			break;
+		}
+		// Skip to the next occupied slot of level 0 within the current round
+		uint64_t bits = wheel->occupied[0] >> idx;
+		uint32_t left = now - wheel->now;
+		if(bits == 0) {
+			uint32_t step = FSM_WHEEL_SLOTS - idx;
+			if(left < step) {
+				wheel->now = now + 1;
+				break;
+			}
+			wheel->now += step;
+			continue;
+		}
+		uint32_t skip = (uint32_t)__builtin_ctzll(bits);
+		if(left < skip) {
+			wheel->now = now + 1;
+			break;
+		}
+		wheel->now += skip;
+		wheel_expire_slot(wheel, idx + skip);
+		wheel->now++;
+	}
+}
+
+/*--- Public function definitions -----------------------------------------------------*/
+
+void fsm_wheel_init(struct fsm_wheel *wheel, uint32_t now) {
+	ASSERT(wheel);
+	wheel->now	 = now;
+	wheel->armed = 0;
+	for(uint32_t level = 0; level < FSM_WHEEL_LEVELS; level++) {
+		wheel->occupied[level] = 0;
+		for(uint32_t slot = 0; slot < FSM_WHEEL_SLOTS; slot++) {
+			link_init(&wheel->slots[level][slot]);
+		}
+	}
+	link_init(&wheel->expired);
+}
+
+void fsm_timer_init(struct fsm_timer *timer) {
+	ASSERT(timer);
+	timer->link.next = NULL;
+	timer->link.prev = NULL;
+	timer->level	 = WHEEL_LEVEL_IDLE;
+	timer->slot		 = 0;
+}
+
+bool fsm_timer_armed(const struct fsm_timer *timer) {
+	return timer->level != WHEEL_LEVEL_IDLE;
+}
+
+void fsm_wheel_add(struct fsm_wheel *wheel, struct fsm_timer *timer, uint32_t now) {
+	ASSERT(wheel);
+	ASSERT(timer);
+	ASSERT(timer->level == WHEEL_LEVEL_IDLE);
+	if(wheel->armed == 0 && (int32_t)(now - wheel->now) > 0) {
+		wheel->now = now;  // Nothing to process in between, catch up with the clock
+	}
+	wheel_place(wheel, timer);
+}
+
+void fsm_wheel_del(struct fsm_wheel *wheel, struct fsm_timer *timer) {
+	ASSERT(wheel);
+	ASSERT(timer);
+	if(timer->level == WHEEL_LEVEL_IDLE) {
+		return;
+	}
+	link_remove(&timer->link);
+	if(timer->level != WHEEL_LEVEL_DUE) {
+		wheel->armed--;
+		if(link_empty(&wheel->slots[timer->level][timer->slot])) {
+			wheel->occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+		}
+	}
+	timer->level = WHEEL_LEVEL_IDLE;
+}
+
+struct fsm_timer *fsm_wheel_expire(struct fsm_wheel *wheel, uint32_t now) {
+	ASSERT(wheel);
+	if(link_empty(&wheel->expired)) {
+		wheel_advance(wheel, now);
+		if(link_empty(&wheel->expired)) {
+			return NULL;
+		}
+	}
+	struct fsm_timer *timer = (struct fsm_timer *)wheel->expired.next;
+	link_remove(&timer->link);
+	timer->level = WHEEL_LEVEL_IDLE;
+	return timer;
+}
+
+uint32_t fsm_wheel_next(const struct fsm_wheel *wheel, uint32_t now) {
+	ASSERT(wheel);
+	if(!link_empty(&wheel->expired)) {
+		return 0;
+	}
+	if(wheel->armed == 0) {
+		return UINT32_MAX;
+	}
+	uint32_t ret = UINT32_MAX;
+	for(uint32_t level = 0; level < FSM_WHEEL_LEVELS; level++) {
+		if(wheel->occupied[level] == 0) {
+			continue;
+		}
+		uint32_t tick;
+		uint32_t base = wheel->now >> WHEEL_SHIFT(level);
+		if(level == 0) {
+			// Level 0 slots hold the exact expiry tick within the coming round
+			tick = wheel->now + __builtin_ctzll(occupied_from(wheel->occupied[0], base));
+		} else {
+			// Upper level slots are cascaded when the clock reaches their start
+			uint32_t dist = __builtin_ctzll(occupied_from(wheel->occupied[level], base + 1)) + 1;
+			tick		  = (base + dist) << WHEEL_SHIFT(level);
+		}
+		uint32_t delta = (int32_t)(tick - now) > 0 ? tick - now : 0;
+		if(delta < ret) {
+			ret = delta;
+		}
+	}
+	return ret;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,144 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+#ifndef __STATEMACHINE_TIMER_H__
+#define __STATEMACHINE_TIMER_H__
+
+/*--- Public dependencies -------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public macros -------------------------------------------------------------------*/
+#define FSM_WHEEL_BITS	 6
+#define FSM_WHEEL_SLOTS	 (1u << FSM_WHEEL_BITS)
+#define FSM_WHEEL_LEVELS 4	// 1ms resolution, 2^24ms (about 4.6 hours) before re-cascading
+
+/*--- Public type definitions ---------------------------------------------------------*/
+
+struct fsm_timer_link {
+	struct fsm_timer_link *next;
+	struct fsm_timer_link *prev;
+};
+
+/**
+ * @brief Timer node, owned by the user of the wheel. The link must stay the first member.
+ */
+struct fsm_timer {
+	struct fsm_timer_link link;	 // Wheel slot or expired list, unlinked when idle
+	uint8_t				  level;
+	uint8_t				  slot;
+	uint32_t			  expires;	// Uptime in ms
+	uint32_t			  period;	// 0 for one-shot
+	uint32_t			  type;		// Event type delivered on expiry
+	void				 *owner;
+	struct fsm_timer	 *owner_next;
+};
+
+/**
+ * @brief Hierarchical timing wheel with 1ms ticks. Level 0 holds timers due within the next
+ *        FSM_WHEEL_SLOTS ticks, every further level covers FSM_WHEEL_SLOTS times the span of the
+ *        previous one and is cascaded into the lower levels when the clock reaches its slot.
+ *        Adding and removing timers is O(1), advancing skips empty slots with the occupancy
+ *        bitmaps, so idle time costs nothing.
+ */
+struct fsm_wheel {
+	uint32_t			  now;	  // Next tick to process
+	uint32_t			  armed;  // Timers in the slots, not counting the expired list
+	uint64_t			  occupied[FSM_WHEEL_LEVELS];
+	struct fsm_timer_link slots[FSM_WHEEL_LEVELS][FSM_WHEEL_SLOTS];
+	struct fsm_timer_link expired;
+};
+
+/*--- Public variable declarations ----------------------------------------------------*/
+
+/*--- Public function declarations ----------------------------------------------------*/
+
+/**
+ * @brief Initialize an empty wheel.
+ *
+ * @param wheel The wheel to initialize
+ * @param now Current uptime in ms
+ */
+extern void fsm_wheel_init(struct fsm_wheel *wheel, uint32_t now);
+
+/**
+ * @brief Initialize a timer node as idle.
+ *
+ * @param timer The timer to initialize
+ */
+extern void fsm_timer_init(struct fsm_timer *timer);
+
+/**
+ * @brief Check if a timer is in a wheel.
+ *
+ * @param timer The timer to check
+ * @return true The timer is armed or expired but not yet taken with fsm_wheel_expire()
+ */
+extern bool fsm_timer_armed(const struct fsm_timer *timer);
+
+/**
+ * @brief Insert an idle timer. Timers that are already due go straight to the expired list.
+ *
+ * @param wheel The wheel to insert into
+ * @param timer The timer, with expires set
+ * @param now Current uptime in ms
+ */
+extern void fsm_wheel_add(struct fsm_wheel *wheel, struct fsm_timer *timer, uint32_t now);
+
+/**
+ * @brief Remove a timer from the wheel. Does nothing if the timer is idle.
+ *
+ * @param wheel The wheel the timer was added to
+ * @param timer The timer to remove
+ */
+extern void fsm_wheel_del(struct fsm_wheel *wheel, struct fsm_timer *timer);
+
+/**
+ * @brief Advance the wheel and take one expired timer. The timer is idle when returned.
+ *
+ * @param wheel The wheel to advance
+ * @param now Current uptime in ms, timers with expires <= now are due
+ * @return struct fsm_timer* An expired timer, or NULL if no timer is due
+ */
+extern struct fsm_timer *fsm_wheel_expire(struct fsm_wheel *wheel, uint32_t now);
+
+/**
+ * @brief Get a lower bound of the time until the next timer expires. Timers in the upper levels
+ *        are accounted for by the time they are cascaded.
+ *
+ * @param wheel The wheel to inspect
+ * @param now Current uptime in ms
+ * @return uint32_t Milliseconds until the next expiry or cascade, UINT32_MAX if the wheel is empty
+ */
+extern uint32_t fsm_wheel_next(const struct fsm_wheel *wheel, uint32_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// __STATEMACHINE_TIMER_H__
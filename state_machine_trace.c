@@ -0,0 +1,145 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+/*--- Private dependencies ------------------------------------------------------------*/
+#include "state_machine.h"
+#include "state_machine_trace.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public variable definitions -----------------------------------------------------*/
+
+/*--- Private macros ------------------------------------------------------------------*/
+#define TRACE_MASK (FSM_TRACE_LENGTH - 1)
+
+/*--- Private type definitions --------------------------------------------------------*/
+
+_Static_assert((FSM_TRACE_LENGTH & TRACE_MASK) == 0, "FSM_TRACE_LENGTH must be a power of two");
+#if FSM_USE_TRACE
+_Static_assert(sizeof(struct fsm_trace_ring) <= FSM_TRACE_RING_SIZE, "Trace ring size mismatch");
+#endif
+
+/*--- Private function declarations ---------------------------------------------------*/
+
+/*--- Private variable definitions ----------------------------------------------------*/
+static uint32_t trace_next_id = 0;
+
+/*--- Private function definitions ----------------------------------------------------*/
+
+/*--- Public function definitions -----------------------------------------------------*/
+
+uint32_t fsm_trace_id_new(void) {
+	return __atomic_add_fetch(&trace_next_id, 1, __ATOMIC_RELAXED);
+}
+
+void fsm_trace_ring_init(struct fsm_trace_ring *ring) {
+	memset(ring, 0, sizeof(*ring));
+}
+
+void fsm_trace_write(struct fsm_trace_ring *ring,
+					 uint32_t				kind,
+					 uint32_t				fsm_id,
+					 uint32_t				timestamp_us,
+					 uint32_t				type,
+					 uint32_t				from,
+					 uint32_t				to) {
+	uint32_t			   seq	= __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+	struct fsm_trace_slot *slot = &ring->slots[seq & TRACE_MASK];
+	__atomic_store_n(&slot->stamp, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&slot->record.seq, seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->record.timestamp_us, timestamp_us, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->record.fsm_id, fsm_id, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->record.kind, kind, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->record.type, type, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->record.from, from, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->record.to, to, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->stamp, seq + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t fsm_trace_ring_read(struct fsm_trace_ring	 *ring,
+							 uint32_t				 *cursor,
+							 struct fsm_trace_record *records,
+							 uint32_t				  max) {
+	uint32_t number = 0;
+	uint32_t head	= __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	uint32_t pos	= *cursor;
+	if(head - pos > FSM_TRACE_LENGTH) {
+		pos = head - FSM_TRACE_LENGTH;	// Older records are overwritten
+	}
+	while(number < max && pos != head) {
+		struct fsm_trace_slot *slot	 = &ring->slots[pos & TRACE_MASK];
+		uint32_t			   stamp = __atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE);
+		if(stamp != pos + 1) {
+			if(stamp == 0 || (int32_t)(stamp - (pos + 1)) < 0) {
+				break;	// Still being written, read it next time
+			}
+			pos++;	// Overwritten by a newer record
+			continue;
+		}
+		struct fsm_trace_record *dst = &records[number];
+		dst->seq					 = __atomic_load_n(&slot->record.seq, __ATOMIC_RELAXED);
+		dst->timestamp_us = __atomic_load_n(&slot->record.timestamp_us, __ATOMIC_RELAXED);
+		dst->fsm_id		  = __atomic_load_n(&slot->record.fsm_id, __ATOMIC_RELAXED);
+		dst->kind		  = __atomic_load_n(&slot->record.kind, __ATOMIC_RELAXED);
+		dst->type		  = __atomic_load_n(&slot->record.type, __ATOMIC_RELAXED);
+		dst->from		  = __atomic_load_n(&slot->record.from, __ATOMIC_RELAXED);
+		dst->to			  = __atomic_load_n(&slot->record.to, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&slot->stamp, __ATOMIC_RELAXED) == stamp) {
+			number++;
+		}
+		pos++;
+	}
+	*cursor = pos;
+	return number;
+}
+
+int fsm_trace_format(const struct fsm_trace_record *record, char *buf, size_t size) {
+	if(record->kind == FSM_TRACE_SWITCH) {
+		return snprintf(buf,
+						size,
+						"%10lu us FSM#%lu: {%lu}==>{%lu}",
+						(unsigned long)record->timestamp_us,
+						(unsigned long)record->fsm_id,
+						(unsigned long)record->from,
+						(unsigned long)record->to);
+	}
+	return snprintf(buf,
+					size,
+					"%10lu us FSM#%lu: {%lu} event %lu(0x%lX)",
+					(unsigned long)record->timestamp_us,
+					(unsigned long)record->fsm_id,
+					(unsigned long)record->to,
+					(unsigned long)record->type,
+					(unsigned long)record->type);
+}
+
+#ifdef __cplusplus
+}
+#endif
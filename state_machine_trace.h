@@ -0,0 +1,113 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+#ifndef __STATEMACHINE_TRACE_H__
+#define __STATEMACHINE_TRACE_H__
+
+/*--- Public dependencies -------------------------------------------------------------*/
+#include <stdint.h>
+#include "state_machine.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public macros -------------------------------------------------------------------*/
+
+/*--- Public type definitions ---------------------------------------------------------*/
+
+// A slot is stamped with its sequence number plus one once its record is complete, and with 0
+// while a writer fills it, so that readers can tell torn and overwritten records apart
+struct fsm_trace_slot {
+	uint32_t				stamp;
+	struct fsm_trace_record record;
+};
+
+/**
+ * @brief Trace ring of one FSM. Only threads polling that FSM write to it, so the head stays in
+ *        the cache of the core running the FSM instead of bouncing between all cores.
+ */
+struct fsm_trace_ring {
+	uint32_t			  head;	 // Sequence number of the next record
+	struct fsm_trace_slot slots[FSM_TRACE_LENGTH];
+};
+
+/*--- Public variable declarations ----------------------------------------------------*/
+
+/*--- Public function declarations ----------------------------------------------------*/
+
+/**
+ * @brief Get a new FSM ID for trace records. IDs start at 1 and are never reused.
+ *
+ * @return uint32_t The ID
+ */
+extern uint32_t fsm_trace_id_new(void);
+
+/**
+ * @brief Empty a trace ring.
+ *
+ * @param ring The ring
+ */
+extern void fsm_trace_ring_init(struct fsm_trace_ring *ring);
+
+/**
+ * @brief Append a record to a trace ring, overwriting the oldest one when the ring is full.
+ *        Lock-free, a few relaxed stores, so it can be called with locks held and from any
+ *        thread. See fsm_trace_read() in state_machine.h.
+ *
+ * @param ring The ring of the FSM
+ * @param kind FSM_TRACE_SWITCH or FSM_TRACE_EVENT
+ * @param fsm_id ID of the FSM, see fsm_trace_id_new()
+ * @param timestamp_us Time of the record in microseconds
+ * @param type Event type, FSM_EVT_ENTER for switches
+ * @param from ID of the state left, or of the state handling the event
+ * @param to ID of the state entered, or of the state handling the event
+ */
+extern void fsm_trace_write(struct fsm_trace_ring *ring,
+							uint32_t			   kind,
+							uint32_t			   fsm_id,
+							uint32_t			   timestamp_us,
+							uint32_t			   type,
+							uint32_t			   from,
+							uint32_t			   to);
+
+/**
+ * @brief Copy records out of a trace ring, see fsm_trace_read() in state_machine.h.
+ *
+ * @param ring The ring
+ * @param cursor Sequence number of the first record to read, advanced past the records read
+ * @param records Where to copy the records
+ * @param max Maximum number of records to copy
+ * @return uint32_t Number of records copied
+ */
+extern uint32_t fsm_trace_ring_read(struct fsm_trace_ring	*ring,
+									uint32_t				*cursor,
+									struct fsm_trace_record	*records,
+									uint32_t				 max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// __STATEMACHINE_TRACE_H__
@@ -0,0 +1,204 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+/*--- Private dependencies ------------------------------------------------------------*/
+#include "state_machine_transition.h"
+#include <stddef.h>
+#include <string.h>
+
+#include <assert.h>
+#define USE_ASSERT 1
+#if USE_ASSERT
+#define ASSERT(e) assert(e)
+#else
+#define ASSERT(e)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public variable definitions -----------------------------------------------------*/
+
+/*--- Private macros ------------------------------------------------------------------*/
+#define TRANS_MIN_CAPACITY 8
+
+/*--- Private type definitions --------------------------------------------------------*/
+
+/*--- Private function declarations ---------------------------------------------------*/
+
+/*--- Private variable definitions ----------------------------------------------------*/
+
+/*--- Private function definitions ----------------------------------------------------*/
+
+static void trans_table_free(struct fsm_trans *trans) {
+	trans->os->free(trans->cells);
+	trans->cells   = NULL;
+	trans->states  = 0;
+	trans->columns = 0;
+	fsm_map_deinit(&trans->column_index);
+}
+
+/*--- Public function definitions -----------------------------------------------------*/
+
+void fsm_trans_init(struct fsm_trans *trans, os_handle_t os) {
+	ASSERT(trans);
+	ASSERT(os);
+	memset(trans, 0, sizeof(struct fsm_trans));
+	trans->os = os;
+	fsm_map_init(&trans->column_index, os);
+}
+
+void fsm_trans_deinit(struct fsm_trans *trans) {
+	ASSERT(trans);
+	trans_table_free(trans);
+	trans->os->free(trans->rows);
+	trans->rows		= NULL;
+	trans->number	= 0;
+	trans->capacity = 0;
+	trans->dirty	= false;
+}
+
+int fsm_trans_append(struct fsm_trans *trans, const struct fsm_transition *rows, uint32_t number) {
+	ASSERT(trans);
+	ASSERT(rows || number == 0);
+	if(trans->number + number > trans->capacity) {
+		uint32_t capacity = trans->capacity ? trans->capacity : TRANS_MIN_CAPACITY;
+		while(capacity < trans->number + number) {
+			capacity *= 2;
+		}
+		struct fsm_trans_row *table = trans->os->malloc(sizeof(struct fsm_trans_row) * capacity);
+		if(table == NULL) {
+			return -2;
+		}
+		if(trans->number) {
+			memcpy(table, trans->rows, sizeof(struct fsm_trans_row) * trans->number);
+		}
+		trans->os->free(trans->rows);
+		trans->rows		= table;
+		trans->capacity = capacity;
+	}
+	for(uint32_t i = 0; i < number; i++) {
+		struct fsm_trans_row *row = &trans->rows[trans->number++];
+		memset(row, 0, sizeof(struct fsm_trans_row));
+		row->def = rows[i];
+	}
+	trans->dirty = true;
+	return 0;
+}
+
+void fsm_trans_clear(struct fsm_trans *trans) {
+	ASSERT(trans);
+	trans_table_free(trans);
+	trans->number = 0;
+	trans->dirty  = false;
+}
+
+int fsm_trans_compile(struct fsm_trans	 *trans,
+					  uint32_t			  state_number,
+					  fsm_trans_resolve_t resolve,
+					  void				 *ctx) {
+	ASSERT(trans);
+	ASSERT(resolve);
+	trans_table_free(trans);
+	trans->dirty = false;
+	// Resolve the states of every row and number the event types in use
+	uint32_t columns = 0;
+	for(uint32_t i = 0; i < trans->number; i++) {
+		struct fsm_trans_row *row = &trans->rows[i];
+		uint32_t			  unused;
+		row->source = resolve(ctx, row->def.source, &row->source_ordinal);
+		row->target = NULL;
+		row->next	= 0;
+		if(row->def.target != FSM_TARGET_NONE) {
+			row->target = resolve(ctx, row->def.target, &unused);
+			if(row->target == NULL) {
+				row->source = NULL;
+			}
+		}
+		if(row->source == NULL) {
+			continue;
+		}
+		ASSERT(row->source_ordinal < state_number);
+		if(fsm_map_get(&trans->column_index, row->def.type) == NULL) {
+			if(fsm_map_put(&trans->column_index, row->def.type, (void *)(uintptr_t)(columns + 1))
+			   != 0) {
+				goto ERROR;
+			}
+			columns++;
+		}
+	}
+	if(columns == 0) {
+		return 0;
+	}
+	trans->cells = trans->os->malloc(sizeof(uint32_t) * state_number * columns);
+	if(trans->cells == NULL) {
+		goto ERROR;
+	}
+	memset(trans->cells, 0, sizeof(uint32_t) * state_number * columns);
+	trans->states  = state_number;
+	trans->columns = columns;
+	// Push rows to the front of their cell in reverse, so every cell lists them in insertion order
+	for(uint32_t i = trans->number; i-- > 0;) {
+		struct fsm_trans_row *row = &trans->rows[i];
+		if(row->source == NULL) {
+			continue;
+		}
+		uintptr_t column = (uintptr_t)fsm_map_get(&trans->column_index, row->def.type);
+		uint32_t *cell	 = &trans->cells[row->source_ordinal * columns + (uint32_t)column - 1];
+		row->next		 = *cell;
+		*cell			 = i + 1;
+	}
+	return 0;
+ERROR:
+	trans_table_free(trans);
+	return -2;
+}
+
+const struct fsm_trans_row *fsm_trans_find(const struct fsm_trans *trans,
+										   uint32_t				   ordinal,
+										   uint32_t				   type) {
+	ASSERT(trans);
+	ASSERT(!trans->dirty);
+	if(trans->cells == NULL || ordinal >= trans->states) {
+		return NULL;
+	}
+	uintptr_t column = (uintptr_t)fsm_map_get(&trans->column_index, type);
+	if(column == 0) {
+		return NULL;
+	}
+	uint32_t idx = trans->cells[ordinal * trans->columns + (uint32_t)column - 1];
+	return idx ? &trans->rows[idx - 1] : NULL;
+}
+
+const struct fsm_trans_row *fsm_trans_next(const struct fsm_trans	  *trans,
+										   const struct fsm_trans_row *row) {
+	ASSERT(trans);
+	ASSERT(row);
+	return row->next ? &trans->rows[row->next - 1] : NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,157 @@
+/**********************************************************************************/
+/* MIT License                                                                    */
+/*                                                                                */
+/* Copyright (c) [2023] [Jerrick.Rowe]                                            */
+/*                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/* of this software and associated documentation files (the "Software"), to deal  */
+/* in the Software without restriction, including without limitation the rights   */
+/* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/* copies of the Software, and to permit persons to whom the Software is          */
+/* furnished to do so, subject to the following conditions:                       */
+/*                                                                                */
+/* The above copyright notice and this permission notice shall be included in all */
+/* copies or substantial portions of the Software.                                */
+/*                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/* SOFTWARE.                                                                      */
+/**********************************************************************************/
+
+#ifndef __STATEMACHINE_TRANSITION_H__
+#define __STATEMACHINE_TRANSITION_H__
+
+/*--- Public dependencies -------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "state_machine.h"
+#include "state_machine_port.h"
+#include "state_machine_map.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*--- Public macros -------------------------------------------------------------------*/
+
+/*--- Public type definitions ---------------------------------------------------------*/
+
+/**
+ * @brief Resolve a state ID while compiling a transition table.
+ *
+ * @param ctx Context passed to fsm_trans_compile()
+ * @param id The state ID
+ * @param ordinal Set to the position of the state, below the state_number of the compilation
+ * @return void* The state, or NULL if there is no state with this ID
+ */
+typedef void *(*fsm_trans_resolve_t)(void *ctx, uint32_t id, uint32_t *ordinal);
+
+struct fsm_trans_row {
+	struct fsm_transition def;
+	void				 *source;  // Resolved by the last compilation, NULL if the row is unused
+	void				 *target;  // NULL for FSM_TARGET_NONE
+	uint32_t			  source_ordinal;
+	uint32_t			  next;	 // Index + 1 of the next row of the same cell, 0 at the end
+};
+
+/**
+ * @brief Transition rows compiled into a dense dispatch table. Event types are numbered into
+ *        columns through a map, every (source ordinal, column) cell holds the first of the rows
+ *        for that pair, so finding the candidates of an event is two array lookups.
+ */
+struct fsm_trans {
+	struct fsm_trans_row *rows;
+	uint32_t			  number;
+	uint32_t			  capacity;
+	uint32_t			 *cells;  // states * columns, index + 1 of the first row, 0 for none
+	uint32_t			  states;
+	uint32_t			  columns;
+	struct fsm_map		  column_index;	 // Event type to column + 1
+	bool				  dirty;		 // Rows or states changed since the last compilation
+	os_handle_t			  os;
+};
+
+/*--- Public variable declarations ----------------------------------------------------*/
+
+/*--- Public function declarations ----------------------------------------------------*/
+
+/**
+ * @brief Initialize an empty transition table. Nothing is allocated.
+ *
+ * @param trans The table to initialize
+ * @param os OS handle used for allocation
+ */
+extern void fsm_trans_init(struct fsm_trans *trans, os_handle_t os);
+
+/**
+ * @brief Release all rows and the compiled table.
+ *
+ * @param trans The table to deinitialize
+ */
+extern void fsm_trans_deinit(struct fsm_trans *trans);
+
+/**
+ * @brief Append rows. The table needs to be compiled again before lookups.
+ *
+ * @param trans The table to append to
+ * @param rows The rows to copy
+ * @param number Number of rows
+ * @return int 0 on success, -2 if out of memory
+ */
+extern int fsm_trans_append(struct fsm_trans			*trans,
+							const struct fsm_transition *rows,
+							uint32_t					 number);
+
+/**
+ * @brief Remove all rows.
+ *
+ * @param trans The table to clear
+ */
+extern void fsm_trans_clear(struct fsm_trans *trans);
+
+/**
+ * @brief Compile the rows into the dispatch table. Rows whose source or target does not resolve
+ *        are left out.
+ *
+ * @param trans The table to compile
+ * @param state_number Number of state ordinals
+ * @param resolve Callback resolving state IDs
+ * @param ctx Context passed to resolve
+ * @return int 0 on success, -2 if out of memory, in which case the table is empty
+ */
+extern int fsm_trans_compile(struct fsm_trans	*trans,
+							 uint32_t			 state_number,
+							 fsm_trans_resolve_t resolve,
+							 void				*ctx);
+
+/**
+ * @brief Get the first candidate row of an event in a state. Must not be called while dirty.
+ *
+ * @param trans The compiled table
+ * @param ordinal The ordinal of the current state
+ * @param type The event type
+ * @return const struct fsm_trans_row* The first row, or NULL if no row matches
+ */
+extern const struct fsm_trans_row *fsm_trans_find(const struct fsm_trans *trans,
+												  uint32_t				  ordinal,
+												  uint32_t				  type);
+
+/**
+ * @brief Get the next candidate row after a row returned by fsm_trans_find().
+ *
+ * @param trans The compiled table
+ * @param row The current row
+ * @return const struct fsm_trans_row* The next row in insertion order, or NULL
+ */
+extern const struct fsm_trans_row *fsm_trans_next(const struct fsm_trans	 *trans,
+												  const struct fsm_trans_row *row);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// __STATEMACHINE_TRANSITION_H__
@@ -31,6 +31,8 @@
 #include "sysdelay.h"
 
 #include "../state_machine.h"
+#include "../state_machine_port.h"
+#include "../state_machine_executor.h"
 
 #include "esp_heap_caps.h"
 #define GET_HEAP_FREE_SIZE() heap_caps_get_free_size(MALLOC_CAP_8BIT)
@@ -278,6 +280,1366 @@ TEST_CASE("Test State machine features", "[fsm]") {
 	TEST_ASSERT_TRUE_MESSAGE(heap_begin - heap_end <= 336, "Memory leak test failed");
 }
 
+TEST_CASE("Steady state polling makes no heap calls", "[fsm]") {
+	fsm_t fsm		 = fsm_new("Heap FSM");
+	fsm_t child_fsm	 = fsm_new("Heap child FSM");
+	fsm_t child_fsm2 = fsm_new("Heap child FSM 2");
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, STATE_1_ID, NULL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_2_NAME, STATE_2_ID, NULL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(child_fsm, STATE_3_NAME, STATE_3_ID, NULL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(child_fsm2, STATE_3_NAME, STATE_3_ID, NULL), 0);
+	state_t state1 = fsm_get_state(fsm, STATE_1_ID);
+	TEST_ASSERT_EQUAL_INT(fsm_state_child_fsm_add(state1, child_fsm), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_child_fsm_add(state1, child_fsm2), 0);
+
+	// The first poll takes the child-FSM snapshot, after that nothing may touch the heap
+	fsm_poll(fsm);
+	uint32_t heap_calls = fsm_port_heap_calls();
+	for(int i = 0; i < 1000; i++) {
+		if(i % 100 == 50) {
+			fsm_switch(fsm, (i / 100) % 2 ? STATE_1_ID : STATE_2_ID);
+		}
+		fsm_event_send(fsm, TEST_EVENT, NULL, 0);
+		fsm_poll(fsm);
+	}
+	TEST_ASSERT_EQUAL_UINT32(heap_calls, fsm_port_heap_calls());
+
+	TEST_ASSERT_EQUAL_INT(fsm_state_child_fsm_del(state1, child_fsm), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_child_fsm_del(state1, child_fsm2), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_del(&child_fsm2), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_del(&child_fsm), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+}
+
+static int drain_event_cnt = 0;
+
+static void drain_handler(event_t event) {
+	if(event->type == TEST_EVENT) {
+		drain_event_cnt++;
+	}
+}
+
+TEST_CASE("Budgeted multi-event drain", "[fsm]") {
+	bool  pending = false;
+	fsm_t fsm	  = fsm_new("Drain FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(fsm, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, STATE_1_ID, drain_handler), 0);
+	drain_event_cnt = 0;
+
+	for(int i = 0; i < 8; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TEST_EVENT, NULL, 0), 0);
+	}
+	// Event budget runs out with events left in the queue
+	TEST_ASSERT_EQUAL_INT(fsm_poll_ex(fsm, 5, FSM_POLL_NO_LIMIT, &pending), 5);
+	TEST_ASSERT_TRUE(pending);
+	TEST_ASSERT_EQUAL_INT(drain_event_cnt, 5);
+	// Without limit the queue is drained in a single call
+	TEST_ASSERT_EQUAL_INT(fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, &pending), 3);
+	TEST_ASSERT_FALSE(pending);
+	TEST_ASSERT_EQUAL_INT(drain_event_cnt, 8);
+	TEST_ASSERT_EQUAL_INT(fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, 1000, &pending), 0);
+	TEST_ASSERT_FALSE(pending);
+
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+}
+
+TEST_CASE("State lookup with compact and sparse IDs", "[fsm]") {
+	static const uint32_t strides[] = { 1, 0x9E3779B1u };
+	for(int s = 0; s < 2; s++) {
+		fsm_t fsm = fsm_new("Index FSM");
+		for(uint32_t i = 0; i < 300; i++) {
+			TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, i * strides[s], NULL), 0);
+		}
+		TEST_ASSERT_NOT_EQUAL(fsm_state_add(fsm, STATE_1_NAME, 299 * strides[s], NULL), 0);
+		// Delete every other state, the rest must stay reachable by ID
+		for(uint32_t i = 0; i < 300; i += 2) {
+			TEST_ASSERT_EQUAL_INT(fsm_state_del(fsm, i * strides[s]), 0);
+		}
+		for(uint32_t i = 0; i < 300; i++) {
+			state_t state = fsm_get_state(fsm, i * strides[s]);
+			if(i % 2) {
+				TEST_ASSERT_NOT_NULL(state);
+				TEST_ASSERT_EQUAL_INT(fsm_switch_by_state_handle(fsm, state), 0);
+				fsm_poll(fsm);
+			} else {
+				TEST_ASSERT_NULL(state);
+				TEST_ASSERT_NOT_EQUAL(fsm_switch(fsm, i * strides[s]), 0);
+			}
+		}
+		TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+	}
+}
+
+TEST_CASE("State lookup by interned name", "[fsm]") {
+	fsm_t fsm = fsm_new("Name FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, STATE_1_ID, NULL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_2_NAME, STATE_2_ID, NULL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_2_NAME, STATE_3_ID, NULL), 0);
+	// Names are interned, a copy of the string resolves to the same state
+	char name[sizeof(STATE_2_NAME)];
+	strcpy(name, STATE_2_NAME);
+	TEST_ASSERT_EQUAL_PTR(fsm_get_state_by_name(fsm, name), fsm_get_state(fsm, STATE_2_ID));
+	TEST_ASSERT_EQUAL_PTR(fsm_name_find(name), fsm_name_find(STATE_2_NAME));
+	TEST_ASSERT_NULL(fsm_get_state_by_name(fsm, "No such state"));
+	TEST_ASSERT_NOT_EQUAL(fsm_switch_by_name(fsm, "No such state"), 0);
+	// Duplicate names resolve to the first registered state still present
+	TEST_ASSERT_EQUAL_INT(fsm_state_del_by_name(fsm, STATE_2_NAME), 0);
+	TEST_ASSERT_EQUAL_PTR(fsm_get_state_by_name(fsm, STATE_2_NAME), fsm_get_state(fsm, STATE_3_ID));
+	TEST_ASSERT_EQUAL_INT(fsm_state_del_by_name(fsm, STATE_2_NAME), 0);
+	TEST_ASSERT_NULL(fsm_get_state_by_name(fsm, STATE_2_NAME));
+	TEST_ASSERT_EQUAL_INT(fsm_switch_by_name(fsm, STATE_1_NAME), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+}
+
+TEST_CASE("Non-blocking event send", "[fsm]") {
+	bool	 pending = false;
+	uint32_t queued	 = 0;
+	fsm_t	 fsm	 = fsm_new("Mailbox FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(fsm, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, STATE_1_ID, drain_handler), 0);
+	fsm_poll(fsm);
+	drain_event_cnt = 0;
+
+	// Fill the event queue, try-send fails instead of blocking once it is full
+	while(fsm_event_try_send(fsm, TEST_EVENT, NULL, 0) == 0) {
+		queued++;
+		TEST_ASSERT_LESS_THAN_UINT32(1024, queued);
+	}
+	TEST_ASSERT_GREATER_THAN_UINT32(0, queued);
+	TEST_ASSERT_NOT_EQUAL(fsm_event_send_timeout(fsm, TEST_EVENT, NULL, 0, 10), 0);
+	// Events are delivered in order and the queue accepts new events after draining
+	TEST_ASSERT_EQUAL_INT(fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, &pending), queued);
+	TEST_ASSERT_FALSE(pending);
+	TEST_ASSERT_EQUAL_INT(drain_event_cnt, queued);
+	TEST_ASSERT_EQUAL_INT(fsm_event_try_send(fsm, TEST_EVENT, NULL, 0), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_event_clear(fsm), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, &pending), 0);
+
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+}
+
+struct blocked_sender {
+	fsm_t	 fsm;
+	int		 ret;
+	uint32_t done_ms;
+};
+
+static void blocked_sender_main(void *arg) {
+	struct blocked_sender *sender = arg;
+	sender->ret		= fsm_event_send_timeout(sender->fsm, TEST_EVENT, NULL, 0, 5000);
+	sender->done_ms = fsm_port_os_handle.uptime_ms();
+}
+
+TEST_CASE("Blocking send wakes up when the queue drains", "[fsm]") {
+	os_handle_t			  os	 = (os_handle_t)&fsm_port_os_handle;
+	struct blocked_sender sender = { 0 };
+	sender.fsm					 = fsm_new("Blocked FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(sender.fsm, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(sender.fsm, STATE_1_NAME, STATE_1_ID, drain_handler), 0);
+	fsm_poll(sender.fsm);
+	while(fsm_event_try_send(sender.fsm, TEST_EVENT, NULL, 0) == 0) {
+	}
+	void *thread = os->thread_create("fsm_blocked", blocked_sender_main, &sender);
+	TEST_ASSERT_NOT_NULL(thread);
+	sysdelay_ms(20);
+	// Taking one event lets the sender in long before its timeout
+	uint32_t popped_ms = os->uptime_ms();
+	TEST_ASSERT_EQUAL_INT(fsm_poll_ex(sender.fsm, 1, FSM_POLL_NO_LIMIT, NULL), 1);
+	os->thread_join(thread);
+	TEST_ASSERT_EQUAL_INT(0, sender.ret);
+	TEST_ASSERT_LESS_THAN_UINT32(1000, sender.done_ms - popped_ms);
+	TEST_ASSERT_EQUAL_INT(fsm_event_clear(sender.fsm), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_del(&sender.fsm), 0);
+}
+
+static int wakeup_cnt = 0;
+
+static void wakeup_hook(fsm_t fsm, void *arg) {
+	(*(int *)arg)++;
+}
+
+TEST_CASE("Next deadline and wakeup hook", "[fsm]") {
+	fsm_t fsm	= fsm_new("Deadline FSM");
+	fsm_t child = fsm_new("Deadline child FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(fsm, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(child, 50), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, STATE_1_ID, NULL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(child, STATE_3_NAME, STATE_3_ID, NULL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_set_wakeup(fsm, wakeup_hook, &wakeup_cnt), 0);
+	wakeup_cnt = 0;
+
+	// Pending transition into the first state
+	TEST_ASSERT_EQUAL_UINT32(fsm_next_deadline(fsm), 0);
+	fsm_poll(fsm);
+	TEST_ASSERT_EQUAL_UINT32(fsm_next_deadline(fsm), FSM_NO_DEADLINE);
+	// Child FSM deadlines count once the child is attached to the current state
+	TEST_ASSERT_EQUAL_INT(fsm_state_child_fsm_add(fsm_get_state(fsm, STATE_1_ID), child), 0);
+	TEST_ASSERT_EQUAL_UINT32(fsm_next_deadline(fsm), 0);
+	fsm_poll(fsm);
+	uint32_t deadline = fsm_next_deadline(fsm);
+	TEST_ASSERT_GREATER_THAN_UINT32(0, deadline);
+	TEST_ASSERT_LESS_THAN_UINT32(51, deadline);
+	// Events sent to the child wake up the runner of the parent
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(child, TEST_EVENT, NULL, 0), 0);
+	TEST_ASSERT_EQUAL_INT(wakeup_cnt, 1);
+	TEST_ASSERT_EQUAL_UINT32(fsm_next_deadline(fsm), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_switch(fsm, STATE_1_ID), 0);
+	TEST_ASSERT_EQUAL_INT(wakeup_cnt, 2);
+	// A new hook comes with its own argument, a removed hook is not called any more
+	int other_cnt = 0;
+	TEST_ASSERT_EQUAL_INT(fsm_set_wakeup(fsm, wakeup_hook, &other_cnt), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(child, TEST_EVENT, NULL, 0), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_set_wakeup(fsm, NULL, NULL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(child, TEST_EVENT, NULL, 0), 0);
+	TEST_ASSERT_EQUAL_INT(wakeup_cnt, 2);
+	TEST_ASSERT_EQUAL_INT(other_cnt, 1);
+
+	TEST_ASSERT_EQUAL_INT(fsm_del(&child), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+}
+
+#define TIMER_ONESHOT  0xA600
+#define TIMER_PERIODIC 0xA601
+
+static int timer_oneshot_cnt  = 0;
+static int timer_periodic_cnt = 0;
+
+static void timer_handler(event_t event) {
+	switch(event->type) {
+	case TIMER_ONESHOT: timer_oneshot_cnt++; break;
+	case TIMER_PERIODIC: timer_periodic_cnt++; break;
+	default: break;
+	}
+}
+
+TEST_CASE("State timers", "[fsm]") {
+	fsm_t fsm = fsm_new("Timer FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(fsm, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, STATE_1_ID, timer_handler), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_2_NAME, STATE_2_ID, timer_handler), 0);
+	state_t state1	   = fsm_get_state(fsm, STATE_1_ID);
+	timer_oneshot_cnt  = 0;
+	timer_periodic_cnt = 0;
+	fsm_poll(fsm);
+
+	TEST_ASSERT_EQUAL_INT(fsm_timer_start(state1, TIMER_ONESHOT, 30, 0), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_timer_start(state1, TIMER_PERIODIC, 10, 10), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_timer_start(state1, 0xA602, 100000, 0), 0);
+	TEST_ASSERT_LESS_THAN_UINT32(11, fsm_next_deadline(fsm));
+	for(int i = 0; i < 55; i++) {
+		sysdelay_ms(1);
+		fsm_poll(fsm);
+	}
+	TEST_ASSERT_EQUAL_INT(timer_oneshot_cnt, 1);
+	TEST_ASSERT_GREATER_THAN(2, timer_periodic_cnt);
+	TEST_ASSERT_LESS_THAN(7, timer_periodic_cnt);
+	TEST_ASSERT_EQUAL_INT(fsm_timer_stop(state1, TIMER_ONESHOT), -1);
+	TEST_ASSERT_EQUAL_INT(fsm_timer_stop(state1, 0xA602), 0);
+	// Leaving the state cancels its timers
+	TEST_ASSERT_EQUAL_INT(fsm_switch(fsm, STATE_2_ID), 0);
+	fsm_poll(fsm);
+	int periodic_cnt = timer_periodic_cnt;
+	TEST_ASSERT_EQUAL_UINT32(fsm_next_deadline(fsm), FSM_NO_DEADLINE);
+	for(int i = 0; i < 30; i++) {
+		sysdelay_ms(1);
+		fsm_poll(fsm);
+	}
+	TEST_ASSERT_EQUAL_INT(timer_periodic_cnt, periodic_cnt);
+	TEST_ASSERT_EQUAL_INT(fsm_timer_stop(state1, TIMER_PERIODIC), -1);
+
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+}
+
+#define EXEC_FSM_NUMBER 4
+#define EXEC_EVENTS		200
+
+struct exec_ctx {
+	int busy;
+	int events;
+	int polls;
+	int overlaps;
+};
+
+static void exec_handler(event_t event) {
+	if(event->type == TEST_EVENT) {
+		struct exec_ctx *ctx = event->data;
+		if(__atomic_exchange_n(&ctx->busy, 1, __ATOMIC_ACQ_REL)) {
+			__atomic_add_fetch(&ctx->overlaps, 1, __ATOMIC_RELAXED);
+		}
+		__atomic_add_fetch(&ctx->events, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&ctx->busy, 0, __ATOMIC_RELEASE);
+	}
+}
+
+static struct exec_ctx exec_poll_ctx;
+
+static void exec_poll_handler(event_t event) {
+	if(event->type == FSM_EVT_POLL) {
+		__atomic_add_fetch(&exec_poll_ctx.polls, 1, __ATOMIC_RELAXED);
+	}
+}
+
+TEST_CASE("Executor runs FSMs on worker threads", "[fsm]") {
+	struct exec_ctx			  ctx[EXEC_FSM_NUMBER];
+	fsm_t					  fsm[EXEC_FSM_NUMBER];
+	struct fsm_executor_stats stats;
+	fsm_executor_t			  executor = fsm_executor_new(2);
+	TEST_ASSERT_NOT_NULL(executor);
+	memset(ctx, 0, sizeof(ctx));
+	memset(&exec_poll_ctx, 0, sizeof(exec_poll_ctx));
+	for(int i = 0; i < EXEC_FSM_NUMBER; i++) {
+		fsm[i] = fsm_new("Executor FSM");
+		TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(fsm[i], FSM_NO_POLL), 0);
+		TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm[i], STATE_1_NAME, STATE_1_ID, exec_handler), 0);
+		TEST_ASSERT_EQUAL_INT(fsm_executor_add(executor, fsm[i]), 0);
+	}
+	fsm_t poll_fsm = fsm_new("Executor polled FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(poll_fsm, 10), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(poll_fsm, STATE_1_NAME, STATE_1_ID, exec_poll_handler), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_executor_add(executor, poll_fsm), 0);
+
+	for(int n = 0; n < EXEC_EVENTS; n++) {
+		for(int i = 0; i < EXEC_FSM_NUMBER; i++) {
+			TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm[i], TEST_EVENT, &ctx[i], 0), 0);
+		}
+	}
+	int done = 0;
+	for(int t = 0; t < 2000 && done < EXEC_FSM_NUMBER; t++) {
+		sysdelay_ms(1);
+		done = 0;
+		for(int i = 0; i < EXEC_FSM_NUMBER; i++) {
+			done += __atomic_load_n(&ctx[i].events, __ATOMIC_RELAXED) == EXEC_EVENTS;
+		}
+	}
+	sysdelay_ms(100);
+	for(int i = 0; i < EXEC_FSM_NUMBER; i++) {
+		TEST_ASSERT_EQUAL_INT(__atomic_load_n(&ctx[i].events, __ATOMIC_RELAXED), EXEC_EVENTS);
+		TEST_ASSERT_EQUAL_INT(__atomic_load_n(&ctx[i].overlaps, __ATOMIC_RELAXED), 0);
+	}
+	// Polling events are generated on the deadlines reported by the FSM
+	TEST_ASSERT_GREATER_THAN(3, __atomic_load_n(&exec_poll_ctx.polls, __ATOMIC_RELAXED));
+	fsm_executor_get_stats(executor, &stats);
+	TEST_ASSERT_EQUAL_UINT32(stats.workers, 2);
+	TEST_ASSERT_EQUAL_UINT32(stats.fsm_number, EXEC_FSM_NUMBER + 1);
+	TEST_ASSERT_GREATER_THAN_UINT32(EXEC_FSM_NUMBER * EXEC_EVENTS - 1, stats.events);
+	TEST_ASSERT_EQUAL_UINT32(stats.timed, 1);
+
+	TEST_ASSERT_EQUAL_INT(fsm_executor_remove(executor, poll_fsm), 0);
+	TEST_ASSERT_NOT_EQUAL(fsm_executor_remove(executor, poll_fsm), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_executor_del(&executor), 0);
+	TEST_ASSERT_NULL(executor);
+	for(int i = 0; i < EXEC_FSM_NUMBER; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_del(&fsm[i]), 0);
+	}
+	TEST_ASSERT_EQUAL_INT(fsm_del(&poll_fsm), 0);
+}
+
+struct exec_sender {
+	fsm_t	 fsm;
+	uint32_t stop;
+	uint32_t sent;
+};
+
+static void exec_sender_main(void *arg) {
+	struct exec_sender *sender = arg;
+	while(__atomic_load_n(&sender->stop, __ATOMIC_ACQUIRE) == 0) {
+		if(fsm_event_try_send(sender->fsm, TEST_EVENT + 1, NULL, 0) == 0) {
+			__atomic_add_fetch(&sender->sent, 1, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+TEST_CASE("Executor deletion races with senders", "[fsm]") {
+	os_handle_t os = (os_handle_t)&fsm_port_os_handle;
+	for(int round = 0; round < 20; round++) {
+		struct exec_sender sender	= { 0 };
+		fsm_executor_t	   executor = fsm_executor_new(2);
+		TEST_ASSERT_NOT_NULL(executor);
+		sender.fsm = fsm_new("Executor race FSM");
+		TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(sender.fsm, FSM_NO_POLL), 0);
+		TEST_ASSERT_EQUAL_INT(fsm_state_add(sender.fsm, STATE_1_NAME, STATE_1_ID, NULL), 0);
+		TEST_ASSERT_EQUAL_INT(fsm_executor_add(executor, sender.fsm), 0);
+		void *thread = os->thread_create("fsm_sender", exec_sender_main, &sender);
+		TEST_ASSERT_NOT_NULL(thread);
+		while(__atomic_load_n(&sender.sent, __ATOMIC_RELAXED) < 10) {
+			sysdelay_ms(1);
+		}
+		// The sender keeps waking up the executor while it goes away
+		TEST_ASSERT_EQUAL_INT(fsm_executor_del(&executor), 0);
+		__atomic_store_n(&sender.stop, 1, __ATOMIC_RELEASE);
+		os->thread_join(thread);
+		TEST_ASSERT_EQUAL_INT(fsm_del(&sender.fsm), 0);
+	}
+}
+
+static int static_enters;
+static int static_exits;
+static int static_events;
+
+static void static_enter(event_t event) {
+	if(event->type == FSM_EVT_ENTER) {
+		static_enters++;
+	}
+}
+
+static void static_exit(event_t event) {
+	if(event->type == FSM_EVT_EXIT) {
+		static_exits++;
+	}
+}
+
+static void static_handler(event_t event) {
+	TEST_ASSERT_NOT_EQUAL(FSM_EVT_EXIT, event->type);  // Routed to static_exit
+	if(event->type == TEST_EVENT) {
+		static_events++;
+	}
+}
+
+static const struct state_def static_states[] = {
+	STATE(STATE_1_ID, STATE_1_NAME, static_enter, static_handler, static_exit),
+	STATE(STATE_2_ID, STATE_2_NAME, NULL, static_handler, static_exit),
+};
+
+TEST_CASE("Static FSM from a state table", "[fsm]") {
+	static FSM_STATIC_STORAGE(storage, 2);
+	uint64_t small[8];
+	TEST_ASSERT_NULL(fsm_init_static("Static FSM", static_states, 2, small, sizeof(small)));
+
+	static_enters = 0;
+	static_exits  = 0;
+	static_events = 0;
+	uint32_t heap_calls = fsm_port_heap_calls();
+	fsm_t	 fsm		= fsm_init_static("Static FSM", static_states, 2, storage, sizeof(storage));
+	TEST_ASSERT_NOT_NULL(fsm);
+	TEST_ASSERT_EQUAL_PTR(fsm_get_state(fsm, STATE_2_ID), fsm_get_state_by_name(fsm, STATE_2_NAME));
+	fsm_poll(fsm);
+	TEST_ASSERT_EQUAL_INT(1, static_enters);
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TEST_EVENT, NULL, 0), 0);
+	fsm_poll(fsm);
+	TEST_ASSERT_EQUAL_INT(1, static_events);
+	TEST_ASSERT_EQUAL_INT(fsm_switch(fsm, STATE_2_ID), 0);
+	fsm_poll(fsm);
+	TEST_ASSERT_EQUAL_INT(1, static_enters);
+	TEST_ASSERT_EQUAL_INT(1, static_exits);
+	// States of the table are not deleted
+	TEST_ASSERT_NOT_EQUAL(0, fsm_state_del(fsm, STATE_1_ID));
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+	TEST_ASSERT_NULL(fsm);
+	TEST_ASSERT_EQUAL_UINT32(heap_calls, fsm_port_heap_calls());
+}
+
+#define TRANS_EVT_GO	   0xB001
+#define TRANS_EVT_INTERNAL 0xB002
+#define TRANS_STATE_4_ID   81
+
+static int trans_actions;
+static int trans_handled;
+
+static bool trans_guard_false(event_t event) {
+	return false;
+}
+
+static void trans_action(event_t event) {
+	trans_actions++;
+}
+
+static void trans_handler(event_t event) {
+	if(event->type == TEST_EVENT || event->type == TRANS_EVT_GO) {
+		trans_handled++;
+	}
+}
+
+static const struct fsm_transition trans_table[] = {
+	TRANSITION(STATE_1_ID, TRANS_EVT_GO, NULL, trans_action, STATE_2_ID),
+	TRANSITION(STATE_2_ID, TRANS_EVT_GO, trans_guard_false, trans_action, STATE_1_ID),
+	TRANSITION(STATE_2_ID, TRANS_EVT_GO, NULL, NULL, STATE_3_ID),
+	TRANSITION(STATE_3_ID, TRANS_EVT_INTERNAL, NULL, trans_action, FSM_TARGET_NONE),
+};
+
+static uint32_t trans_current(fsm_t fsm) {
+	struct state_info info;
+	fsm_get_current_state(fsm, &info);
+	return info.id;
+}
+
+TEST_CASE("Transition table dispatch", "[fsm]") {
+	fsm_t fsm = fsm_new("Transition FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(fsm, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, STATE_1_ID, trans_handler), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_2_NAME, STATE_2_ID, trans_handler), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_3_NAME, STATE_3_ID, trans_handler), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_transition_add(fsm, trans_table, 4), 0);
+	struct fsm_transition bad[] = {
+		TRANSITION(TRANS_STATE_4_ID, TRANS_EVT_GO, NULL, NULL, STATE_1_ID),
+		TRANSITION(STATE_1_ID, FSM_EVT_ENTER, NULL, NULL, STATE_2_ID),
+	};
+	TEST_ASSERT_EQUAL_INT(fsm_transition_add(fsm, &bad[0], 1), -1);
+	TEST_ASSERT_EQUAL_INT(fsm_transition_add(fsm, &bad[1], 1), -1);
+	trans_actions = 0;
+	trans_handled = 0;
+	fsm_poll(fsm);
+	TEST_ASSERT_EQUAL_UINT32(STATE_1_ID, trans_current(fsm));
+
+	// Unconditional row, the action runs instead of the handler
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TRANS_EVT_GO, NULL, 0), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	fsm_poll(fsm);
+	TEST_ASSERT_EQUAL_UINT32(STATE_2_ID, trans_current(fsm));
+	TEST_ASSERT_EQUAL_INT(1, trans_actions);
+	TEST_ASSERT_EQUAL_INT(0, trans_handled);
+	// Rows are tried in order until a guard passes
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TRANS_EVT_GO, NULL, 0), 0);
+	fsm_poll(fsm);
+	fsm_poll(fsm);
+	TEST_ASSERT_EQUAL_UINT32(STATE_3_ID, trans_current(fsm));
+	TEST_ASSERT_EQUAL_INT(1, trans_actions);
+	// Internal transition and unmatched events
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TRANS_EVT_INTERNAL, NULL, 0), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TRANS_EVT_GO, NULL, 0), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TEST_EVENT, NULL, 0), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	TEST_ASSERT_EQUAL_UINT32(STATE_3_ID, trans_current(fsm));
+	TEST_ASSERT_EQUAL_INT(2, trans_actions);
+	TEST_ASSERT_EQUAL_INT(2, trans_handled);
+
+	// States added later are picked up by the next compilation
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, "Test state 4", TRANS_STATE_4_ID, trans_handler), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_transition_add(fsm, bad, 1), 0);
+	struct fsm_transition to_4 = TRANSITION(STATE_3_ID, TRANS_EVT_GO, NULL, NULL, TRANS_STATE_4_ID);
+	TEST_ASSERT_EQUAL_INT(fsm_transition_add(fsm, &to_4, 1), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TRANS_EVT_GO, NULL, 0), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	TEST_ASSERT_EQUAL_UINT32(TRANS_STATE_4_ID, trans_current(fsm));
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TRANS_EVT_GO, NULL, 0), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	TEST_ASSERT_EQUAL_UINT32(STATE_1_ID, trans_current(fsm));
+
+	// Without rows every event reaches the handler again
+	TEST_ASSERT_EQUAL_INT(fsm_transition_clear(fsm), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TRANS_EVT_GO, NULL, 0), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	TEST_ASSERT_EQUAL_UINT32(STATE_1_ID, trans_current(fsm));
+	TEST_ASSERT_EQUAL_INT(3, trans_handled);
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+}
+
+#define COPY_EVT 0x0C0
+
+static uint32_t copy_received;
+static uint32_t copy_sum;
+
+static void copy_handler(event_t event) {
+	if(event->type != COPY_EVT) {
+		return;
+	}
+	const uint8_t *data = event->data;
+	copy_received++;
+	for(uint32_t i = 0; i < event->datalen; i++) {
+		copy_sum += data[i];
+	}
+}
+
+TEST_CASE("Copied event payloads", "[fsm]") {
+	fsm_t fsm		= fsm_new("Copy FSM");
+	fsm_t child_fsm = fsm_new("Copy child FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(fsm, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(child_fsm, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, STATE_1_ID, copy_handler), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(child_fsm, STATE_3_NAME, STATE_3_ID, copy_handler), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_child_fsm_add(fsm_get_state(fsm, STATE_1_ID), child_fsm), 0);
+	fsm_poll(fsm);
+
+	// The sender's buffer may be reused as soon as the call returns
+	uint8_t buf[256];
+	memset(buf, 1, sizeof(buf));
+	copy_received = 0;
+	copy_sum	  = 0;
+	TEST_ASSERT_EQUAL_INT(fsm_event_send_copy(fsm, COPY_EVT, buf, 16), 0);
+	memset(buf, 0, sizeof(buf));
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	fsm_poll_ex(child_fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	TEST_ASSERT_EQUAL_UINT32(2, copy_received);
+	TEST_ASSERT_EQUAL_UINT32(2 * 16, copy_sum);
+
+	// Larger payloads go through the pool, which makes no heap calls once allocated
+	memset(buf, 2, sizeof(buf));
+	TEST_ASSERT_EQUAL_INT(fsm_event_send_copy(fsm, COPY_EVT, buf, sizeof(buf)), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	fsm_poll_ex(child_fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	uint32_t heap_calls = fsm_port_heap_calls();
+	copy_received		= 0;
+	copy_sum			= 0;
+	for(int i = 0; i < 100; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_event_send_copy(fsm, COPY_EVT, buf, 100), 0);
+		memset(buf, 0, sizeof(buf));
+		fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+		fsm_poll_ex(child_fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+		memset(buf, 2, sizeof(buf));
+	}
+	TEST_ASSERT_EQUAL_UINT32(heap_calls, fsm_port_heap_calls());
+	TEST_ASSERT_EQUAL_UINT32(200, copy_received);
+	TEST_ASSERT_EQUAL_UINT32(200 * 100 * 2, copy_sum);
+
+	// Blocks are returned when events are handled or cleared
+	TEST_ASSERT_EQUAL_INT(fsm_event_send_copy(fsm, COPY_EVT, buf, sizeof(buf) + 1), -2);
+	for(int i = 0; i < 8; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_event_send_copy(fsm, COPY_EVT, buf, 100), 0);
+	}
+	TEST_ASSERT_EQUAL_INT(fsm_event_send_copy(fsm, COPY_EVT, buf, 100), -2);
+	TEST_ASSERT_EQUAL_INT(fsm_event_clear(fsm), 0);
+	for(int i = 0; i < 8; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_event_send_copy(fsm, COPY_EVT, buf, 100), 0);
+	}
+
+	TEST_ASSERT_EQUAL_INT(fsm_state_child_fsm_del(fsm_get_state(fsm, STATE_1_ID), child_fsm), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_del(&child_fsm), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+}
+
+#define PRIO_EVT_HIGH 0x0D0
+#define PRIO_EVT_LOW  0x0D1
+
+static uint32_t prio_seq[32];
+static uint32_t prio_seq_len;
+
+static void prio_handler(event_t event) {
+	if((event->type == PRIO_EVT_HIGH || event->type == PRIO_EVT_LOW || event->type == TEST_EVENT)
+	   && prio_seq_len < 32) {
+		prio_seq[prio_seq_len++] = event->type;
+	}
+}
+
+TEST_CASE("Priority event lanes", "[fsm]") {
+	fsm_t fsm = fsm_new("Priority FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(fsm, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, STATE_1_ID, prio_handler), 0);
+	fsm_poll(fsm);
+
+	// An urgent event overtakes the backlog of the other lanes
+	prio_seq_len = 0;
+	for(int i = 0; i < 4; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_event_send_prio(fsm, FSM_PRIO_LOW, PRIO_EVT_LOW, NULL, 0, 0), 0);
+		TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TEST_EVENT, NULL, 0), 0);
+	}
+	TEST_ASSERT_EQUAL_INT(fsm_event_send_prio(fsm, FSM_PRIO_HIGH, PRIO_EVT_HIGH, NULL, 0, 0), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	TEST_ASSERT_EQUAL_UINT32(9, prio_seq_len);
+	TEST_ASSERT_EQUAL_UINT32(PRIO_EVT_HIGH, prio_seq[0]);
+	for(int i = 1; i < 5; i++) {
+		TEST_ASSERT_EQUAL_UINT32(TEST_EVENT, prio_seq[i]);
+		TEST_ASSERT_EQUAL_UINT32(PRIO_EVT_LOW, prio_seq[i + 4]);
+	}
+
+	// A lane that is full does not block without a timeout
+	int ret;
+	for(int i = 0; i < 4; i++) {
+		ret = fsm_event_send_prio(fsm, FSM_PRIO_HIGH, PRIO_EVT_HIGH, NULL, 0, 0);
+		TEST_ASSERT_EQUAL_INT(0, ret);
+	}
+	ret = fsm_event_send_prio(fsm, FSM_PRIO_HIGH, PRIO_EVT_HIGH, NULL, 0, 0);
+	TEST_ASSERT_EQUAL_INT(-1, ret);
+
+	// A steady stream of urgent events does not starve the low lane
+	prio_seq_len = 0;
+	TEST_ASSERT_EQUAL_INT(fsm_event_send_prio(fsm, FSM_PRIO_LOW, PRIO_EVT_LOW, NULL, 0, 0), 0);
+	for(int i = 0; i < 20; i++) {
+		fsm_poll(fsm);
+		fsm_event_send_prio(fsm, FSM_PRIO_HIGH, PRIO_EVT_HIGH, NULL, 0, 0);
+	}
+	uint32_t low_at = 32;
+	for(uint32_t i = 0; i < prio_seq_len; i++) {
+		if(prio_seq[i] == PRIO_EVT_LOW) {
+			low_at = i;
+		}
+	}
+	TEST_ASSERT_EQUAL_UINT32(8, low_at);
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+}
+
+static uint32_t poll_seq[32];
+static uint32_t poll_seq_len;
+
+static void poll_order_handler(event_t event) {
+	if((event->type == FSM_EVT_POLL || event->type == TEST_EVENT) && poll_seq_len < 32) {
+		poll_seq[poll_seq_len++] = event->type;
+	}
+}
+
+TEST_CASE("Poll events take no queue slot", "[fsm]") {
+	fsm_t fsm = fsm_new("Poll order FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(fsm, 20), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, STATE_1_ID, poll_order_handler), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+
+	// A full queue neither drops the poll nor loses a slot to it, and the poll that became due
+	// behind the queued events is handled after them
+	poll_seq_len = 0;
+	for(int i = 0; i < 16; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_event_try_send(fsm, TEST_EVENT, NULL, 0), 0);
+	}
+	TEST_ASSERT_EQUAL_INT(fsm_event_try_send(fsm, TEST_EVENT, NULL, 0), -1);
+	sysdelay_ms(25);
+	TEST_ASSERT_EQUAL_UINT32(0, fsm_next_deadline(fsm));
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	TEST_ASSERT_EQUAL_UINT32(17, poll_seq_len);
+	for(int i = 0; i < 16; i++) {
+		TEST_ASSERT_EQUAL_UINT32(TEST_EVENT, poll_seq[i]);
+	}
+	TEST_ASSERT_EQUAL_UINT32(FSM_EVT_POLL, poll_seq[16]);
+
+	// Clearing the queue also drops a pending poll
+	sysdelay_ms(25);
+	TEST_ASSERT_EQUAL_INT(fsm_event_try_send(fsm, TEST_EVENT, NULL, 0), 0);
+	fsm_poll(fsm);
+	TEST_ASSERT_EQUAL_UINT32(18, poll_seq_len);
+	TEST_ASSERT_EQUAL_INT(fsm_event_clear(fsm), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	TEST_ASSERT_EQUAL_UINT32(18, poll_seq_len);
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+}
+
+static fsm_t	rtc_fsm;
+static uint32_t rtc_enters;
+static bool		rtc_ping_pong;
+
+static void rtc_handler_1(event_t event) {
+	if(event->type == FSM_EVT_ENTER) {
+		rtc_enters++;
+		if(rtc_ping_pong) {
+			fsm_switch(rtc_fsm, STATE_2_ID);
+		}
+	} else if(event->type == TEST_EVENT) {
+		fsm_switch(rtc_fsm, STATE_2_ID);
+	}
+}
+
+static void rtc_handler_2(event_t event) {
+	if(event->type == FSM_EVT_ENTER) {
+		rtc_enters++;
+		// Chained switch from an enter handler
+		fsm_switch(rtc_fsm, rtc_ping_pong ? STATE_1_ID : STATE_3_ID);
+	}
+}
+
+static void rtc_handler_3(event_t event) {
+	if(event->type == FSM_EVT_ENTER) {
+		rtc_enters++;
+	}
+}
+
+TEST_CASE("Run-to-completion transitions", "[fsm]") {
+	rtc_fsm = fsm_new("RTC FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(rtc_fsm, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(rtc_fsm, STATE_1_NAME, STATE_1_ID, rtc_handler_1), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(rtc_fsm, STATE_2_NAME, STATE_2_ID, rtc_handler_2), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(rtc_fsm, STATE_3_NAME, STATE_3_ID, rtc_handler_3), 0);
+	rtc_ping_pong = false;
+	rtc_enters	  = 0;
+	fsm_poll(rtc_fsm);
+	TEST_ASSERT_EQUAL_UINT32(STATE_1_ID, trans_current(rtc_fsm));
+
+	// Without the mode a switch from a handler waits for the next poll
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(rtc_fsm, TEST_EVENT, NULL, 0), 0);
+	fsm_poll(rtc_fsm);
+	TEST_ASSERT_EQUAL_UINT32(STATE_1_ID, trans_current(rtc_fsm));
+	fsm_poll(rtc_fsm);
+	fsm_poll(rtc_fsm);
+	TEST_ASSERT_EQUAL_UINT32(STATE_3_ID, trans_current(rtc_fsm));
+
+	// The switch and the chained one complete within the poll that handled the event
+	TEST_ASSERT_EQUAL_INT(fsm_set_run_to_completion(rtc_fsm, 4), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_switch(rtc_fsm, STATE_1_ID), 0);
+	fsm_poll(rtc_fsm);
+	TEST_ASSERT_EQUAL_UINT32(STATE_1_ID, trans_current(rtc_fsm));
+	rtc_enters = 0;
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(rtc_fsm, TEST_EVENT, NULL, 0), 0);
+	fsm_poll(rtc_fsm);
+	TEST_ASSERT_EQUAL_UINT32(STATE_3_ID, trans_current(rtc_fsm));
+	TEST_ASSERT_EQUAL_UINT32(2, rtc_enters);
+
+	// Requests from outside are queued instead of ignored
+	rtc_enters = 0;
+	TEST_ASSERT_EQUAL_INT(fsm_switch(rtc_fsm, STATE_1_ID), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_switch(rtc_fsm, STATE_3_ID), 0);
+	fsm_poll(rtc_fsm);
+	TEST_ASSERT_EQUAL_UINT32(STATE_3_ID, trans_current(rtc_fsm));
+	TEST_ASSERT_EQUAL_UINT32(2, rtc_enters);
+
+	// Endless chains stop at the bound and continue on the next poll
+	rtc_ping_pong = true;
+	rtc_enters	  = 0;
+	TEST_ASSERT_EQUAL_INT(fsm_switch(rtc_fsm, STATE_1_ID), 0);
+	fsm_poll(rtc_fsm);
+	TEST_ASSERT_EQUAL_UINT32(5, rtc_enters);
+	TEST_ASSERT_EQUAL_UINT32(0, fsm_next_deadline(rtc_fsm));
+	rtc_ping_pong = false;
+	fsm_poll(rtc_fsm);
+	TEST_ASSERT_EQUAL_UINT32(STATE_3_ID, trans_current(rtc_fsm));
+	TEST_ASSERT_EQUAL_INT(fsm_del(&rtc_fsm), 0);
+}
+
+#define FANOUT_CHILDREN 3
+
+static const void *fanout_data[FANOUT_CHILDREN + 1];
+static uint8_t	   fanout_last[FANOUT_CHILDREN + 1];
+static uint32_t	   fanout_received;
+
+static void fanout_handler(event_t event) {
+	if(event->type == COPY_EVT && fanout_received < FANOUT_CHILDREN + 1) {
+		fanout_data[fanout_received] = event->data;
+		fanout_last[fanout_received] = ((const uint8_t *)event->data)[event->datalen - 1];
+		fanout_received++;
+	}
+}
+
+TEST_CASE("Refcounted fan-out to child FSMs", "[fsm]") {
+	fsm_t fsm = fsm_new("Fan-out FSM");
+	fsm_t children[FANOUT_CHILDREN];
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(fsm, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, STATE_1_ID, fanout_handler), 0);
+	state_t state1 = fsm_get_state(fsm, STATE_1_ID);
+	for(int i = 0; i < FANOUT_CHILDREN; i++) {
+		children[i] = fsm_new("Fan-out child FSM");
+		TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(children[i], FSM_NO_POLL), 0);
+		TEST_ASSERT_EQUAL_INT(fsm_state_add(children[i], STATE_3_NAME, STATE_3_ID, fanout_handler),
+							  0);
+		TEST_ASSERT_EQUAL_INT(fsm_state_child_fsm_add(state1, children[i]), 0);
+	}
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+
+	// Every child sees the parent's block, nothing is copied or allocated per child
+	uint8_t buf[100];
+	memset(buf, 3, sizeof(buf));
+	TEST_ASSERT_EQUAL_INT(fsm_event_send_copy(fsm, COPY_EVT, buf, sizeof(buf)), 0);
+	uint32_t heap_calls = fsm_port_heap_calls();
+	for(int round = 0; round < 20; round++) {
+		fanout_received = 0;
+		if(round > 0) {
+			TEST_ASSERT_EQUAL_INT(fsm_event_send_copy(fsm, COPY_EVT, buf, sizeof(buf)), 0);
+		}
+		fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+		TEST_ASSERT_EQUAL_UINT32(FANOUT_CHILDREN + 1, fanout_received);
+		for(int i = 1; i <= FANOUT_CHILDREN; i++) {
+			TEST_ASSERT_EQUAL_PTR(fanout_data[0], fanout_data[i]);
+		}
+	}
+	TEST_ASSERT_EQUAL_UINT32(heap_calls, fsm_port_heap_calls());
+
+	// A full child drops the event at once instead of stalling the parent
+	for(int i = 0; i < 16; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_event_try_send(children[1], TEST_EVENT, NULL, 0), 0);
+	}
+	TEST_ASSERT_EQUAL_INT(fsm_event_send_copy(fsm, COPY_EVT, buf, sizeof(buf)), 0);
+	fanout_received = 0;
+	uint32_t ts		= fsm_port_os_handle.uptime_ms();
+	fsm_poll(fsm);
+	TEST_ASSERT_LESS_THAN_UINT32(100, fsm_port_os_handle.uptime_ms() - ts);
+	TEST_ASSERT_EQUAL_UINT32(0, fsm_event_dropped(children[0]));
+	TEST_ASSERT_EQUAL_UINT32(1, fsm_event_dropped(children[1]));
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	TEST_ASSERT_EQUAL_UINT32(FANOUT_CHILDREN, fanout_received);
+
+	// Blocks still queued at the children outlive the parent
+	for(int i = 0; i < FANOUT_CHILDREN; i++) {
+		TEST_ASSERT_EQUAL_INT(
+			fsm_event_send_prio(children[i], FSM_PRIO_HIGH, TEST_EVENT, NULL, 0, 0), 0);
+	}
+	TEST_ASSERT_EQUAL_INT(fsm_event_send_copy(fsm, COPY_EVT, buf, sizeof(buf)), 0);
+	fanout_received = 0;
+	fsm_poll(fsm);
+	TEST_ASSERT_EQUAL_UINT32(1, fanout_received);
+	for(int i = 0; i < FANOUT_CHILDREN; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_state_child_fsm_del(state1, children[i]), 0);
+	}
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+	for(int i = 0; i < FANOUT_CHILDREN; i++) {
+		fsm_poll(children[i]);
+		TEST_ASSERT_EQUAL_UINT32(i + 2, fanout_received);
+		TEST_ASSERT_EQUAL_UINT8(3, fanout_last[i + 1]);
+		TEST_ASSERT_EQUAL_INT(fsm_del(&children[i]), 0);
+	}
+}
+
+#define SUB_EVT_SMALL 7
+
+static uint32_t sub_received[3];
+
+static void sub_handler_0(event_t event) {
+	sub_received[0]++;
+}
+
+static void sub_handler_1(event_t event) {
+	sub_received[1]++;
+}
+
+static void sub_handler_2(event_t event) {
+	sub_received[2]++;
+}
+
+TEST_CASE("Child FSM subscription filters", "[fsm]") {
+	static const state_handler_t handlers[3] = { sub_handler_0, sub_handler_1, sub_handler_2 };
+	fsm_t fsm = fsm_new("Subscribing FSM");
+	fsm_t children[3];
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(fsm, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, STATE_1_ID, NULL), 0);
+	state_t state1 = fsm_get_state(fsm, STATE_1_ID);
+	for(int i = 0; i < 3; i++) {
+		children[i] = fsm_new("Subscribed child FSM");
+		TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(children[i], FSM_NO_POLL), 0);
+		TEST_ASSERT_EQUAL_INT(fsm_state_add(children[i], STATE_3_NAME, STATE_3_ID, handlers[i]), 0);
+		TEST_ASSERT_EQUAL_INT(fsm_state_child_fsm_add(state1, children[i]), 0);
+	}
+	// Child 0 takes a large type from the hash set, child 1 a small one from the bitset, child 2
+	// has no subscriptions and takes everything
+	TEST_ASSERT_EQUAL_INT(fsm_event_subscribe(children[0], TEST_EVENT), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_event_subscribe(children[1], SUB_EVT_SMALL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_event_subscribe(children[1], SUB_EVT_SMALL), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	memset(sub_received, 0, sizeof(sub_received));
+
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TEST_EVENT, NULL, 0), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, SUB_EVT_SMALL, NULL, 0), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, SUB_EVT_SMALL + 1, NULL, 0), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	TEST_ASSERT_EQUAL_UINT32(1, sub_received[0]);
+	TEST_ASSERT_EQUAL_UINT32(1, sub_received[1]);
+	TEST_ASSERT_EQUAL_UINT32(3, sub_received[2]);
+
+	// Direct sends are not filtered, and without subscriptions everything passes again
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(children[0], SUB_EVT_SMALL, NULL, 0), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_event_unsubscribe(children[1], SUB_EVT_SMALL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_event_unsubscribe(children[1], SUB_EVT_SMALL), -1);
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TEST_EVENT, NULL, 0), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	TEST_ASSERT_EQUAL_UINT32(3, sub_received[0]);
+	TEST_ASSERT_EQUAL_UINT32(2, sub_received[1]);
+	TEST_ASSERT_EQUAL_UINT32(4, sub_received[2]);
+
+	for(int i = 0; i < 3; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_state_child_fsm_del(state1, children[i]), 0);
+		TEST_ASSERT_EQUAL_INT(fsm_del(&children[i]), 0);
+	}
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+}
+
+static void stats_handler(event_t event) {
+	if(event->type == TEST_EVENT && event->data) {
+		sysdelay_ms(2);
+	}
+}
+
+TEST_CASE("Runtime statistics", "[fsm]") {
+	static uint8_t slow = 1;
+	fsm_t		   fsm	= fsm_new("Statistics FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(fsm, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, STATE_1_ID, stats_handler), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_2_NAME, STATE_2_ID, stats_handler), 0);
+	state_t state1 = fsm_get_state(fsm, STATE_1_ID);
+	state_t state2 = fsm_get_state(fsm, STATE_2_ID);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+
+	struct fsm_stats	   stats;
+	struct fsm_state_stats state_stats;
+#if FSM_USE_STATS
+	// Fill the normal lane, then fail once without waiting and once after a timeout
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TEST_EVENT, &slow, 0), 0);
+	while(fsm_event_try_send(fsm, TEST_EVENT, NULL, 0) == 0) {
+	}
+	TEST_ASSERT_NOT_EQUAL(fsm_event_send_timeout(fsm, TEST_EVENT, NULL, 0, 5), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_event_send_prio(fsm, FSM_PRIO_HIGH, TEST_EVENT, NULL, 0, 0), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	TEST_ASSERT_EQUAL_INT(fsm_get_stats(fsm, &stats), 0);
+	TEST_ASSERT_EQUAL_UINT32(17, stats.events_sent);
+	TEST_ASSERT_EQUAL_UINT32(17, stats.events_received);
+	TEST_ASSERT_EQUAL_UINT32(1, stats.events_dropped);
+	TEST_ASSERT_EQUAL_UINT32(1, stats.events_timed_out);
+	TEST_ASSERT_EQUAL_UINT32(1, stats.queue_high_water[FSM_PRIO_HIGH]);
+	TEST_ASSERT_EQUAL_UINT32(16, stats.queue_high_water[FSM_PRIO_NORMAL]);
+	TEST_ASSERT_EQUAL_UINT32(0, stats.queue_high_water[FSM_PRIO_LOW]);
+	TEST_ASSERT_EQUAL_INT(fsm_state_get_stats(state1, &state_stats), 0);
+	TEST_ASSERT_EQUAL_UINT32(1, state_stats.enter_count);
+	TEST_ASSERT_EQUAL_UINT32(17, state_stats.handler_count);
+	TEST_ASSERT_TRUE(state_stats.handler_max_us >= 2000);
+	TEST_ASSERT_TRUE(state_stats.handler_total_us >= state_stats.handler_max_us);
+	TEST_ASSERT_EQUAL_UINT32(0, state_stats.dwell_total_ms);
+
+	// Dwell time is booked when the visit ends
+	sysdelay_ms(10);
+	TEST_ASSERT_EQUAL_INT(fsm_switch(fsm, STATE_2_ID), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	TEST_ASSERT_EQUAL_INT(fsm_state_get_stats(state1, &state_stats), 0);
+	TEST_ASSERT_TRUE(state_stats.dwell_total_ms >= 10);
+	TEST_ASSERT_EQUAL_UINT32(state_stats.dwell_total_ms, state_stats.dwell_max_ms);
+	TEST_ASSERT_EQUAL_INT(fsm_state_get_stats(state2, &state_stats), 0);
+	TEST_ASSERT_EQUAL_UINT32(1, state_stats.enter_count);
+	TEST_ASSERT_EQUAL_UINT32(0, state_stats.handler_count);
+#else
+	TEST_ASSERT_EQUAL_INT(fsm_get_stats(fsm, &stats), -1);
+	TEST_ASSERT_EQUAL_INT(fsm_state_get_stats(state2, &state_stats), -1);
+	(void)slow;
+	(void)state1;
+#endif
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+}
+
+TEST_CASE("Binary trace ring", "[fsm]") {
+	struct fsm_trace_record records[8];
+	char					line[80];
+	uint32_t				cursor = 0;
+	fsm_t					fsm	   = fsm_new("Trace FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(fsm, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, STATE_1_ID, stats_handler), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_2_NAME, STATE_2_ID, stats_handler), 0);
+	uint32_t id = fsm_get_trace_id(fsm);
+	TEST_ASSERT_NOT_EQUAL(0, id);
+
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TEST_EVENT, NULL, 0), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+	TEST_ASSERT_EQUAL_INT(fsm_switch(fsm, STATE_2_ID), 0);
+	fsm_poll_ex(fsm, FSM_POLL_NO_LIMIT, FSM_POLL_NO_LIMIT, NULL);
+#if FSM_USE_TRACE
+	TEST_ASSERT_EQUAL_UINT32(3, fsm_trace_read(fsm, &cursor, records, 8));
+	TEST_ASSERT_EQUAL_UINT32(FSM_TRACE_SWITCH, records[0].kind);
+	TEST_ASSERT_EQUAL_UINT32(id, records[0].fsm_id);
+	TEST_ASSERT_EQUAL_UINT32(STATE_ID_ROOT, records[0].from);
+	TEST_ASSERT_EQUAL_UINT32(STATE_1_ID, records[0].to);
+	TEST_ASSERT_EQUAL_UINT32(FSM_TRACE_EVENT, records[1].kind);
+	TEST_ASSERT_EQUAL_UINT32(TEST_EVENT, records[1].type);
+	TEST_ASSERT_EQUAL_UINT32(STATE_1_ID, records[1].to);
+	TEST_ASSERT_EQUAL_UINT32(FSM_TRACE_SWITCH, records[2].kind);
+	TEST_ASSERT_EQUAL_UINT32(STATE_2_ID, records[2].to);
+	TEST_ASSERT_EQUAL_UINT32(records[0].seq + 2, records[2].seq);
+	TEST_ASSERT_TRUE(fsm_trace_format(&records[2], line, sizeof(line)) > 0);
+	TEST_ASSERT_NOT_NULL(strstr(line, "{5}==>{2}"));
+
+	// Overwritten records are skipped and show as a gap
+	uint32_t start = cursor;
+	for(int i = 0; i < FSM_TRACE_LENGTH + 4; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TEST_EVENT, NULL, 0), 0);
+		fsm_poll(fsm);
+	}
+	TEST_ASSERT_EQUAL_UINT32(8, fsm_trace_read(fsm, &cursor, records, 8));
+	TEST_ASSERT_EQUAL_UINT32(start + 4, records[0].seq);
+
+	// Rings of several FSMs merge into one trace ordered by time
+	fsm_t	 other		= fsm_new("Other trace FSM");
+	fsm_t	 fsms[2]	= { fsm, other };
+	uint32_t cursors[2] = { cursor, 0 };
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(other, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(other, STATE_1_NAME, STATE_1_ID, stats_handler), 0);
+	while(fsm_trace_read(fsm, &cursors[0], records, 8) > 0) {
+	}
+	fsm_poll(other);
+	for(int i = 0; i < 3; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_event_send(fsm, TEST_EVENT, NULL, 0), 0);
+		fsm_poll(fsm);
+		TEST_ASSERT_EQUAL_INT(fsm_event_send(other, TEST_EVENT, NULL, 0), 0);
+		fsm_poll(other);
+	}
+	// Records of the same microsecond may come in either order
+	TEST_ASSERT_EQUAL_UINT32(7, fsm_trace_merge(fsms, 2, cursors, records, 8));
+	uint32_t switches = 0;
+	for(int i = 0; i < 7; i++) {
+		if(records[i].kind == FSM_TRACE_SWITCH) {
+			TEST_ASSERT_EQUAL_UINT32(fsm_get_trace_id(other), records[i].fsm_id);
+			TEST_ASSERT_EQUAL_UINT32(records[0].timestamp_us, records[i].timestamp_us);
+			switches++;
+		}
+		if(i > 0) {
+			TEST_ASSERT_TRUE((int32_t)(records[i].timestamp_us - records[i - 1].timestamp_us)
+							 >= 0);
+		}
+	}
+	TEST_ASSERT_EQUAL_UINT32(1, switches);
+	TEST_ASSERT_EQUAL_UINT32(0, fsm_trace_merge(fsms, 2, cursors, records, 8));
+	TEST_ASSERT_EQUAL_INT(fsm_del(&other), 0);
+#else
+	TEST_ASSERT_EQUAL_UINT32(0, fsm_trace_read(fsm, &cursor, records, 8));
+	(void)line;
+#endif
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+}
+
+TEST_CASE("Deferred logging", "[fsm]") {
+	fsm_t fsm = fsm_new("Logging FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(fsm, FSM_NO_POLL), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_1_NAME, STATE_1_ID, stats_handler), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, STATE_2_NAME, STATE_2_ID, stats_handler), 0);
+	fsm_port_log_flush();
+
+	// A refused switch request is queued with the FSM lock held and formatted on flush
+	TEST_ASSERT_EQUAL_INT(fsm_switch(fsm, STATE_2_ID), 0);
+#if FSM_LOG_DEFERRED && FSM_LOG_LEVEL >= FSM_DBG_LVL_RAW
+	TEST_ASSERT_EQUAL_UINT32(1, fsm_port_log_flush());
+#endif
+
+	// Filtered messages are neither formatted nor queued
+	fsm_port_set_print_level(FSM_DBG_LVL_ERR);
+	TEST_ASSERT_EQUAL_INT(fsm_switch(fsm, STATE_2_ID), 0);
+	TEST_ASSERT_EQUAL_UINT32(0, fsm_port_log_flush());
+	fsm_port_set_print_level(FSM_DBG_LVL_RAW);
+
+#if FSM_LOG_DEFERRED
+	// A full queue drops messages instead of blocking
+	uint32_t dropped = fsm_port_log_dropped();
+	for(int i = 0; i < 100; i++) {
+		OS_LOG_ERR(&fsm_port_os_handle, "Deferred message %d of %s", i, STATE_1_NAME);
+	}
+	TEST_ASSERT_NOT_EQUAL(dropped, fsm_port_log_dropped());
+	TEST_ASSERT_TRUE(fsm_port_log_flush() > 0);
+	TEST_ASSERT_EQUAL_UINT32(0, fsm_port_log_flush());
+#endif
+#if FSM_LOG_DEFERRED
+	// The port drain prints messages that nobody flushes, and can be stopped again
+	fsm_port_log_drain(true);
+	OS_LOG_ERR(&fsm_port_os_handle, "Drained message of %s", STATE_1_NAME);
+	fsm_port_os_handle.delay_ms(100);
+	TEST_ASSERT_EQUAL_UINT32(0, fsm_port_log_flush());
+	fsm_port_log_drain(false);
+	OS_LOG_ERR(&fsm_port_os_handle, "Undrained message of %s", STATE_1_NAME);
+	fsm_port_os_handle.delay_ms(20);
+	TEST_ASSERT_EQUAL_UINT32(1, fsm_port_log_flush());
+#endif
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+}
+
+TEST_CASE("Slab allocation of FSMs and states", "[fsm]") {
+	struct fsm_slab_stats fsm_before, state_before, stats;
+	fsm_t				  fsms[5];
+	TEST_ASSERT_EQUAL_INT(fsm_slab_get_stats(FSM_SLAB_FSM, &fsm_before), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_slab_get_stats(FSM_SLAB_STATE, &state_before), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_slab_reserve(FSM_SLAB_FSM, 4, 0), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_slab_reserve(FSM_SLAB_STATE, 4, 4), 0);
+
+	// An FSM from the slab brings its lock and its lanes, creating it needs no heap
+	uint32_t heap_calls = fsm_port_heap_calls();
+	fsms[0]				= fsm_new("Slab FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsms[0]), 0);
+	TEST_ASSERT_EQUAL_UINT32(heap_calls, fsm_port_heap_calls());
+
+	// The fifth FSM falls back to the heap, the state slab grows by a chunk
+	for(int i = 0; i < 5; i++) {
+		fsms[i] = fsm_new("Slab FSM");
+		TEST_ASSERT_EQUAL_INT(fsm_state_add(fsms[i], STATE_1_NAME, STATE_1_ID, stats_handler), 0);
+		fsm_poll(fsms[i]);
+	}
+	TEST_ASSERT_EQUAL_INT(fsm_slab_get_stats(FSM_SLAB_FSM, &stats), 0);
+	TEST_ASSERT_EQUAL_UINT32(fsm_before.capacity + 4, stats.capacity);
+	TEST_ASSERT_EQUAL_UINT32(fsm_before.used + 4, stats.used);
+	TEST_ASSERT_EQUAL_UINT32(fsm_before.exhausted + 1, stats.exhausted);
+	TEST_ASSERT_TRUE(stats.object_size >= 64);
+	TEST_ASSERT_EQUAL_INT(fsm_slab_get_stats(FSM_SLAB_STATE, &stats), 0);
+	TEST_ASSERT_EQUAL_UINT32(state_before.used + 5, stats.used);
+	TEST_ASSERT_EQUAL_UINT32(state_before.chunks + 2, stats.chunks);
+	TEST_ASSERT_EQUAL_UINT32(state_before.exhausted, stats.exhausted);
+
+	// Deleted objects go back to their slab and are reused
+	for(int i = 0; i < 5; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_del(&fsms[i]), 0);
+	}
+	TEST_ASSERT_EQUAL_INT(fsm_slab_get_stats(FSM_SLAB_FSM, &stats), 0);
+	TEST_ASSERT_EQUAL_UINT32(fsm_before.used, stats.used);
+	uint32_t used_max = stats.used_max;
+	fsms[0]			  = fsm_new("Slab FSM");
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsms[0]), 0);
+	TEST_ASSERT_EQUAL_INT(fsm_slab_get_stats(FSM_SLAB_FSM, &stats), 0);
+	TEST_ASSERT_EQUAL_UINT32(used_max, stats.used_max);
+	TEST_ASSERT_EQUAL_INT(fsm_slab_get_stats(FSM_SLAB_STATE, &stats), 0);
+	TEST_ASSERT_EQUAL_UINT32(state_before.used, stats.used);
+}
+
+TEST_CASE("FSM from a state table in one allocation", "[fsm]") {
+	char				   names[3][16];
+	struct state_def	   table[3];
+	const struct state_def twins[] = {
+		STATE(STATE_1_ID, STATE_1_NAME, NULL, stats_handler, NULL),
+		STATE(STATE_1_ID, STATE_2_NAME, NULL, stats_handler, NULL),
+	};
+	for(int i = 0; i < 3; i++) {
+		snprintf(names[i], sizeof(names[i]), "Table state %d", i);
+		struct state_def def = STATE(100 + i, names[i], NULL, stats_handler, NULL);
+		table[i]			 = def;
+	}
+
+	uint32_t heap_calls = fsm_port_heap_calls();
+	TEST_ASSERT_NULL(fsm_new_from_table("Table FSM", twins, 2));
+	TEST_ASSERT_EQUAL_UINT32(heap_calls + 2, fsm_port_heap_calls());
+
+	heap_calls = fsm_port_heap_calls();
+	fsm_t fsm  = fsm_new_from_table("Table FSM", table, 3);
+	TEST_ASSERT_NOT_NULL(fsm);
+	TEST_ASSERT_EQUAL_UINT32(heap_calls + 1, fsm_port_heap_calls());
+	// Names are copied, the table may go away
+	memset(names, 0, sizeof(names));
+	TEST_ASSERT_EQUAL_PTR(fsm_get_state(fsm, 101), fsm_get_state_by_name(fsm, "Table state 1"));
+	fsm_poll(fsm);
+	struct state_info info;
+	fsm_get_current_state(fsm, &info);
+	TEST_ASSERT_EQUAL_UINT32(100, info.id);
+	TEST_ASSERT_EQUAL_INT(fsm_switch_by_name(fsm, "Table state 2"), 0);
+	fsm_poll(fsm);
+	fsm_get_current_state(fsm, &info);
+	TEST_ASSERT_EQUAL_UINT32(102, info.id);
+	TEST_ASSERT_NOT_EQUAL(0, fsm_state_del(fsm, 101));
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+	TEST_ASSERT_EQUAL_UINT32(heap_calls + 2, fsm_port_heap_calls());
+
+	// States added later outgrow the indexes of the block, which move to the heap
+	fsm = fsm_new_from_table("Table FSM", twins, 1);
+	TEST_ASSERT_NOT_NULL(fsm);
+	for(int i = 0; i < 16; i++) {
+		snprintf(names[0], sizeof(names[0]), "Added state %d", i);
+		TEST_ASSERT_EQUAL_INT(fsm_state_add(fsm, names[0], 200 + i, stats_handler), 0);
+	}
+	TEST_ASSERT_NOT_NULL(fsm_get_state(fsm, STATE_1_ID));
+	TEST_ASSERT_EQUAL_PTR(fsm_get_state(fsm, 215), fsm_get_state_by_name(fsm, "Added state 15"));
+	TEST_ASSERT_EQUAL_INT(fsm_del(&fsm), 0);
+}
+
+struct graph_device {
+	uint32_t events;
+	uint32_t enters;
+	uint32_t last_type;
+};
+
+static void graph_idle_handler(fsm_inst_t inst, void *context, event_t event) {
+	struct graph_device *device = context;
+	if(event->type == FSM_EVT_ENTER) {
+		device->enters++;
+	} else if(event->type == 2) {
+		fsm_inst_switch(inst, 2);
+	} else if(event->type != FSM_EVT_EXIT) {
+		device->events++;
+		device->last_type = event->type;
+	}
+}
+
+static void graph_busy_handler(fsm_inst_t inst, void *context, event_t event) {
+	struct graph_device *device = context;
+	if(event->type == FSM_EVT_ENTER) {
+		device->enters++;
+		fsm_inst_timer_start(inst, 3, 0, 0);
+	} else if(event->type == 3) {
+		fsm_inst_switch(inst, 1);
+	}
+}
+
+TEST_CASE("Instances of a shared state graph", "[fsm]") {
+	static const struct fsm_graph_state_def table[] = {
+		GRAPH_STATE(1, "Graph idle", NULL, graph_idle_handler, NULL, FSM_NO_POLL),
+		GRAPH_STATE(2, "Graph busy", NULL, graph_busy_handler, NULL, FSM_NO_POLL),
+	};
+	static const struct fsm_graph_state_def twins[] = {
+		GRAPH_STATE(1, "Graph idle", NULL, graph_idle_handler, NULL, FSM_NO_POLL),
+		GRAPH_STATE(1, "Graph busy", NULL, graph_busy_handler, NULL, FSM_NO_POLL),
+	};
+	struct graph_device devices[8];
+	uint64_t			storage[8][32];
+	fsm_inst_t			insts[8];
+	struct state_info	info;
+	memset(devices, 0, sizeof(devices));
+	TEST_ASSERT_NULL(fsm_graph_new("Device", twins, 2, 4));
+	fsm_graph_t graph = fsm_graph_new("Device", table, 2, 4);
+	TEST_ASSERT_NOT_NULL(graph);
+	TEST_ASSERT_TRUE(fsm_graph_inst_size(graph) <= sizeof(storage[0]));
+
+	// Instances in caller storage need no heap, each handler sees its own context
+	uint32_t heap_calls = fsm_port_heap_calls();
+	for(int i = 0; i < 8; i++) {
+		insts[i] = fsm_inst_init(graph, &devices[i], storage[i], sizeof(storage[i]));
+		TEST_ASSERT_NOT_NULL(insts[i]);
+		fsm_inst_get_current_state(insts[i], &info);
+		TEST_ASSERT_EQUAL_UINT32(STATE_ID_ROOT, info.id);
+		fsm_inst_poll(insts[i]);
+		TEST_ASSERT_EQUAL_INT(fsm_inst_event_send(insts[i], 10 + i, NULL, 0), 0);
+	}
+	for(int i = 0; i < 8; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_inst_poll(insts[i]), 1);
+		TEST_ASSERT_EQUAL_UINT32(1, devices[i].enters);
+		TEST_ASSERT_EQUAL_UINT32(1, devices[i].events);
+		TEST_ASSERT_EQUAL_UINT32(10 + i, devices[i].last_type);
+		TEST_ASSERT_EQUAL_PTR(&devices[i], fsm_inst_get_context(insts[i]));
+	}
+	TEST_ASSERT_EQUAL_UINT32(heap_calls, fsm_port_heap_calls());
+
+	// A full mailbox refuses events
+	for(int i = 0; i < 4; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_inst_event_send(insts[0], 20, NULL, 0), 0);
+	}
+	TEST_ASSERT_EQUAL_INT(fsm_inst_event_send(insts[0], 20, NULL, 0), -1);
+	TEST_ASSERT_EQUAL_UINT32(0, fsm_inst_next_deadline(insts[0]));
+	TEST_ASSERT_EQUAL_INT(fsm_inst_poll(insts[0]), 4);
+	TEST_ASSERT_EQUAL_UINT32(FSM_NO_DEADLINE, fsm_inst_next_deadline(insts[0]));
+
+	// The switch to busy starts a timer that switches back on the next poll
+	TEST_ASSERT_EQUAL_INT(fsm_inst_switch(insts[1], 99), -1);
+	TEST_ASSERT_EQUAL_INT(fsm_inst_event_send(insts[1], 2, NULL, 0), 0);
+	fsm_inst_poll(insts[1]);
+	fsm_inst_get_current_state(insts[1], &info);
+	TEST_ASSERT_EQUAL_UINT32(2, info.id);
+	TEST_ASSERT_TRUE(FSM_NAME_IS(info.name, "Graph busy"));
+	TEST_ASSERT_EQUAL_UINT32(0, fsm_inst_next_deadline(insts[1]));
+	fsm_inst_poll(insts[1]);
+	fsm_inst_get_current_state(insts[1], &info);
+	TEST_ASSERT_EQUAL_UINT32(1, info.id);
+	TEST_ASSERT_EQUAL_UINT32(3, devices[1].enters);
+
+	// The graph outlives its instances
+	fsm_inst_t heap_inst = fsm_inst_new(graph, NULL);
+	TEST_ASSERT_NOT_NULL(heap_inst);
+	TEST_ASSERT_EQUAL_INT(fsm_graph_del(&graph), -3);
+	TEST_ASSERT_EQUAL_INT(fsm_inst_del(&heap_inst), 0);
+	for(int i = 0; i < 8; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_inst_deinit(insts[i]), 0);
+	}
+	TEST_ASSERT_EQUAL_INT(fsm_graph_del(&graph), 0);
+	TEST_ASSERT_NULL(graph);
+}
+
+TEST_CASE("Lock-free state snapshots", "[fsm]") {
+	fsm_t				fsms[3];
+	struct fsm_snapshot snaps[3];
+	struct state_info	info;
+	for(int i = 0; i < 3; i++) {
+		fsms[i] = fsm_new("Snapshot FSM");
+		TEST_ASSERT_EQUAL_INT(fsm_change_default_poll_interval(fsms[i], FSM_NO_POLL), 0);
+		TEST_ASSERT_EQUAL_INT(fsm_state_add(fsms[i], STATE_1_NAME, STATE_1_ID, stats_handler), 0);
+		TEST_ASSERT_EQUAL_INT(fsm_state_add(fsms[i], STATE_2_NAME, STATE_2_ID, stats_handler), 0);
+	}
+	// The first state is pending until the first poll
+	TEST_ASSERT_EQUAL_INT(fsm_get_snapshot(fsms[0], &snaps[0]), 0);
+	TEST_ASSERT_EQUAL_UINT32(STATE_ID_ROOT, snaps[0].curr.id);
+	TEST_ASSERT_TRUE(snaps[0].has_next);
+	TEST_ASSERT_EQUAL_UINT32(STATE_1_ID, snaps[0].next.id);
+	TEST_ASSERT_EQUAL_UINT32(0, snaps[0].switches);
+
+	fsm_poll(fsms[0]);
+	fsm_poll(fsms[1]);
+	TEST_ASSERT_EQUAL_INT(fsm_switch(fsms[1], STATE_2_ID), 0);
+	TEST_ASSERT_EQUAL_UINT32(3, fsm_get_snapshots(fsms, snaps, 3));
+	TEST_ASSERT_EQUAL_UINT32(STATE_1_ID, snaps[0].curr.id);
+	TEST_ASSERT_TRUE(FSM_NAME_IS(snaps[0].curr.name, STATE_1_NAME));
+	TEST_ASSERT_EQUAL_UINT32(STATE_ID_ROOT, snaps[0].prev.id);
+	TEST_ASSERT_FALSE(snaps[0].has_next);
+	TEST_ASSERT_EQUAL_UINT32(1, snaps[0].switches);
+	TEST_ASSERT_EQUAL_UINT32(STATE_1_ID, snaps[1].curr.id);
+	TEST_ASSERT_TRUE(snaps[1].has_next);
+	TEST_ASSERT_EQUAL_UINT32(STATE_2_ID, snaps[1].next.id);
+	TEST_ASSERT_EQUAL_UINT32(STATE_ID_ROOT, snaps[2].curr.id);
+
+	fsm_poll(fsms[1]);
+	fsm_get_current_state(fsms[1], &info);
+	TEST_ASSERT_EQUAL_UINT32(STATE_2_ID, info.id);
+	TEST_ASSERT_EQUAL_INT(fsm_get_snapshot(fsms[1], &snaps[1]), 0);
+	TEST_ASSERT_EQUAL_UINT32(STATE_1_ID, snaps[1].prev.id);
+	TEST_ASSERT_FALSE(snaps[1].has_next);
+	TEST_ASSERT_EQUAL_UINT32(2, snaps[1].switches);
+	for(int i = 0; i < 3; i++) {
+		TEST_ASSERT_EQUAL_INT(fsm_del(&fsms[i]), 0);
+	}
+}
+
 #ifdef __cplusplus
 }
 #endif